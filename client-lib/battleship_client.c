@@ -1,4 +1,5 @@
 #include "battleship_client.h"
+#include "battleship_messages.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <netdb.h>  // For getaddrinfo (DNS resolution)
+#include <zlib.h>   // WIRE_OP_JSON_DEFLATE
 
 BattleshipClient* client_create() {
     BattleshipClient* client = (BattleshipClient*)malloc(sizeof(BattleshipClient));
@@ -20,6 +22,8 @@ BattleshipClient* client_create() {
     client->socket_fd = -1;
     client->connected = 0;
     client->recv_offset = 0;
+    client->protocol = CLIENT_PROTO_JSON;
+    client->frame_pending = 0;
     memset(client->buffer, 0, sizeof(client->buffer));
     memset(client->recv_buffer, 0, sizeof(client->recv_buffer));
     
@@ -80,15 +84,10 @@ int client_connect(BattleshipClient* client, const char* host, int port) {
     return 0;
 }
 
-int client_send(BattleshipClient* client, const char* message) {
-    if (!client || !client->connected || !message) return -1;
-    
-    int len = strlen(message);
+static int send_all(BattleshipClient* client, const void* data, int len) {
     int total_sent = 0;
-    
-    // Gửi message
     while (total_sent < len) {
-        int sent = send(client->socket_fd, message + total_sent, len - total_sent, 0);
+        int sent = send(client->socket_fd, (const char*)data + total_sent, len - total_sent, 0);
         if (sent < 0) {
             perror("send");
             client->connected = 0;
@@ -96,6 +95,30 @@ int client_send(BattleshipClient* client, const char* message) {
         }
         total_sent += sent;
     }
+    return total_sent;
+}
+
+// Một binary frame: header (varint length + opcode) rồi body
+static int send_frame(BattleshipClient* client, int opcode, const void* body, int len) {
+    unsigned char header[WIRE_MAX_HEADER];
+    int header_len = wire_put_header(header, len, opcode);
+    if (send_all(client, header, header_len) < 0) return -1;
+    if (len > 0 && send_all(client, body, len) < 0) return -1;
+    return len;
+}
+
+int client_send(BattleshipClient* client, const char* message) {
+    if (!client || !client->connected || !message) return -1;
+    
+    int len = strlen(message);
+    
+    // Binary mode: JSON đi trong frame WIRE_OP_JSON, không cần newline
+    if (client->protocol == CLIENT_PROTO_BINARY) {
+        return send_frame(client, WIRE_OP_JSON, message, len);
+    }
+    
+    // Gửi message
+    if (send_all(client, message, len) < 0) return -1;
     
     // Gửi newline để server phân biệt messages (giống như Node.js server làm)
     if (send(client->socket_fd, "\n", 1, 0) < 0) {
@@ -104,25 +127,70 @@ int client_send(BattleshipClient* client, const char* message) {
         return -1;
     }
     
-    return total_sent;
+    return len;
 }
 
-int client_receive(BattleshipClient* client, char* out_buffer, int max_len) {
-    if (!client || !client->connected || !out_buffer) return -1;
+int client_request_binary(BattleshipClient* client) {
+    char message[64];
+    bs_encode_REQ_HELLO(message, sizeof(message), "binary", "");
+    return client_send(client, message);
+}
+
+int client_request_compression(BattleshipClient* client) {
+    char message[96];
+    bs_encode_REQ_HELLO(message, sizeof(message), "binary", "deflate");
+    return client_send(client, message);
+}
+
+int client_send_move(BattleshipClient* client, int row, int col) {
+    if (!client || !client->connected) return -1;
+    if (client->protocol == CLIENT_PROTO_BINARY) {
+        unsigned char body[2] = { (unsigned char)row, (unsigned char)col };
+        return send_frame(client, WIRE_OP_MOVE, body, 2);
+    }
+    char coord[BS_COORD_SIZE], message[64];
+    snprintf(coord, sizeof(coord), "%c%d", 'A' + row, col);
+    bs_encode_REQ_MOVE(message, sizeof(message), coord);
+    return client_send(client, message);
+}
+
+int client_send_ping(BattleshipClient* client) {
+    if (!client || !client->connected) return -1;
+    if (client->protocol == CLIENT_PROTO_BINARY) {
+        return send_frame(client, WIRE_OP_PING, NULL, 0);
+    }
+    return client_send(client, "{\"cmd\":\"PING\",\"payload\":{}}");
+}
+
+int client_send_batch(BattleshipClient* client, const char* const* messages, int count) {
+    if (!client || !client->connected || !messages) return -1;
     
-    // Đọc thêm data từ socket vào recv_buffer
+    char batch[4096]; // BUFFER_SIZE của server
+    BsWriter w;
+    bs_writer_init(&w, batch, sizeof(batch));
+    bs_put_str(&w, "{\"cmd\":\"BATCH\",\"payload\":{\"commands\":[");
+    for (int i = 0; i < count; i++) {
+        if (i > 0) bs_put(&w, ",", 1);
+        bs_put_str(&w, messages[i]);
+    }
+    bs_put_str(&w, "]}}");
+    if (bs_finish(&w) >= (int)sizeof(batch) - 1) return -1; // chừa chỗ cho newline
+    return client_send(client, batch);
+}
+
+// Đọc thêm data từ socket vào recv_buffer (non-blocking). Returns 0, hoặc -1 nếu lỗi/đóng
+static int fill_recv_buffer(BattleshipClient* client) {
     char temp_buffer[4096];
     int received = recv(client->socket_fd, temp_buffer, sizeof(temp_buffer) - 1, MSG_DONTWAIT);
     
     if (received < 0) {
         if (errno == EWOULDBLOCK || errno == EAGAIN) {
             // No data available (non-blocking mode)
-            received = 0;
-        } else {
-            perror("recv");
-            client->connected = 0;
-            return -1;
+            return 0;
         }
+        perror("recv");
+        client->connected = 0;
+        return -1;
     } else if (received == 0) {
         // Connection closed by server
         printf("Server closed connection\n");
@@ -130,28 +198,150 @@ int client_receive(BattleshipClient* client, char* out_buffer, int max_len) {
         return -1;
     }
     
-    if (received > 0) {
-        temp_buffer[received] = '\0';
+    // Append vào recv_buffer
+    if (client->recv_offset + received < (int)sizeof(client->recv_buffer)) {
+        memcpy(client->recv_buffer + client->recv_offset, temp_buffer, received);
+        client->recv_offset += received;
+        client->recv_buffer[client->recv_offset] = '\0';
+    } else {
+        fprintf(stderr, "Buffer overflow! Clearing buffer.\n");
+        client->recv_offset = 0;
+        client->recv_buffer[0] = '\0';
+    }
+    return 0;
+}
+
+// Xóa len byte đầu recv_buffer (message đã xử lý)
+static void consume_recv_buffer(BattleshipClient* client, int len) {
+    int remaining = client->recv_offset - len;
+    if (remaining > 0) {
+        memmove(client->recv_buffer, client->recv_buffer + len, remaining);
+        client->recv_offset = remaining;
+    } else {
+        client->recv_offset = 0;
+    }
+    client->recv_buffer[client->recv_offset] = '\0';
+}
+
+// Tìm frame hoàn chỉnh tiếp theo; HEARTBEAT được trả lời luôn ở đây.
+// Returns frame size, 0 nếu chưa đủ, -1 nếu frame lỗi
+static int next_binary_frame(BattleshipClient* client, WireFrame* frame) {
+    for (;;) {
+        int size = wire_parse_frame((const unsigned char*)client->recv_buffer, client->recv_offset,
+                                    sizeof(client->recv_buffer) - 1, frame);
+        if (size < 0) {
+            fprintf(stderr, "Invalid frame from server\n");
+            client->connected = 0;
+            return -1;
+        }
+        if (size == 0 || frame->opcode != WIRE_OP_HEARTBEAT) return size;
         
-        // Append vào recv_buffer
-        if (client->recv_offset + received < sizeof(client->recv_buffer)) {
-            memcpy(client->recv_buffer + client->recv_offset, temp_buffer, received);
-            client->recv_offset += received;
-            client->recv_buffer[client->recv_offset] = '\0';
-        } else {
-            fprintf(stderr, "Buffer overflow! Clearing buffer.\n");
-            client->recv_offset = 0;
-            client->recv_buffer[0] = '\0';
-            return 0;
+        size_t pos = 0;
+        unsigned long seq;
+        if (wire_read_varint(frame, &pos, &seq)) {
+            unsigned char body[WIRE_MAX_FIELD_VARINT];
+            send_frame(client, WIRE_OP_HEARTBEAT_ACK, body, wire_put_varint(body, seq));
         }
+        consume_recv_buffer(client, size);
     }
+}
+
+// WIRE_OP_JSON_DEFLATE -> JSON text, cắt bớt nếu dài hơn max_len - 1 như JSON mode
+static int inflate_json(const WireFrame* frame, char* out, int max_len) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, -MAX_WBITS) != Z_OK) return -1;
+    inflateSetDictionary(&z, (const Bytef*)WIRE_DEFLATE_DICTIONARY, sizeof(WIRE_DEFLATE_DICTIONARY) - 1);
     
-    // Tìm message hoàn chỉnh (kết thúc bằng \n)
-    char* newline = strchr(client->recv_buffer, '\n');
-    if (newline != NULL) {
-        // Tìm thấy message hoàn chỉnh
-        int msg_len = newline - client->recv_buffer;
+    z.next_in = (Bytef*)frame->body;
+    z.avail_in = frame->len;
+    z.next_out = (Bytef*)out;
+    z.avail_out = max_len - 1;
+    int status = inflate(&z, Z_FINISH);
+    int len = (int)(max_len - 1 - z.avail_out);
+    inflateEnd(&z);
+    
+    if (status != Z_STREAM_END && status != Z_BUF_ERROR) { // Z_BUF_ERROR: out_buffer đầy
+        fprintf(stderr, "Corrupt compressed frame from server\n");
+        return -1;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// Packed frame -> đúng JSON mà server gửi ở JSON mode
+static int frame_to_json(const WireFrame* frame, char* out, int max_len) {
+    size_t pos = 0;
+    unsigned long a = 0, b = 0;
+    
+    switch (frame->opcode) {
+        case WIRE_OP_JSON: {
+            int len = frame->len < (size_t)max_len ? (int)frame->len : max_len - 1;
+            memcpy(out, frame->body, len);
+            out[len] = '\0';
+            return len;
+        }
+        case WIRE_OP_JSON_DEFLATE:
+            return inflate_json(frame, out, max_len);
+        case WIRE_OP_MOVE_RESULT: {
+            if (frame->len < 4 || frame->len < 4u + frame->body[3]) return -1;
+            static const char* results[] = { "MISS", "HIT", "ALREADY_HIT", "ALREADY_HIT" };
+            int flags = frame->body[2];
+            char coord[BS_COORD_SIZE], ship_sunk[BS_NAME_SIZE];
+            snprintf(coord, sizeof(coord), "%c%d", 'A' + frame->body[0], frame->body[1]);
+            snprintf(ship_sunk, sizeof(ship_sunk), "%.*s", frame->body[3], (const char*)frame->body + 4);
+            return bs_encode_MOVE_RESULT(out, max_len, coord, results[flags & WIRE_RESULT_MASK], ship_sunk,
+                                         (flags & WIRE_MOVE_YOUR_SHOT) != 0, (flags & WIRE_MOVE_GAME_OVER) != 0);
+        }
+        case WIRE_OP_TURN_CHANGE:
+            if (frame->len < 1) return -1;
+            return bs_encode_TURN_CHANGE(out, max_len, frame->body[0]);
+        case WIRE_OP_PONG:
+            if (!wire_read_varint(frame, &pos, &a)) return -1;
+            return bs_encode_PONG(out, max_len, (long)a);
+        case WIRE_OP_LATENCY:
+            if (!wire_read_varint(frame, &pos, &a) || !wire_read_varint(frame, &pos, &b)) return -1;
+            return bs_encode_LATENCY(out, max_len, (long)a, (long)b);
+        case WIRE_OP_PING_UPDATE:
+            if (!wire_read_varint(frame, &pos, &a) || !wire_read_varint(frame, &pos, &b)) return -1;
+            return bs_encode_PING_UPDATE(out, max_len, (long)a, (long)b);
+        default:
+            fprintf(stderr, "Unknown opcode 0x%02x from server\n", frame->opcode);
+            return -1;
+    }
+}
+
+int client_receive(BattleshipClient* client, char* out_buffer, int max_len) {
+    if (!client || !client->connected || !out_buffer) return -1;
+    
+    if (client->frame_pending) {
+        consume_recv_buffer(client, client->frame_pending);
+        client->frame_pending = 0;
+    }
+    
+    // Đọc thêm data từ socket vào recv_buffer
+    if (fill_recv_buffer(client) < 0) return -1;
+    
+    for (;;) {
+        if (client->protocol == CLIENT_PROTO_BINARY) {
+            WireFrame frame;
+            int size = next_binary_frame(client, &frame);
+            if (size <= 0) return size;
+            
+            int msg_len = frame_to_json(&frame, out_buffer, max_len);
+            consume_recv_buffer(client, size);
+            if (msg_len < 0) continue;
+            return msg_len < max_len ? msg_len : max_len - 1;
+        }
         
+        // Tìm message hoàn chỉnh (kết thúc bằng \n)
+        char* newline = (char*)memchr(client->recv_buffer, '\n', client->recv_offset);
+        if (!newline) {
+            // Chưa có message hoàn chỉnh
+            return 0;
+        }
+        
+        int msg_len = newline - client->recv_buffer;
         if (msg_len >= max_len) {
             msg_len = max_len - 1;
         }
@@ -161,21 +351,49 @@ int client_receive(BattleshipClient* client, char* out_buffer, int max_len) {
         out_buffer[msg_len] = '\0';
         
         // Xóa message đã xử lý khỏi buffer
-        int remaining = client->recv_offset - msg_len - 1;
-        if (remaining > 0) {
-            memmove(client->recv_buffer, newline + 1, remaining);
-            client->recv_offset = remaining;
-            client->recv_buffer[client->recv_offset] = '\0';
-        } else {
-            client->recv_offset = 0;
-            client->recv_buffer[0] = '\0';
+        consume_recv_buffer(client, newline - client->recv_buffer + 1);
+        
+        // Server đo RTT: trả lời HEARTBEAT ngay tại đây, không đưa lên ứng dụng
+        if (strncmp(out_buffer, "{\"cmd\":\"HEARTBEAT\"", 18) == 0) {
+            JsonDoc doc;
+            Msg_HEARTBEAT heartbeat;
+            if (json_tokenize(&doc, out_buffer, msg_len) == 0 &&
+                bs_decode_HEARTBEAT(&doc, json_find(&doc, 0, "payload"), &heartbeat)) {
+                char ack[64];
+                bs_encode_REQ_HEARTBEAT_ACK(ack, sizeof(ack), heartbeat.seq);
+                client_send(client, ack);
+                continue;
+            }
+        }
+        
+        // HELLO_OK là message JSON cuối cùng; phần còn lại của buffer đã là binary
+        if (strncmp(out_buffer, "{\"cmd\":\"HELLO_OK\"", 17) == 0) {
+            JsonDoc doc;
+            Msg_HELLO_OK hello;
+            if (json_tokenize(&doc, out_buffer, msg_len) == 0 &&
+                bs_decode_HELLO_OK(&doc, json_find(&doc, 0, "payload"), &hello) &&
+                strcmp(hello.protocol, "binary") == 0) {
+                client->protocol = CLIENT_PROTO_BINARY;
+            }
         }
         
         return msg_len;
     }
+}
+
+int client_receive_frame(BattleshipClient* client, WireFrame* frame) {
+    if (!client || !client->connected || !frame || client->protocol != CLIENT_PROTO_BINARY) return -1;
     
-    // Chưa có message hoàn chỉnh
-    return 0;
+    if (client->frame_pending) {
+        consume_recv_buffer(client, client->frame_pending);
+        client->frame_pending = 0;
+    }
+    if (fill_recv_buffer(client) < 0) return -1;
+    
+    int size = next_binary_frame(client, frame);
+    if (size <= 0) return size;
+    client->frame_pending = size; // body stays in recv_buffer until the next call
+    return 1;
 }
 
 int client_set_nonblocking(BattleshipClient* client) {
@@ -205,6 +423,8 @@ void client_disconnect(BattleshipClient* client) {
     
     client->connected = 0;
     client->recv_offset = 0;
+    client->protocol = CLIENT_PROTO_JSON;
+    client->frame_pending = 0;
     memset(client->recv_buffer, 0, sizeof(client->recv_buffer));
 }
 
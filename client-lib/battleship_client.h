@@ -1,12 +1,19 @@
 #ifndef BATTLESHIP_CLIENT_H
 #define BATTLESHIP_CLIENT_H
 
+#include "battleship_wire.h"
+
+#define CLIENT_PROTO_JSON   0
+#define CLIENT_PROTO_BINARY 1
+
 typedef struct {
     int socket_fd;
     char buffer[8192];
     int connected;
     char recv_buffer[8192];  // Buffer for incomplete messages
     int recv_offset;         // Current offset in recv_buffer
+    int protocol;            // CLIENT_PROTO_JSON / CLIENT_PROTO_BINARY (after HELLO_OK)
+    int frame_pending;       // Bytes of the frame last returned by client_receive_frame
 } BattleshipClient;
 
 // Khởi tạo client
@@ -22,6 +29,28 @@ int client_send(BattleshipClient* client, const char* message);
 // Returns: >0 nếu có message hoàn chỉnh, 0 nếu chưa có, -1 nếu lỗi
 int client_receive(BattleshipClient* client, char* out_buffer, int max_len);
 
+// Yêu cầu binary framing (battleship_wire.h); gọi sau WELCOME, trước LOGIN.
+// Thư viện tự chuyển khi nhận HELLO_OK, client_receive vẫn trả về JSON.
+int client_request_binary(BattleshipClient* client);
+
+// Như client_request_binary, và server nén các reply lớn (LEADERBOARD, ...)
+// bằng deflate; client_receive tự giải nén. Cần link zlib (-lz).
+int client_request_compression(BattleshipClient* client);
+
+// Gửi MOVE / PING dạng packed nếu đã chuyển binary, ngược lại gửi JSON
+int client_send_move(BattleshipClient* client, int row, int col);
+int client_send_ping(BattleshipClient* client);
+
+// Gửi nhiều lệnh JSON trong một BATCH (một lần send); server trả về một
+// BATCH_RESULT có "replies" theo đúng thứ tự. Returns -1 nếu quá 4096 byte.
+int client_send_batch(BattleshipClient* client, const char* const* messages, int count);
+
+// Binary mode: nhận frame thô, không chuyển sang JSON (cho bot).
+// frame->body trỏ vào recv_buffer, hợp lệ tới lần receive tiếp theo.
+// Returns: 1 nếu có frame, 0 nếu chưa có, -1 nếu lỗi hoặc chưa ở binary mode
+// (sau client_request_compression, frame có thể là WIRE_OP_JSON_DEFLATE)
+int client_receive_frame(BattleshipClient* client, WireFrame* frame);
+
 // Ngắt kết nối
 void client_disconnect(BattleshipClient* client);
 
@@ -0,0 +1,317 @@
+#ifndef BATTLESHIP_MESSAGES_H
+#define BATTLESHIP_MESSAGES_H
+
+// Message schema shared by the server, client-lib and the Qt client.
+//
+// Each message is listed once in BATTLESHIP_MESSAGES with its fields in
+// BS_FIELDS_<name>. The macros at the bottom expand that into, per message:
+//
+//   Msg_<name>                       struct with fixed-size storage
+//   bs_write_<name>(w, fields...)    JSON into a BsWriter
+//   bs_encode_<name>(out, size, ...) JSON into a buffer, returns the length
+//                                    it needs like snprintf (no trailing '\n')
+//   bs_decode_<name>(doc, payload, m) fields of a json_tokens.h payload object
+//
+// Nothing allocates, the encoders are ordinary typed functions (a missing or
+// mistyped field does not compile), and all three programs share the keys.
+//
+// Field kinds:
+//   STR      char[size], a JSON string (escaped on encode, unescaped on decode)
+//   OPT_STR  like STR, left out of the message when empty
+//   INT      long, a JSON number
+//   BOOL     int, true / false
+//   FLAG     like BOOL, left out of the message when false
+//
+// Messages with arrays (PLACE_SHIPS and the PLAYER_LIST, LEADERBOARD and
+// MATCH_HISTORY replies) and fixed notices are still written by hand, with
+// the same bs_put* calls.
+
+#include <stddef.h>
+#include <string.h>
+#include "json_tokens.h"
+
+#define BS_NAME_SIZE 50       // = USERNAME_SIZE of the server
+#define BS_PASSWORD_SIZE 100
+#define BS_TOKEN_SIZE 64
+#define BS_WORD_SIZE 24       // status, result, reason, protocol...
+#define BS_COORD_SIZE 10
+#define BS_TEXT_SIZE 512      // chat and system messages
+
+#define BS_TO_SERVER 0
+#define BS_TO_CLIENT 1
+
+// X(name, "CMD", direction); names of client -> server messages start with REQ_
+#define BATTLESHIP_MESSAGES(X) \
+    X(REQ_HELLO,             "HELLO",                 BS_TO_SERVER) \
+    X(REQ_REGISTER,          "REGISTER",              BS_TO_SERVER) \
+    X(REQ_LOGIN,             "LOGIN",                 BS_TO_SERVER) \
+    X(REQ_CHALLENGE,         "CHALLENGE",             BS_TO_SERVER) \
+    X(REQ_CHALLENGE_REPLY,   "CHALLENGE_REPLY",       BS_TO_SERVER) \
+    X(REQ_MOVE,              "MOVE",                  BS_TO_SERVER) \
+    X(REQ_CHAT,              "CHAT",                  BS_TO_SERVER) \
+    X(REQ_DRAW_REPLY,        "DRAW_REPLY",            BS_TO_SERVER) \
+    X(REQ_HEARTBEAT_ACK,     "HEARTBEAT_ACK",         BS_TO_SERVER) \
+    X(REQ_LEADERBOARD,       "LEADERBOARD",           BS_TO_SERVER) \
+    X(REQ_PLAYER_LIST,       "PLAYER_LIST",           BS_TO_SERVER) \
+    X(SYSTEM_MSG,            "SYSTEM_MSG",            BS_TO_CLIENT) \
+    X(HELLO_OK,              "HELLO_OK",              BS_TO_CLIENT) \
+    X(LOGIN_SUCCESS,         "LOGIN_SUCCESS",         BS_TO_CLIENT) \
+    X(CHALLENGE,             "CHALLENGE",             BS_TO_CLIENT) \
+    X(CHALLENGE_REPLY,       "CHALLENGE_REPLY",       BS_TO_CLIENT) \
+    X(MATCH_FOUND,           "MATCH_FOUND",           BS_TO_CLIENT) \
+    X(OPPONENT_READY,        "OPPONENT_READY",        BS_TO_CLIENT) \
+    X(GAME_START,            "GAME_START",            BS_TO_CLIENT) \
+    X(GAME_READY,            "GAME_READY",            BS_TO_CLIENT) \
+    X(MOVE_RESULT,           "MOVE_RESULT",           BS_TO_CLIENT) \
+    X(TURN_CHANGE,           "TURN_CHANGE",           BS_TO_CLIENT) \
+    X(CHAT,                  "CHAT",                  BS_TO_CLIENT) \
+    X(DRAW_OFFER,            "DRAW_OFFER",            BS_TO_CLIENT) \
+    X(GAME_END,              "GAME_END",              BS_TO_CLIENT) \
+    X(OPPONENT_DISCONNECTED, "OPPONENT_DISCONNECTED", BS_TO_CLIENT) \
+    X(OPPONENT_RECONNECTED,  "OPPONENT_RECONNECTED",  BS_TO_CLIENT) \
+    X(GAME_RESUMED,          "GAME_RESUMED",          BS_TO_CLIENT) \
+    X(HEARTBEAT,             "HEARTBEAT",             BS_TO_CLIENT) \
+    X(LATENCY,               "LATENCY",               BS_TO_CLIENT) \
+    X(PING_UPDATE,           "PING_UPDATE",           BS_TO_CLIENT) \
+    X(PONG,                  "PONG",                  BS_TO_CLIENT) \
+    X(NOT_MODIFIED,          "NOT_MODIFIED",          BS_TO_CLIENT)
+
+// F(kind, field, size)
+#define BS_FIELDS_REQ_HELLO(F)            F(STR, protocol, BS_WORD_SIZE) F(OPT_STR, compression, BS_WORD_SIZE)
+#define BS_FIELDS_REQ_REGISTER(F)         F(STR, username, BS_NAME_SIZE) F(STR, password, BS_PASSWORD_SIZE)
+#define BS_FIELDS_REQ_LOGIN(F)            F(STR, username, BS_NAME_SIZE) F(STR, password, BS_PASSWORD_SIZE)
+#define BS_FIELDS_REQ_CHALLENGE(F)        F(STR, target_username, BS_NAME_SIZE)
+#define BS_FIELDS_REQ_CHALLENGE_REPLY(F)  F(STR, challenger_username, BS_NAME_SIZE) F(STR, status, BS_WORD_SIZE)
+#define BS_FIELDS_REQ_MOVE(F)             F(STR, coord, BS_COORD_SIZE)
+#define BS_FIELDS_REQ_CHAT(F)             F(STR, message, BS_TEXT_SIZE)
+#define BS_FIELDS_REQ_DRAW_REPLY(F)       F(STR, status, BS_WORD_SIZE)
+#define BS_FIELDS_REQ_HEARTBEAT_ACK(F)    F(INT, seq, 0)
+#define BS_FIELDS_REQ_LEADERBOARD(F)      F(INT, version, 0) // version already held, 0 = none
+#define BS_FIELDS_REQ_PLAYER_LIST(F)      F(INT, version, 0)
+
+#define BS_FIELDS_SYSTEM_MSG(F) \
+    F(INT, code, 0) F(STR, message, BS_TEXT_SIZE) F(OPT_STR, command, BS_WORD_SIZE)
+#define BS_FIELDS_HELLO_OK(F)             F(STR, protocol, BS_WORD_SIZE) F(OPT_STR, compression, BS_WORD_SIZE)
+#define BS_FIELDS_LOGIN_SUCCESS(F) \
+    F(STR, username, BS_NAME_SIZE) F(STR, message, BS_TEXT_SIZE) F(INT, elo, 0) F(STR, sessionToken, BS_TOKEN_SIZE)
+#define BS_FIELDS_CHALLENGE(F)            F(STR, challenger, BS_NAME_SIZE)
+#define BS_FIELDS_CHALLENGE_REPLY(F)      F(STR, player, BS_NAME_SIZE) F(STR, status, BS_WORD_SIZE)
+#define BS_FIELDS_MATCH_FOUND(F)          F(STR, opponent, BS_NAME_SIZE) F(INT, elo, 0)
+#define BS_FIELDS_OPPONENT_READY(F)       F(STR, username, BS_NAME_SIZE)
+#define BS_FIELDS_GAME_START(F)           F(STR, opponent, BS_NAME_SIZE) F(BOOL, your_turn, 0)
+#define BS_FIELDS_GAME_READY(F)           F(STR, message, BS_TEXT_SIZE) F(BOOL, your_turn, 0)
+#define BS_FIELDS_MOVE_RESULT(F) \
+    F(STR, coord, BS_COORD_SIZE) F(STR, result, BS_WORD_SIZE) F(STR, ship_sunk, BS_NAME_SIZE) \
+    F(BOOL, is_your_shot, 0) F(FLAG, game_over, 0)
+#define BS_FIELDS_TURN_CHANGE(F)          F(BOOL, your_turn, 0)
+#define BS_FIELDS_CHAT(F)                 F(STR, from, BS_NAME_SIZE) F(STR, message, BS_TEXT_SIZE)
+#define BS_FIELDS_DRAW_OFFER(F)           F(STR, from, BS_NAME_SIZE)
+#define BS_FIELDS_GAME_END(F) \
+    F(STR, result, BS_WORD_SIZE) F(STR, reason, BS_WORD_SIZE) F(OPT_STR, log_id, BS_NAME_SIZE) \
+    F(OPT_STR, opponent, BS_NAME_SIZE) F(OPT_STR, message, BS_TEXT_SIZE) F(INT, elo, 0)
+#define BS_FIELDS_OPPONENT_DISCONNECTED(F) F(STR, username, BS_NAME_SIZE) F(INT, grace, 0)
+#define BS_FIELDS_OPPONENT_RECONNECTED(F) F(STR, username, BS_NAME_SIZE)
+#define BS_FIELDS_GAME_RESUMED(F) \
+    F(STR, opponent, BS_NAME_SIZE) F(BOOL, your_turn, 0) F(BOOL, ready, 0) F(BOOL, opponent_ready, 0)
+#define BS_FIELDS_HEARTBEAT(F)            F(INT, seq, 0)
+#define BS_FIELDS_LATENCY(F)              F(INT, rtt, 0) F(INT, jitter, 0)
+#define BS_FIELDS_PING_UPDATE(F)          F(INT, opponent_ping, 0) F(INT, opponent_jitter, 0)
+#define BS_FIELDS_PONG(F)                 F(INT, timestamp, 0)
+#define BS_FIELDS_NOT_MODIFIED(F)         F(STR, query, BS_WORD_SIZE) F(INT, version, 0)
+
+// ==================== JSON writer ====================
+
+typedef struct BsWriter {
+    char *buf;
+    size_t size;
+    size_t len;     // bytes the message needs; >= size means it was truncated
+    int fields;     // members written to the current payload
+    // Optional: asked to make room for `need` bytes (NUL included) before a
+    // write would truncate; may move buf. Without it the writer is bounded.
+    void (*grow)(struct BsWriter *w, size_t need);
+} BsWriter;
+
+static inline void bs_writer_init(BsWriter *w, char *buf, size_t size) {
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->fields = 0;
+    w->grow = NULL;
+}
+
+static inline void bs_put(BsWriter *w, const char *s, size_t n) {
+    if (w->len + n >= w->size && w->grow) w->grow(w, w->len + n + 1);
+    if (w->len + 1 < w->size) {
+        size_t room = w->size - 1 - w->len;
+        memcpy(w->buf + w->len, s, n < room ? n : room);
+    }
+    w->len += n;
+}
+
+static inline void bs_put_str(BsWriter *w, const char *s) {
+    bs_put(w, s, strlen(s));
+}
+
+// NUL-terminates (truncating if needed) and returns the untruncated length
+static inline int bs_finish(BsWriter *w) {
+    if (w->size > 0) w->buf[w->len < w->size ? w->len : w->size - 1] = '\0';
+    return (int)w->len;
+}
+
+static inline void bs_put_escaped(BsWriter *w, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        bs_put(w, run, s - run);
+        run = s + 1;
+        char esc[6] = { '\\', (char)c, 0, 0, 0, 0 };
+        size_t n = 2;
+        switch (c) {
+            case '"': case '\\': break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            default:
+                esc[1] = 'u'; esc[2] = '0'; esc[3] = '0';
+                esc[4] = hex[c >> 4]; esc[5] = hex[c & 15];
+                n = 6;
+        }
+        bs_put(w, esc, n);
+    }
+    bs_put(w, run, s - run);
+}
+
+static inline void bs_put_long(BsWriter *w, long value) {
+    char digits[24];
+    int n = sizeof(digits);
+    unsigned long v = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    do {
+        digits[--n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) digits[--n] = '-';
+    bs_put(w, digits + n, sizeof(digits) - n);
+}
+
+static inline void bs_begin(BsWriter *w, const char *cmd) {
+    bs_put(w, "{\"cmd\":\"", 8);
+    bs_put(w, cmd, strlen(cmd));
+    bs_put(w, "\",\"payload\":{", 13);
+    w->fields = 0;
+}
+
+static inline int bs_end(BsWriter *w) {
+    bs_put(w, "}}", 2);
+    return bs_finish(w);
+}
+
+static inline void bs_key(BsWriter *w, const char *key) {
+    if (w->fields++) bs_put(w, ",", 1);
+    bs_put(w, "\"", 1);
+    bs_put(w, key, strlen(key));
+    bs_put(w, "\":", 2);
+}
+
+static inline void bs_field_STR(BsWriter *w, const char *key, const char *value) {
+    bs_key(w, key);
+    bs_put(w, "\"", 1);
+    bs_put_escaped(w, value ? value : "");
+    bs_put(w, "\"", 1);
+}
+
+static inline void bs_field_OPT_STR(BsWriter *w, const char *key, const char *value) {
+    if (value && value[0]) bs_field_STR(w, key, value);
+}
+
+static inline void bs_field_INT(BsWriter *w, const char *key, long value) {
+    bs_key(w, key);
+    bs_put_long(w, value);
+}
+
+static inline void bs_field_BOOL(BsWriter *w, const char *key, int value) {
+    bs_key(w, key);
+    if (value) bs_put(w, "true", 4);
+    else bs_put(w, "false", 5);
+}
+
+static inline void bs_field_FLAG(BsWriter *w, const char *key, int value) {
+    if (value) bs_field_BOOL(w, key, 1);
+}
+
+// ==================== Generated code ====================
+
+#define BS_CTYPE_STR const char *
+#define BS_CTYPE_OPT_STR const char *
+#define BS_CTYPE_INT long
+#define BS_CTYPE_BOOL int
+#define BS_CTYPE_FLAG int
+
+#define BS_MEMBER_STR(field, size) char field[size];
+#define BS_MEMBER_OPT_STR(field, size) char field[size];
+#define BS_MEMBER_INT(field, size) long field;
+#define BS_MEMBER_BOOL(field, size) int field;
+#define BS_MEMBER_FLAG(field, size) int field;
+
+#define BS_READ_STR(field, size) json_string(doc, json_find(doc, payload, #field), m->field, size);
+#define BS_READ_OPT_STR(field, size) BS_READ_STR(field, size)
+#define BS_READ_INT(field, size) json_long(doc, json_find(doc, payload, #field), &m->field);
+#define BS_READ_BOOL(field, size) m->field = json_bool(doc, json_find(doc, payload, #field));
+#define BS_READ_FLAG(field, size) BS_READ_BOOL(field, size)
+
+#define BS_MEMBER(kind, field, size) BS_MEMBER_##kind(field, size)
+#define BS_PARAM(kind, field, size) , BS_CTYPE_##kind field
+#define BS_ARG(kind, field, size) , field
+#define BS_WRITE(kind, field, size) bs_field_##kind(w, #field, field);
+#define BS_READ(kind, field, size) BS_READ_##kind(field, size)
+
+typedef enum {
+#define X(name, cmd, dir) BS_MSG_##name,
+    BATTLESHIP_MESSAGES(X)
+#undef X
+    BS_MSG_COUNT
+} BsMessageId;
+
+#define X(name, cmd, dir) typedef struct { BS_FIELDS_##name(BS_MEMBER) } Msg_##name;
+BATTLESHIP_MESSAGES(X)
+#undef X
+
+#define X(name, cmd, dir) \
+    static inline int bs_write_##name(BsWriter *w BS_FIELDS_##name(BS_PARAM)) { \
+        bs_begin(w, cmd); \
+        BS_FIELDS_##name(BS_WRITE) \
+        return bs_end(w); \
+    } \
+    static inline int bs_encode_##name(char *out, size_t size BS_FIELDS_##name(BS_PARAM)) { \
+        BsWriter w; \
+        bs_writer_init(&w, out, size); \
+        return bs_write_##name(&w BS_FIELDS_##name(BS_ARG)); \
+    } \
+    static inline int bs_decode_##name(const JsonDoc *doc, int payload, Msg_##name *m) { \
+        memset(m, 0, sizeof(*m)); \
+        BS_FIELDS_##name(BS_READ) \
+        return payload >= 0 && doc->tokens[payload].type == JSON_OBJECT; \
+    }
+BATTLESHIP_MESSAGES(X)
+#undef X
+
+static inline const char *bs_message_cmd(BsMessageId id) {
+    switch (id) {
+#define X(name, cmd, dir) case BS_MSG_##name: return cmd;
+        BATTLESHIP_MESSAGES(X)
+#undef X
+        default: return "";
+    }
+}
+
+// Schema entry for a "cmd" travelling in `direction`, or BS_MSG_COUNT
+static inline BsMessageId bs_message_lookup(const char *cmd, int direction) {
+#define X(name, message_cmd, dir) \
+    if (dir == direction && strcmp(cmd, message_cmd) == 0) return BS_MSG_##name;
+    BATTLESHIP_MESSAGES(X)
+#undef X
+    return BS_MSG_COUNT;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef BATTLESHIP_WIRE_H
+#define BATTLESHIP_WIRE_H
+
+// Binary framing shared by the server and client-lib.
+//
+// Line-delimited JSON stays the default. After WELCOME a client may send
+//   {"cmd":"HELLO","payload":{"protocol":"binary"}}
+// The server answers HELLO_OK (still JSON); from the next byte on both
+// directions use:
+//
+//   frame  = varint(length of opcode + body) | opcode (1 byte) | body
+//   varint = little-endian base 128, at most WIRE_MAX_VARINT bytes
+//
+// Messages with a packed form below use their own opcode; everything else
+// travels as WIRE_OP_JSON with the usual JSON text (no trailing newline).
+//
+// With "compression":"deflate" in the same HELLO, the server may send large
+// replies (lists) as WIRE_OP_JSON_DEFLATE instead: the JSON text as a raw
+// deflate stream (windowBits -15) primed with WIRE_DEFLATE_DICTIONARY.
+
+#include <stddef.h>
+
+#define WIRE_OP_JSON          0x00  // JSON message text
+
+// client -> server
+#define WIRE_OP_MOVE          0x01  // u8 row, u8 col
+#define WIRE_OP_PING          0x02  // (empty)
+#define WIRE_OP_HEARTBEAT_ACK 0x03  // varint seq
+
+// server -> client
+#define WIRE_OP_MOVE_RESULT   0x81  // u8 row, u8 col, u8 flags, u8 sunk_len, sunk name
+#define WIRE_OP_TURN_CHANGE   0x82  // u8 your_turn
+#define WIRE_OP_PONG          0x83  // varint timestamp
+#define WIRE_OP_HEARTBEAT     0x84  // varint seq
+#define WIRE_OP_LATENCY       0x85  // varint rtt, varint jitter (ms)
+#define WIRE_OP_PING_UPDATE   0x86  // varint opponent_ping, varint opponent_jitter (ms)
+#define WIRE_OP_JSON_DEFLATE  0x87  // deflated JSON text (after HELLO compression "deflate")
+
+// Preset dictionary for WIRE_OP_JSON_DEFLATE: the keys and values the list
+// replies repeat, most common last (deflate reaches those with the shortest
+// distances). Changing it breaks compatibility with deployed clients.
+#define WIRE_DEFLATE_DICTIONARY \
+    "{\"cmd\":\"BATCH_RESULT\",\"payload\":{\"replies\":[" \
+    "{\"cmd\":\"PLAYER_LIST\",\"payload\":{\"players\":[" \
+    "{\"cmd\":\"MATCH_HISTORY\",\"payload\":{\"matches\":[" \
+    "{\"cmd\":\"LEADERBOARD\",\"payload\":{\"players\":[" \
+    "{\"username\":\"\",\"status\":1,\"elo\":8" \
+    "\"result\":\"DRAW\"},\"result\":\"LOSE\"},\"result\":\"WIN\"}," \
+    "{\"timestamp\":17,\"opponent\":\"" \
+    "{\"rank\":,\"username\":\"\",\"elo\":,\"games\":,\"wins\":,\"winrate\":0.0},"
+
+// MOVE_RESULT flags
+#define WIRE_RESULT_MASK      0x03  // 0 = MISS, 1 = HIT, 2 = ALREADY_HIT
+#define WIRE_MOVE_YOUR_SHOT   0x04
+#define WIRE_MOVE_GAME_OVER   0x08
+
+#define WIRE_MAX_VARINT 3                  // frames up to 2 MB
+#define WIRE_MAX_FIELD_VARINT 10           // any 64-bit field
+#define WIRE_MAX_HEADER (WIRE_MAX_VARINT + 1)
+#define WIRE_MAX_BODY ((1UL << (7 * WIRE_MAX_VARINT)) - 2) // the length varint also counts the opcode
+
+typedef struct {
+    int opcode;
+    const unsigned char *body;
+    size_t len;
+} WireFrame;
+
+static inline int wire_put_varint(unsigned char *p, unsigned long value) {
+    int n = 0;
+    while (value >= 0x80) {
+        p[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (unsigned char)value;
+    return n;
+}
+
+// Returns bytes used, 0 if more input is needed, -1 if longer than max_bytes
+static inline int wire_get_varint(const unsigned char *p, size_t len, int max_bytes, unsigned long *value) {
+    unsigned long v = 0;
+    for (int n = 0; n < max_bytes; n++) {
+        if ((size_t)n >= len) return 0;
+        v |= (unsigned long)(p[n] & 0x7F) << (7 * n);
+        if (!(p[n] & 0x80)) {
+            *value = v;
+            return n + 1;
+        }
+    }
+    return -1;
+}
+
+// Writes the frame header for a body of body_len bytes; returns its size
+static inline int wire_put_header(unsigned char *p, size_t body_len, int opcode) {
+    int n = wire_put_varint(p, body_len + 1);
+    p[n++] = (unsigned char)opcode;
+    return n;
+}
+
+// Splits one frame off the front of buf. Returns the frame's total size,
+// 0 if it is not complete yet, -1 if the header is invalid or the frame
+// would exceed max_frame bytes.
+static inline int wire_parse_frame(const unsigned char *buf, size_t len, size_t max_frame, WireFrame *frame) {
+    unsigned long length;
+    int n = wire_get_varint(buf, len, WIRE_MAX_VARINT, &length);
+    if (n <= 0) return n;
+    if (length == 0 || n + length > max_frame) return -1;
+    if (n + length > len) return 0;
+
+    frame->opcode = buf[n];
+    frame->body = buf + n + 1;
+    frame->len = length - 1;
+    return (int)(n + length);
+}
+
+// Reads a varint field at *pos within body; 0 if it is missing or malformed
+static inline int wire_read_varint(const WireFrame *frame, size_t *pos, unsigned long *value) {
+    if (*pos > frame->len) return 0;
+    int n = wire_get_varint(frame->body + *pos, frame->len - *pos, WIRE_MAX_FIELD_VARINT, value);
+    if (n <= 0) return 0;
+    *pos += n;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,289 @@
+// json_tokens.h - single-pass JSON tokenizer, shared by the server and the clients
+//
+// json_tokenize() walks a message once and records every value as a token:
+// its type and [start, end) offsets into the caller's buffer. Nothing is
+// copied or allocated. Handlers then look up members by key in any order and
+// convert only the fields they use (json_string, json_int, json_bool).
+//
+// Token layout (depth first, like jsmn):
+//   object -> key, value, key, value, ...
+//   array  -> element, element, ...
+// Each token's `next` is the index just past its subtree, so the siblings of a
+// nested value are reached without walking its children.
+
+#ifndef JSON_TOKENS_H
+#define JSON_TOKENS_H
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX_TOKENS 256
+#define JSON_MAX_DEPTH 16
+
+typedef enum {
+    JSON_NONE = 0,
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+} JsonType;
+
+typedef struct {
+    JsonType type;
+    int start;   // strings: first byte after the opening quote
+    int end;     // strings: the closing quote
+    int next;    // index of the first token after this value's subtree
+    int count;   // objects: members, arrays: elements
+} JsonToken;
+
+typedef struct {
+    const char *text;
+    int count;
+    JsonToken tokens[JSON_MAX_TOKENS];
+} JsonDoc;
+
+static inline int json_skip_ws(const char *s, int len, int pos) {
+    while (pos < len && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\r' || s[pos] == '\n')) pos++;
+    return pos;
+}
+
+static inline int json_new_token(JsonDoc *doc, JsonType type, int start) {
+    if (doc->count >= JSON_MAX_TOKENS) return -1;
+    JsonToken *token = &doc->tokens[doc->count];
+    token->type = type;
+    token->start = start;
+    token->end = start;
+    token->next = doc->count + 1;
+    token->count = 0;
+    return doc->count++;
+}
+
+static inline int json_parse_string(JsonDoc *doc, int len, int *pos) {
+    const char *s = doc->text;
+    int t = json_new_token(doc, JSON_STRING, *pos + 1);
+    if (t < 0) return -1;
+
+    int p = *pos + 1;
+    while (p < len && s[p] != '"') {
+        if ((unsigned char)s[p] < 0x20) return -1;
+        if (s[p] == '\\' && ++p >= len) return -1;
+        p++;
+    }
+    if (p >= len) return -1;
+
+    doc->tokens[t].end = p;
+    *pos = p + 1;
+    return t;
+}
+
+static inline int json_parse_literal(JsonDoc *doc, int len, int *pos, const char *word, JsonType type) {
+    int n = strlen(word);
+    if (*pos + n > len || memcmp(doc->text + *pos, word, n) != 0) return -1;
+    int t = json_new_token(doc, type, *pos);
+    if (t < 0) return -1;
+    *pos += n;
+    doc->tokens[t].end = *pos;
+    return t;
+}
+
+static inline int json_parse_number(JsonDoc *doc, int len, int *pos) {
+    const char *s = doc->text;
+    int p = *pos;
+    if (p < len && s[p] == '-') p++;
+    if (p >= len || s[p] < '0' || s[p] > '9') return -1;
+    while (p < len && ((s[p] >= '0' && s[p] <= '9') || s[p] == '.' || s[p] == 'e' ||
+                       s[p] == 'E' || s[p] == '+' || s[p] == '-')) p++;
+
+    int t = json_new_token(doc, JSON_NUMBER, *pos);
+    if (t < 0) return -1;
+    doc->tokens[t].end = p;
+    *pos = p;
+    return t;
+}
+
+static inline int json_parse_value(JsonDoc *doc, int len, int *pos, int depth);
+
+static inline int json_parse_container(JsonDoc *doc, int len, int *pos, int depth) {
+    const char *s = doc->text;
+    int is_object = s[*pos] == '{';
+    char close = is_object ? '}' : ']';
+    if (depth >= JSON_MAX_DEPTH) return -1;
+
+    int t = json_new_token(doc, is_object ? JSON_OBJECT : JSON_ARRAY, *pos);
+    if (t < 0) return -1;
+
+    int p = json_skip_ws(s, len, *pos + 1);
+    if (p < len && s[p] == close) {
+        p++;
+    } else {
+        for (;;) {
+            if (is_object) {
+                if (p >= len || s[p] != '"' || json_parse_string(doc, len, &p) < 0) return -1;
+                p = json_skip_ws(s, len, p);
+                if (p >= len || s[p] != ':') return -1;
+                p = json_skip_ws(s, len, p + 1);
+            }
+            if (json_parse_value(doc, len, &p, depth + 1) < 0) return -1;
+            doc->tokens[t].count++;
+
+            p = json_skip_ws(s, len, p);
+            if (p < len && s[p] == ',') {
+                p = json_skip_ws(s, len, p + 1);
+            } else if (p < len && s[p] == close) {
+                p++;
+                break;
+            } else {
+                return -1;
+            }
+        }
+    }
+
+    doc->tokens[t].end = p;
+    doc->tokens[t].next = doc->count;
+    *pos = p;
+    return t;
+}
+
+static inline int json_parse_value(JsonDoc *doc, int len, int *pos, int depth) {
+    if (*pos >= len) return -1;
+    switch (doc->text[*pos]) {
+        case '{':
+        case '[': return json_parse_container(doc, len, pos, depth);
+        case '"': return json_parse_string(doc, len, pos);
+        case 't': return json_parse_literal(doc, len, pos, "true", JSON_TRUE);
+        case 'f': return json_parse_literal(doc, len, pos, "false", JSON_FALSE);
+        case 'n': return json_parse_literal(doc, len, pos, "null", JSON_NULL);
+        default:  return json_parse_number(doc, len, pos);
+    }
+}
+
+// Tokenize text[0..len). Returns 0, or -1 if it is not exactly one JSON value
+// (surrounding whitespace allowed) or needs more than JSON_MAX_TOKENS tokens.
+static inline int json_tokenize(JsonDoc *doc, const char *text, int len) {
+    doc->text = text;
+    doc->count = 0;
+    int pos = json_skip_ws(text, len, 0);
+    if (json_parse_value(doc, len, &pos, 0) < 0) return -1;
+    return json_skip_ws(text, len, pos) == len ? 0 : -1;
+}
+
+// Value token of member `key` in object token `obj`, or -1
+static inline int json_find(const JsonDoc *doc, int obj, const char *key) {
+    if (obj < 0 || doc->tokens[obj].type != JSON_OBJECT) return -1;
+    int key_len = strlen(key);
+    int t = obj + 1;
+    for (int i = 0; i < doc->tokens[obj].count; i++) {
+        const JsonToken *k = &doc->tokens[t];
+        if (k->end - k->start == key_len && memcmp(doc->text + k->start, key, key_len) == 0) {
+            return t + 1;
+        }
+        t = doc->tokens[t + 1].next;
+    }
+    return -1;
+}
+
+static inline int json_hex(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Copy string token `t` into dst with escapes decoded, truncated to size - 1.
+// Returns 1, or 0 (dst = "") if t is missing or not a string.
+static inline int json_string(const JsonDoc *doc, int t, char *dst, size_t size) {
+    dst[0] = '\0';
+    if (t < 0 || doc->tokens[t].type != JSON_STRING) return 0;
+
+    const char *s = doc->text;
+    size_t out = 0;
+    for (int p = doc->tokens[t].start; p < doc->tokens[t].end && out + 1 < size; p++) {
+        char c = s[p];
+        if (c == '\\') {
+            c = s[++p];
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u': {
+                    int code = 0;
+                    for (int i = 1; i <= 4; i++) {
+                        int h = p + i < doc->tokens[t].end ? json_hex(s[p + i]) : -1;
+                        if (h < 0) { code = '?'; break; }
+                        code = code * 16 + h;
+                    }
+                    p += 4;
+                    if (code >= 0xD800 && code <= 0xDFFF) code = '?'; // no surrogate pairs
+                    if (code < 0x80) {
+                        c = (char)code;
+                    } else if (code < 0x800 && out + 2 < size) {
+                        dst[out++] = (char)(0xC0 | (code >> 6));
+                        c = (char)(0x80 | (code & 0x3F));
+                    } else if (code >= 0x800 && out + 3 < size) {
+                        dst[out++] = (char)(0xE0 | (code >> 12));
+                        dst[out++] = (char)(0x80 | ((code >> 6) & 0x3F));
+                        c = (char)(0x80 | (code & 0x3F));
+                    } else {
+                        c = '?';
+                    }
+                    break;
+                }
+                default: break; // \" \\ \/
+            }
+        }
+        dst[out++] = c;
+    }
+    dst[out] = '\0';
+    return 1;
+}
+
+// Copy string token `t` still escaped, for text that goes straight back into
+// an outgoing JSON string. Returns 1, or 0 (dst = "") if not a string.
+static inline int json_string_raw(const JsonDoc *doc, int t, char *dst, size_t size) {
+    dst[0] = '\0';
+    if (t < 0 || doc->tokens[t].type != JSON_STRING) return 0;
+    const char *src = doc->text + doc->tokens[t].start;
+    size_t total = doc->tokens[t].end - doc->tokens[t].start, len = 0;
+    while (len < total) { // truncate on an escape boundary
+        size_t step = src[len] != '\\' ? 1 : (src[len + 1] == 'u' ? 6 : 2);
+        if (len + step > size - 1) break;
+        len += step;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    return 1;
+}
+
+// Returns 1 and stores the value if `t` is a number token, else 0
+static inline int json_long(const JsonDoc *doc, int t, long *value) {
+    if (t < 0 || doc->tokens[t].type != JSON_NUMBER) return 0;
+    long v = 0;
+    int p = doc->tokens[t].start, end = doc->tokens[t].end;
+    int negative = doc->text[p] == '-';
+    if (negative) p++;
+    for (; p < end && doc->text[p] >= '0' && doc->text[p] <= '9'; p++) {
+        if (v > (LONG_MAX - 9) / 10) return 0;
+        v = v * 10 + (doc->text[p] - '0');
+    }
+    *value = negative ? -v : v;
+    return 1;
+}
+
+static inline int json_int(const JsonDoc *doc, int t, int *value) {
+    long v;
+    if (!json_long(doc, t, &v) || v > 0x7FFFFFFF || v < -0x7FFFFFFF) return 0;
+    *value = (int)v;
+    return 1;
+}
+
+static inline int json_bool(const JsonDoc *doc, int t) {
+    return t >= 0 && doc->tokens[t].type == JSON_TRUE;
+}
+
+#endif // JSON_TOKENS_H
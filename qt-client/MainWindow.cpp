@@ -11,6 +11,7 @@
 #include <QHBoxLayout>
 #include <QLabel>
 #include <QPushButton>
+#include "battleship_messages.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -19,6 +20,9 @@ MainWindow::MainWindow(QWidget *parent)
     , matchDialog(nullptr)
     , opponentReady(false)
     , currentPing(0)
+    , nextRequestId(1)
+    , leaderboardRequestId(0)
+    , historyRequestId(0)
 {
     setupUI();
     
@@ -108,14 +112,25 @@ void MainWindow::onDisconnected() {
     // Stop ping timer when disconnected
     pingTimer->stop();
     
+    // Versions are only meaningful to the server that issued them
+    leaderboardCache = QJsonObject();
+    playerListCache = QJsonObject();
+    
     QMessageBox::warning(this, "Connection Lost", "Disconnected from server");
     showScreen(0); // Back to connection screen
     loginWidget->setEnabled(false);
 }
 
 void MainWindow::onMessageReceived(QString message) {
+    QByteArray text = message.toUtf8();
+    
+    // Messages in the shared schema (battleship_messages.h) skip QJsonDocument
+    if (handleSchemaMessage(text)) {
+        return;
+    }
+    
     // Parse JSON
-    QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
+    QJsonDocument doc = QJsonDocument::fromJson(text);
     if (doc.isNull() || !doc.isObject()) {
         qWarning() << "Invalid JSON:" << message;
         return;
@@ -140,6 +155,15 @@ void MainWindow::handleMessage(const QJsonObject& msg) {
         return;
     }
     
+    if (messageType == "BATCH_RESULT") {
+        // Replies to a BATCH, in the order of its commands
+        const QJsonArray replies = msg["payload"].toObject()["replies"].toArray();
+        for (const QJsonValue& reply : replies) {
+            onMessageReceived(QString::fromUtf8(QJsonDocument(reply.toObject()).toJson(QJsonDocument::Compact)));
+        }
+        return;
+    }
+    
     if (messageType == "LOGIN_SUCCESS") {
         QJsonObject payload = msg["payload"].toObject();
         username = payload["username"].toString();
@@ -165,9 +189,29 @@ void MainWindow::handleMessage(const QJsonObject& msg) {
         QMessageBox::warning(this, "Registration Failed", reason);
         
     } else if (messageType == "LEADERBOARD") {
-        lobbyWidget->updateLeaderboard(msg["payload"].toObject());
+        if (msg.contains("id") && msg["id"].toInt() != leaderboardRequestId) {
+            qDebug() << "Ignoring stale LEADERBOARD reply" << msg["id"].toInt();
+            return;
+        }
+        leaderboardCache = msg["payload"].toObject();
+        lobbyWidget->updateLeaderboard(leaderboardCache);
+        
+    } else if (messageType == "NOT_MODIFIED") {
+        QString query = msg["payload"].toObject()["query"].toString();
+        if (query == "LEADERBOARD") {
+            if (msg.contains("id") && msg["id"].toInt() != leaderboardRequestId) {
+                return;
+            }
+            lobbyWidget->updateLeaderboard(leaderboardCache);
+        } else if (query == "PLAYER_LIST") {
+            lobbyWidget->updatePlayerList(playerListCache);
+        }
         
     } else if (messageType == "MATCH_HISTORY") {
+        if (msg.contains("id") && msg["id"].toInt() != historyRequestId) {
+            qDebug() << "Ignoring stale MATCH_HISTORY reply" << msg["id"].toInt();
+            return;
+        }
         lobbyWidget->updateMatchHistory(msg["payload"].toObject());
         
     } else if (messageType == "MATCHING_STARTED") {
@@ -262,25 +306,6 @@ void MainWindow::handleMessage(const QJsonObject& msg) {
             matchStatusLabel->setStyleSheet("color: green; font-weight: bold;");
         }
         
-    } else if (messageType == "GAME_START") {
-        QJsonObject payload = msg["payload"].toObject();
-        QString opponent = payload["opponent"].toString();
-        bool yourTurn = payload["your_turn"].toBool();
-        
-        // Store opponent for rematch
-        lastOpponent = opponent;
-        
-        // Close match dialog if still open
-        if (matchDialog) {
-            matchDialog->accept();
-            matchDialog = nullptr;
-        }
-        
-        qDebug() << "Game starting against:" << opponent << "Your turn:" << yourTurn;
-        gameWidget->startMatch(username, opponent, 0);  // ELO will be updated later
-        showScreen(3); // Go to game screen
-        gameWidget->showShipPlacement();
-        
     } else if (messageType == "PLACE_SHIP_ACK") {
         // Server acknowledges ship placement, waiting for opponent
         QJsonObject payload = msg["payload"].toObject();
@@ -295,53 +320,12 @@ void MainWindow::handleMessage(const QJsonObject& msg) {
         gameWidget->showWaitingMessage(message);
         qDebug() << "Waiting for opponent:" << message;
         
-    } else if (messageType == "GAME_READY") {
-        // Both players have placed ships, game is starting
-        QJsonObject payload = msg["payload"].toObject();
-        bool yourTurn = payload["your_turn"].toBool();
-        QString message = payload["message"].toString();
-        
-        qDebug() << "Game ready! Your turn:" << yourTurn;
-        
-        // Kích hoạt game (set gameActive = true)
-        gameWidget->activateGame();
-        
-        gameWidget->showWaitingMessage(message);
-        gameWidget->setYourTurn(yourTurn);
-        
     } else if (messageType == "SHIPS_PLACED") {
         gameWidget->showWaitingMessage("Waiting for opponent to place ships...");
         
     } else if (messageType == "YOUR_TURN") {
         gameWidget->setYourTurn(true);
         
-    } else if (messageType == "TURN_CHANGE") {
-        // Server thông báo thay đổi lượt
-        QJsonObject payload = msg["payload"].toObject();
-        bool yourTurn = payload["your_turn"].toBool();
-        gameWidget->setYourTurn(yourTurn);
-        qDebug() << "Turn changed - Your turn:" << yourTurn;
-        
-    } else if (messageType == "MOVE_RESULT") {
-        QJsonObject payload = msg["payload"].toObject();
-        QString coord = payload["coord"].toString(); // e.g., "G1"
-        QString result = payload["result"].toString(); // "HIT", "MISS", "ALREADY_HIT"
-        QString shipSunk = payload["ship_sunk"].toString(); // ship name if sunk
-        bool isYourShot = payload["is_your_shot"].toBool();
-        
-        // Parse coordinate (e.g., "G1" -> row=6, col=1)
-        if (coord.length() >= 2) {
-            int row = coord[0].toLatin1() - 'A'; // A=0, B=1, ..., J=9
-            int col = coord.mid(1).toInt(); // Extract number after letter
-            bool hit = (result == "HIT");
-            bool sunk = !shipSunk.isEmpty();
-            
-            qDebug() << "MOVE_RESULT: coord=" << coord << "row=" << row << "col=" << col 
-                     << "result=" << result << "sunk=" << sunk << "shipName=" << shipSunk << "isYourShot=" << isYourShot;
-            
-            gameWidget->updateMove(row, col, hit, sunk, isYourShot, shipSunk);
-        }
-        
     } else if (messageType == "OPPONENT_MOVE") {
         QJsonObject payload = msg["payload"].toObject();
         int row = payload["row"].toInt();
@@ -375,26 +359,16 @@ void MainWindow::handleMessage(const QJsonObject& msg) {
             "Opponent offered a draw. Accept?",
             QMessageBox::Yes | QMessageBox::No);
         
-        QJsonObject response;
-        response["cmd"] = "DRAW_REPLY";
-        QJsonObject payload;
-        payload["status"] = (result == QMessageBox::Yes) ? "accept" : "reject";
-        response["payload"] = payload;
-        gameClient->sendMessage(QJsonDocument(response).toJson(QJsonDocument::Compact));
+        char response[64];
+        bs_encode_REQ_DRAW_REPLY(response, sizeof(response), (result == QMessageBox::Yes) ? "accept" : "reject");
+        gameClient->sendMessage(QString::fromUtf8(response));
         
     } else if (messageType == "DRAW_REJECTED") {
         QMessageBox::information(this, "Draw Rejected", "Opponent rejected the draw offer.");
         
-    } else if (messageType == "CHAT") {
-        QJsonObject payload = msg["payload"].toObject();
-        QString from = payload["from"].toString();
-        QString message = payload["message"].toString();
-        
-        qDebug() << "Chat message from" << from << ":" << message;
-        gameWidget->addChatMessage(from, message);
-        
     } else if (messageType == "PLAYER_LIST") {
-        lobbyWidget->updatePlayerList(msg["payload"].toObject());
+        playerListCache = msg["payload"].toObject();
+        lobbyWidget->updatePlayerList(playerListCache);
         
     } else if (messageType == "CHALLENGE") {
         QJsonObject payload = msg["payload"].toObject();
@@ -403,27 +377,15 @@ void MainWindow::handleMessage(const QJsonObject& msg) {
         qDebug() << "Challenge received from:" << challenger;
         showChallengeDialog(challenger);
         
-    } else if (messageType == "CHALLENGE_REPLY") {
-        QJsonObject payload = msg["payload"].toObject();
-        QString targetUsername = payload["target_username"].toString();
-        QString status = payload["status"].toString();
-        
-        if (status == "ACCEPT") {
-            lobbyWidget->showWaitingMessage("Challenge accepted! Starting game...");
-            QMessageBox::information(this, "Challenge Accepted", 
-                targetUsername + " accepted your challenge!");
-        } else if (status == "REJECT") {
-            lobbyWidget->showWaitingMessage("Challenge rejected.");
-            QMessageBox::information(this, "Challenge Rejected", 
-                targetUsername + " rejected your challenge.");
-        }
-        
     } else if (messageType == "ERROR" || messageType == "SYSTEM_MSG") {
         QJsonObject payload = msg["payload"].toObject();
         QString message = payload["message"].toString();
         int code = payload["code"].toInt();
         
-        if (!message.isEmpty()) {
+        if (code == 429 || code == 503) {
+            // Throttled or shed: the next refresh asks again, nothing for the user to do
+            qDebug() << "Server refused" << payload["command"].toString() << "-" << code << message;
+        } else if (!message.isEmpty()) {
             if (code >= 400) {
                 QMessageBox::warning(this, "Message", message);
             } else {
@@ -452,28 +414,137 @@ void MainWindow::handleMessage(const QJsonObject& msg) {
         lobbyWidget->updatePing(currentPing);
         gameWidget->updateMyPing(currentPing);
         
-        // Optionally send UPDATE_PING to server
-        QJsonObject msg;
-        msg["cmd"] = "UPDATE_PING";
-        QJsonObject payload;
-        payload["ping"] = currentPing;
-        msg["payload"] = payload;
-        QString jsonStr = QString("{\"cmd\":\"UPDATE_PING\",\"payload\":{\"ping\":%1}}")
-                         .arg(currentPing);
-        gameClient->sendMessage(jsonStr);
-        
-    } else if (messageType == "PING_UPDATE") {
+    } else {
+        qDebug() << "Unhandled message type:" << messageType;
+    }
+}
+
+bool MainWindow::handleSchemaMessage(const QByteArray& text) {
+    JsonDoc doc;
+    char cmd[32];
+    if (json_tokenize(&doc, text.constData(), text.size()) != 0 ||
+        !json_string(&doc, json_find(&doc, 0, "cmd"), cmd, sizeof(cmd))) {
+        return false;
+    }
+    int payload = json_find(&doc, 0, "payload");
+    
+    switch (bs_message_lookup(cmd, BS_TO_CLIENT)) {
+    case BS_MSG_GAME_START: {
+        Msg_GAME_START msg;
+        bs_decode_GAME_START(&doc, payload, &msg);
+        QString opponent = QString::fromUtf8(msg.opponent);
+        
+        // Store opponent for rematch
+        lastOpponent = opponent;
+        
+        // Close match dialog if still open
+        if (matchDialog) {
+            matchDialog->accept();
+            matchDialog = nullptr;
+        }
+        
+        qDebug() << "Game starting against:" << opponent << "Your turn:" << (bool)msg.your_turn;
+        gameWidget->startMatch(username, opponent, 0);  // ELO will be updated later
+        showScreen(3); // Go to game screen
+        gameWidget->showShipPlacement();
+        return true;
+    }
+    case BS_MSG_GAME_READY: {
+        // Both players have placed ships, game is starting
+        Msg_GAME_READY msg;
+        bs_decode_GAME_READY(&doc, payload, &msg);
+        
+        qDebug() << "Game ready! Your turn:" << (bool)msg.your_turn;
+        
+        // Kích hoạt game (set gameActive = true)
+        gameWidget->activateGame();
+        
+        gameWidget->showWaitingMessage(QString::fromUtf8(msg.message));
+        gameWidget->setYourTurn(msg.your_turn);
+        return true;
+    }
+    case BS_MSG_TURN_CHANGE: {
+        // Server thông báo thay đổi lượt
+        Msg_TURN_CHANGE msg;
+        bs_decode_TURN_CHANGE(&doc, payload, &msg);
+        gameWidget->setYourTurn(msg.your_turn);
+        qDebug() << "Turn changed - Your turn:" << (bool)msg.your_turn;
+        return true;
+    }
+    case BS_MSG_MOVE_RESULT: {
+        Msg_MOVE_RESULT msg;
+        bs_decode_MOVE_RESULT(&doc, payload, &msg);
+        
+        // Parse coordinate (e.g., "G1" -> row=6, col=1)
+        if (strlen(msg.coord) >= 2) {
+            int row = msg.coord[0] - 'A'; // A=0, B=1, ..., J=9
+            int col = atoi(msg.coord + 1); // Extract number after letter
+            bool hit = strcmp(msg.result, "HIT") == 0;
+            QString shipSunk = QString::fromUtf8(msg.ship_sunk);
+            bool sunk = !shipSunk.isEmpty();
+            
+            qDebug() << "MOVE_RESULT: coord=" << msg.coord << "row=" << row << "col=" << col 
+                     << "result=" << msg.result << "sunk=" << sunk << "shipName=" << shipSunk
+                     << "isYourShot=" << (bool)msg.is_your_shot;
+            
+            gameWidget->updateMove(row, col, hit, sunk, msg.is_your_shot, shipSunk);
+        }
+        return true;
+    }
+    case BS_MSG_CHAT: {
+        Msg_CHAT msg;
+        bs_decode_CHAT(&doc, payload, &msg);
+        QString from = QString::fromUtf8(msg.from);
+        QString message = QString::fromUtf8(msg.message);
+        
+        qDebug() << "Chat message from" << from << ":" << message;
+        gameWidget->addChatMessage(from, message);
+        return true;
+    }
+    case BS_MSG_CHALLENGE_REPLY: {
+        // Server only sends this for a rejection; an accepted challenge starts with GAME_START
+        Msg_CHALLENGE_REPLY msg;
+        bs_decode_CHALLENGE_REPLY(&doc, payload, &msg);
+        QString player = QString::fromUtf8(msg.player);
+        
+        if (strcmp(msg.status, "ACCEPT") == 0) {
+            lobbyWidget->showWaitingMessage("Challenge accepted! Starting game...");
+            QMessageBox::information(this, "Challenge Accepted", 
+                player + " accepted your challenge!");
+        } else if (strcmp(msg.status, "REJECT") == 0) {
+            lobbyWidget->showWaitingMessage("Challenge rejected.");
+            QMessageBox::information(this, "Challenge Rejected", 
+                player + " rejected your challenge.");
+        }
+        return true;
+    }
+    case BS_MSG_LATENCY: {
+        // Server-measured RTT (HEARTBEAT is answered by the client library)
+        Msg_LATENCY msg;
+        bs_decode_LATENCY(&doc, payload, &msg);
+        currentPing = static_cast<int>(msg.rtt);
+        
+        // Server measurements replace our own PING/PONG round trips
+        pingTimer->stop();
+        
+        lobbyWidget->updatePing(currentPing);
+        gameWidget->updateMyPing(currentPing);
+        return true;
+    }
+    case BS_MSG_PING_UPDATE: {
         // Opponent's ping update
-        QJsonObject payload = msg["payload"].toObject();
-        int opponentPing = payload["opponent_ping"].toInt();
+        Msg_PING_UPDATE msg;
+        bs_decode_PING_UPDATE(&doc, payload, &msg);
+        int opponentPing = static_cast<int>(msg.opponent_ping);
         
         qDebug() << "PING_UPDATE received - Opponent ping:" << opponentPing << "ms";
         
         // Update game widget if in game
         gameWidget->updateOpponentPing(opponentPing);
-        
-    } else {
-        qDebug() << "Unhandled message type:" << messageType;
+        return true;
+    }
+    default:
+        return false;
     }
 }
 
@@ -483,29 +554,15 @@ void MainWindow::onErrorOccurred(QString error) {
 }
 
 void MainWindow::onLoginClicked(QString username, QString password) {
-    QJsonObject msg;
-    msg["cmd"] = "LOGIN";  // Server expects "cmd" not "type"
-    QJsonObject payload;
-    payload["username"] = username;
-    payload["password"] = password;
-    msg["payload"] = payload;
-    
-    // Tạo JSON string thủ công để đảm bảo thứ tự đúng
-    QString jsonStr = QString("{\"cmd\":\"LOGIN\",\"payload\":{\"username\":\"%1\",\"password\":\"%2\"}}")
-                          .arg(username).arg(password);
-    
-    gameClient->sendMessage(jsonStr);
+    char message[512];
+    bs_encode_REQ_LOGIN(message, sizeof(message), username.toUtf8().constData(), password.toUtf8().constData());
+    gameClient->sendMessage(QString::fromUtf8(message));
 }
 
 void MainWindow::onRegisterClicked(QString username, QString password) {
-    QJsonObject msg;
-    msg["cmd"] = "REGISTER";  // Server expects "cmd"
-    QJsonObject payload;
-    payload["password"] = password;
-    payload["username"] = username;
-    msg["payload"] = payload;
-    
-    gameClient->sendMessage(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    char message[512];
+    bs_encode_REQ_REGISTER(message, sizeof(message), username.toUtf8().constData(), password.toUtf8().constData());
+    gameClient->sendMessage(QString::fromUtf8(message));
 }
 
 void MainWindow::onFindMatchClicked() {
@@ -531,7 +588,13 @@ void MainWindow::onCancelMatchClicked() {
 void MainWindow::onViewLeaderboardClicked() {
     QJsonObject msg;
     msg["cmd"] = "LEADERBOARD";  // Server expects "cmd"
-    msg["payload"] = QJsonObject();
+    QJsonObject payload;
+    if (leaderboardCache.contains("version")) {
+        payload["version"] = leaderboardCache["version"];
+    }
+    msg["payload"] = payload;
+    leaderboardRequestId = nextRequestId++;
+    msg["id"] = leaderboardRequestId;
     
     gameClient->sendMessage(QJsonDocument(msg).toJson(QJsonDocument::Compact));
 }
@@ -540,6 +603,8 @@ void MainWindow::onViewHistoryClicked() {
     QJsonObject msg;
     msg["cmd"] = "MATCH_HISTORY";  // Server expects "cmd"
     msg["payload"] = QJsonObject();
+    historyRequestId = nextRequestId++;
+    msg["id"] = historyRequestId;
     
     gameClient->sendMessage(QJsonDocument(msg).toJson(QJsonDocument::Compact));
 }
@@ -547,15 +612,19 @@ void MainWindow::onViewHistoryClicked() {
 void MainWindow::onViewPlayersClicked() {
     QJsonObject msg;
     msg["cmd"] = "PLAYER_LIST";
-    msg["payload"] = QJsonObject();
+    QJsonObject payload;
+    if (playerListCache.contains("version")) {
+        payload["version"] = playerListCache["version"];
+    }
+    msg["payload"] = payload;
     
     gameClient->sendMessage(QJsonDocument(msg).toJson(QJsonDocument::Compact));
 }
 
 void MainWindow::onChallengePlayerClicked(const QString& targetUsername) {
-    QString jsonStr = QString("{\"cmd\":\"CHALLENGE\",\"payload\":{\"target_username\":\"%1\"}}")
-                          .arg(targetUsername);
-    gameClient->sendMessage(jsonStr);
+    char message[256];
+    bs_encode_REQ_CHALLENGE(message, sizeof(message), targetUsername.toUtf8().constData());
+    gameClient->sendMessage(QString::fromUtf8(message));
 }
 
 void MainWindow::onLogoutClicked() {
@@ -570,16 +639,12 @@ void MainWindow::onLogoutClicked() {
 
 void MainWindow::onMoveClicked(int row, int col) {
     // Convert row, col to coord format (e.g., row=0, col=5 -> "A5")
-    char coordStr[10];
+    char coordStr[BS_COORD_SIZE];
     sprintf(coordStr, "%c%d", 'A' + row, col);
     
-    QJsonObject msg;
-    msg["cmd"] = "MOVE";  // Server expects "cmd"
-    QJsonObject payload;
-    payload["coord"] = QString(coordStr);
-    msg["payload"] = payload;
-    
-    gameClient->sendMessage(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    char message[64];
+    bs_encode_REQ_MOVE(message, sizeof(message), coordStr);
+    gameClient->sendMessage(QString::fromUtf8(message));
 }
 
 void MainWindow::onSurrenderClicked() {
@@ -639,14 +704,10 @@ void MainWindow::onShipsPlaced(const QVector<QJsonObject>& ships) {
 }
 
 void MainWindow::onChatMessageSent(const QString& message) {
-    QJsonObject msg;
-    msg["cmd"] = "CHAT";
-    
-    QJsonObject payload;
-    payload["message"] = message;
-    msg["payload"] = payload;
-    
-    gameClient->sendMessage(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    // Server truncates chat text to BS_TEXT_SIZE; escaping can grow it up to 6x
+    char json[BS_TEXT_SIZE * 6 + 64];
+    bs_encode_REQ_CHAT(json, sizeof(json), message.toUtf8().constData());
+    gameClient->sendMessage(QString::fromUtf8(json));
     
     qDebug() << "Chat message sent:" << message;
 }
@@ -753,9 +814,9 @@ void MainWindow::showGameEndDialog(const QString& result, const QString& reason,
         
         // Send challenge to last opponent
         if (!lastOpponent.isEmpty()) {
-            QString jsonStr = QString("{\"cmd\":\"CHALLENGE\",\"payload\":{\"target_username\":\"%1\"}}")
-                                  .arg(lastOpponent);
-            gameClient->sendMessage(jsonStr);
+            char message[256];
+            bs_encode_REQ_CHALLENGE(message, sizeof(message), lastOpponent.toUtf8().constData());
+            gameClient->sendMessage(QString::fromUtf8(message));
             lobbyWidget->showWaitingMessage("Rematch challenge sent to " + lastOpponent + "...");
         }
     });
@@ -827,17 +888,17 @@ void MainWindow::showChallengeDialog(const QString& challenger) {
     
     // Connect buttons
     connect(acceptButton, &QPushButton::clicked, [this, dialog, challenger]() {
-        QString jsonStr = QString("{\"cmd\":\"CHALLENGE_REPLY\",\"payload\":{\"challenger_username\":\"%1\",\"status\":\"ACCEPT\"}}")
-                              .arg(challenger);
-        gameClient->sendMessage(jsonStr);
+        char message[256];
+        bs_encode_REQ_CHALLENGE_REPLY(message, sizeof(message), challenger.toUtf8().constData(), "ACCEPT");
+        gameClient->sendMessage(QString::fromUtf8(message));
         lobbyWidget->showWaitingMessage("Challenge accepted! Waiting for game to start...");
         dialog->accept();
     });
     
     connect(declineButton, &QPushButton::clicked, [this, dialog, challenger]() {
-        QString jsonStr = QString("{\"cmd\":\"CHALLENGE_REPLY\",\"payload\":{\"challenger_username\":\"%1\",\"status\":\"REJECT\"}}")
-                              .arg(challenger);
-        gameClient->sendMessage(jsonStr);
+        char message[256];
+        bs_encode_REQ_CHALLENGE_REPLY(message, sizeof(message), challenger.toUtf8().constData(), "REJECT");
+        gameClient->sendMessage(QString::fromUtf8(message));
         dialog->reject();
     });
     
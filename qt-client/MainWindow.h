@@ -59,6 +59,7 @@ private slots:
     
 private:
     void setupUI();
+    bool handleSchemaMessage(const QByteArray& text);
     void handleMessage(const QJsonObject& msg);
     void showScreen(int index);
     void showGameEndDialog(const QString& result, const QString& reason, int newElo);
@@ -91,6 +92,17 @@ private:
     QTimer* pingTimer;
     QElapsedTimer pingElapsed;
     int currentPing;
+    
+    // Request ids echoed by the server: lists are queried in the background,
+    // so a slow reply to an older click must not overwrite a newer one
+    int nextRequestId;
+    int leaderboardRequestId;
+    int historyRequestId;
+    
+    // Last LEADERBOARD / PLAYER_LIST payloads. Their "version" is sent back
+    // with the next request, and NOT_MODIFIED re-renders from the cache
+    QJsonObject leaderboardCache;
+    QJsonObject playerListCache;
 };
 
 #endif // MAINWINDOW_H
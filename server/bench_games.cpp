@@ -0,0 +1,200 @@
+// bench_games.cpp - MOVE throughput vs I/O threads, each posting to its own games
+//
+// Build & run: make bench-games [ARGS=WORKERS]
+// Every producer thread (standing in for an I/O thread) owns GAMES_PER_THREAD
+// sessions of two fake clients (no sockets) and posts MOVEs through
+// handle_move() as fast as the game workers take them; replies are dropped by
+// a stub IoBackend. Ships sit at A0 and nobody shoots there, so games never
+// end. Sessions are spread over the game workers (default one per core), so
+// moves/s should grow with the number of games until every worker is busy.
+// The games_mutex column counts acquisitions per MOVE during the run: the
+// session lookup is lock-free, so it should stay at 0.
+
+#include <sys/stat.h>
+
+#define BATTLESHIP_NO_MAIN
+#include "server_full.cpp"
+
+#define GAMES_PER_THREAD 64
+#define MAX_BENCH_THREADS 16
+#define BENCH_MS 1000
+#define BENCH_SOCK_BASE 1000000  // never a real fd
+#define BENCH_BACKLOG 4096        // MOVEs posted but not yet run before producers wait
+
+static const char *bench_ships =
+    "{\"ships\":[{\"name\":\"Destroyer\",\"size\":1,\"row\":0,\"col\":0,\"horizontal\":true}]}";
+
+static int bench_init(int port) { (void)port; return 0; }
+static void bench_run() {}
+
+static void bench_flush(Client *client) {
+    pthread_mutex_lock(&client->out_mutex);
+    out_drop(client);
+    pthread_mutex_unlock(&client->out_mutex);
+}
+
+static IoBackend bench_backend = { "bench", bench_init, bench_run, bench_flush };
+
+typedef struct {
+    Client *players[GAMES_PER_THREAD][2];
+    pthread_t thread;
+} BenchThread;
+
+static volatile int bench_stop = 0;
+
+static Client *bench_player(int sock, const char *name) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    Client *client = create_client(sock, &address);
+    if (!client) {
+        fprintf(stderr, "create_client failed\n");
+        exit(EXIT_FAILURE);
+    }
+    set_username(client, name);
+    store_status(client, PLAYER_ONLINE);
+    return client;
+}
+
+static void bench_place_ships(Client *client) {
+    char buffer[256];
+    JsonDoc doc;
+    strcpy(buffer, bench_ships);
+    if (json_tokenize(&doc, buffer, strlen(buffer)) != 0) {
+        fprintf(stderr, "bad ship layout\n");
+        exit(EXIT_FAILURE);
+    }
+    handle_place_ships(client, &doc, json_find(&doc, 0, "ships"));
+}
+
+static unsigned long tasks_posted = 0;  // every GameTask this bench caused
+
+static unsigned long tasks_run() {
+    unsigned long total = 0;
+    for (int i = 0; i < game_worker_count; i++) {
+        total += __atomic_load_n(&game_workers[i].tasks, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// Wait for the game workers to run everything posted so far
+static void drain() {
+    while (tasks_run() < __atomic_load_n(&tasks_posted, __ATOMIC_RELAXED)) sched_yield();
+}
+
+static void *bench_thread(void *arg) {
+    BenchThread *t = (BenchThread *)arg;
+    char coord[4];
+    int shot = 0;
+    while (!__atomic_load_n(&bench_stop, __ATOMIC_RELAXED)) {
+        // B0..J9: misses, then ALREADY_HIT, which still passes the turn
+        snprintf(coord, sizeof(coord), "%c%d", 'B' + shot / GRID_SIZE, shot % GRID_SIZE);
+        shot = (shot + 1) % ((GRID_SIZE - 1) * GRID_SIZE);
+        for (int g = 0; g < GAMES_PER_THREAD; g++) {
+            handle_move(t->players[g][0], coord);
+            handle_move(t->players[g][1], coord);
+        }
+        unsigned long posted = __atomic_add_fetch(&tasks_posted, 2 * GAMES_PER_THREAD, __ATOMIC_RELAXED);
+        while (posted > tasks_run() + BENCH_BACKLOG && !__atomic_load_n(&bench_stop, __ATOMIC_RELAXED)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// Post MOVEs for BENCH_MS from count threads; returns moves run per second
+static double run(BenchThread *threads, int count, LockStats *games, unsigned long *moves_run) {
+    pthread_mutex_lock(&games_mutex);
+    LockStats games_before = games_lock_stats;
+    pthread_mutex_unlock(&games_mutex);
+
+    bench_stop = 0;
+    unsigned long tasks_before = tasks_run();
+    unsigned long start = monotonic_us();
+    for (int i = 0; i < count; i++) {
+        pthread_create(&threads[i].thread, NULL, bench_thread, &threads[i]);
+    }
+    usleep(BENCH_MS * 1000);
+    unsigned long moves = tasks_run() - tasks_before;
+    double seconds = (monotonic_us() - start) / 1e6;
+    __atomic_store_n(&bench_stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    drain();
+
+    pthread_mutex_lock(&games_mutex);
+    games->acquired = games_lock_stats.acquired - games_before.acquired;
+    games->contended = games_lock_stats.contended - games_before.contended;
+    games->wait_us = games_lock_stats.wait_us - games_before.wait_us;
+    pthread_mutex_unlock(&games_mutex);
+
+    // End this run's games so the next run starts its own
+    for (int i = 0; i < count; i++) {
+        for (int g = 0; g < GAMES_PER_THREAD; g++) {
+            handle_surrender(threads[i].players[g][0]);
+        }
+    }
+    __atomic_add_fetch(&tasks_posted, count * GAMES_PER_THREAD, __ATOMIC_RELAXED);
+    drain();
+    *moves_run = moves;
+    return moves / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) game_worker_count = atoi(argv[1]);
+
+    char dir[] = "/tmp/battleship-bench-XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0 || mkdir("history", 0755) != 0) {
+        perror("bench workspace");
+        return EXIT_FAILURE;
+    }
+    // Keep the per-move logging out of the measurement; results go to stderr
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+        return EXIT_FAILURE;
+    }
+
+    int clients = MAX_BENCH_THREADS * GAMES_PER_THREAD * 2;
+    slot_table_init(&client_slots, clients);
+    slot_table_init(&game_slots, clients / 2);
+    client_index_init(&sock_index, clients);
+    client_index_init(&name_index, clients);
+    io_backend = &bench_backend;
+    timers_init();
+    game_workers_start();
+    idle_timeout = 0;
+
+    static BenchThread threads[MAX_BENCH_THREADS];
+    for (int i = 0; i < MAX_BENCH_THREADS; i++) {
+        for (int g = 0; g < GAMES_PER_THREAD; g++) {
+            for (int p = 0; p < 2; p++) {
+                char name[USERNAME_SIZE];
+                snprintf(name, sizeof(name), "bench_%d_%d_%d", i, g, p);
+                threads[i].players[g][p] = bench_player(BENCH_SOCK_BASE + (i * GAMES_PER_THREAD + g) * 2 + p, name);
+            }
+        }
+    }
+
+    fprintf(stderr, "%d game workers, %d games per producer, %d ms per run, %ld cores\n",
+            game_worker_count, GAMES_PER_THREAD, BENCH_MS, sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(stderr, "%9s %8s %12s %16s\n", "producers", "games", "moves/s", "games_mutex/move");
+    for (int count = 1; count <= MAX_BENCH_THREADS; count *= 2) {
+        for (int i = 0; i < count; i++) {
+            for (int g = 0; g < GAMES_PER_THREAD; g++) {
+                start_game(threads[i].players[g][0], threads[i].players[g][1]);
+                bench_place_ships(threads[i].players[g][0]);
+                bench_place_ships(threads[i].players[g][1]);
+            }
+        }
+        // start_game() runs its task synchronously, then two PLACE_SHIPS each
+        __atomic_add_fetch(&tasks_posted, count * GAMES_PER_THREAD * 3, __ATOMIC_RELAXED);
+        drain();
+
+        LockStats games;
+        unsigned long moves;
+        double rate = run(threads, count, &games, &moves);
+        fprintf(stderr, "%9d %8d %12.0f %16.3f\n", count, count * GAMES_PER_THREAD, rate,
+                moves ? (double)games.acquired / moves : 0.0);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+// bench_json.cpp - inbound command parsing: legacy strstr/sscanf path vs json_tokens.h
+//
+// Build & run: make bench
+// Each round parses a fixed mix of real client messages and extracts the
+// fields the server's handlers use. Output is messages/sec for both paths.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "json_tokens.h"
+
+#define BUFFER_SIZE 4096
+#define DEFAULT_ITERATIONS 200000
+
+static const char *messages[] = {
+    "{\"cmd\":\"MOVE\",\"payload\":{\"coord\":\"B7\"}}",
+    "{\"cmd\":\"PING\",\"payload\":{}}",
+    "{\"cmd\":\"HEARTBEAT_ACK\",\"payload\":{\"seq\":1234}}",
+    "{\"cmd\":\"LOGIN\",\"payload\":{\"username\":\"player_one\",\"password\":\"hunter2\"}}",
+    "{\"cmd\":\"CHAT\",\"payload\":{\"message\":\"good game, well played\"}}",
+    "{\"cmd\":\"PLACE_SHIPS\",\"payload\":{\"ships\":["
+        "{\"name\":\"Carrier\",\"size\":5,\"row\":0,\"col\":0,\"horizontal\":true},"
+        "{\"name\":\"Battleship\",\"size\":4,\"row\":2,\"col\":0,\"horizontal\":true},"
+        "{\"name\":\"Cruiser\",\"size\":3,\"row\":4,\"col\":0,\"horizontal\":false},"
+        "{\"name\":\"Submarine\",\"size\":3,\"row\":4,\"col\":5,\"horizontal\":true},"
+        "{\"name\":\"Destroyer\",\"size\":2,\"row\":8,\"col\":8,\"horizontal\":false}]}}",
+};
+#define MESSAGE_COUNT (int)(sizeof(messages) / sizeof(messages[0]))
+
+static volatile int sink; // keeps the compiler from dropping the work
+
+// The parsing that process_message() / handle_command() did before json_tokens.h
+static void parse_legacy(const char *buffer) {
+    char cmd[50] = "", payload[BUFFER_SIZE] = "";
+    const char *cmd_start = strstr(buffer, "\"cmd\":\"");
+    const char *payload_start = strstr(buffer, "\"payload\":");
+
+    if (cmd_start) {
+        cmd_start += 7;
+        const char *cmd_end = strchr(cmd_start, '"');
+        if (cmd_end) {
+            int len = cmd_end - cmd_start;
+            strncpy(cmd, cmd_start, len < 50 ? len : 49);
+            cmd[len < 50 ? len : 49] = '\0';
+        }
+    }
+    if (payload_start) {
+        payload_start += 10;
+        const char *payload_end = strrchr(payload_start, '}');
+        if (payload_end) {
+            payload_end++;
+            int len = payload_end - payload_start;
+            strncpy(payload, payload_start, len < BUFFER_SIZE ? len : BUFFER_SIZE - 1);
+            payload[len < BUFFER_SIZE ? len : BUFFER_SIZE - 1] = '\0';
+        }
+    }
+
+    if (strcmp(cmd, "MOVE") == 0) {
+        char coord[10] = "";
+        sscanf(payload, "{\"coord\":\"%[^\"]\"}", coord);
+        sink += coord[0];
+    } else if (strcmp(cmd, "HEARTBEAT_ACK") == 0) {
+        unsigned int seq = 0;
+        sscanf(payload, "{\"seq\":%u}", &seq);
+        sink += seq;
+    } else if (strcmp(cmd, "LOGIN") == 0) {
+        char username[50] = "", password[100] = "";
+        sscanf(payload, "{\"username\":\"%[^\"]\",\"password\":\"%[^\"]\"}", username, password);
+        sink += username[0] + password[0];
+    } else if (strcmp(cmd, "CHAT") == 0) {
+        char message[BUFFER_SIZE] = "";
+        sscanf(payload, "{\"message\":\"%[^\"]\"}", message);
+        sink += message[0];
+    } else if (strcmp(cmd, "PLACE_SHIPS") == 0) {
+        const char *ptr = strstr(payload, "\"ships\":");
+        while (ptr && *ptr) {
+            if (*ptr == '{') {
+                char name[30], horizontal_str[10];
+                int size, row, col;
+                if (sscanf(ptr, "{\"name\":\"%[^\"]\",\"size\":%d,\"row\":%d,\"col\":%d,\"horizontal\":%[^,}]",
+                           name, &size, &row, &col, horizontal_str) == 5) {
+                    sink += size + row + col + (strstr(horizontal_str, "true") != NULL);
+                }
+            }
+            ptr++;
+        }
+    } else {
+        sink += cmd[0];
+    }
+}
+
+// The same work through json_tokens.h
+static void parse_tokens(const char *buffer) {
+    JsonDoc doc;
+    char cmd[50];
+    if (json_tokenize(&doc, buffer, strlen(buffer)) < 0 ||
+        !json_string(&doc, json_find(&doc, 0, "cmd"), cmd, sizeof(cmd))) {
+        return;
+    }
+    int payload = json_find(&doc, 0, "payload");
+
+    if (strcmp(cmd, "MOVE") == 0) {
+        char coord[10];
+        json_string(&doc, json_find(&doc, payload, "coord"), coord, sizeof(coord));
+        sink += coord[0];
+    } else if (strcmp(cmd, "HEARTBEAT_ACK") == 0) {
+        int seq = 0;
+        json_int(&doc, json_find(&doc, payload, "seq"), &seq);
+        sink += seq;
+    } else if (strcmp(cmd, "LOGIN") == 0) {
+        char username[50], password[100];
+        json_string(&doc, json_find(&doc, payload, "username"), username, sizeof(username));
+        json_string(&doc, json_find(&doc, payload, "password"), password, sizeof(password));
+        sink += username[0] + password[0];
+    } else if (strcmp(cmd, "CHAT") == 0) {
+        char message[BUFFER_SIZE];
+        json_string_raw(&doc, json_find(&doc, payload, "message"), message, sizeof(message));
+        sink += message[0];
+    } else if (strcmp(cmd, "PLACE_SHIPS") == 0) {
+        int ships = json_find(&doc, payload, "ships");
+        int count = ships >= 0 ? doc.tokens[ships].count : 0;
+        int element = ships + 1;
+        for (int n = 0; n < count; n++, element = doc.tokens[element].next) {
+            char name[30];
+            int size, row, col;
+            if (json_string(&doc, json_find(&doc, element, "name"), name, sizeof(name)) &&
+                json_int(&doc, json_find(&doc, element, "size"), &size) &&
+                json_int(&doc, json_find(&doc, element, "row"), &row) &&
+                json_int(&doc, json_find(&doc, element, "col"), &col)) {
+                sink += size + row + col + json_bool(&doc, json_find(&doc, element, "horizontal"));
+            }
+        }
+    } else {
+        sink += cmd[0];
+    }
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *name, void (*parse)(const char *), int iterations) {
+    double start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        for (int m = 0; m < MESSAGE_COUNT; m++) {
+            parse(messages[m]);
+        }
+    }
+    double elapsed = now_seconds() - start;
+    double rate = (double)iterations * MESSAGE_COUNT / elapsed;
+    printf("%-8s %10.0f msg/s  (%d messages in %.3fs)\n", name, rate, iterations * MESSAGE_COUNT, elapsed);
+    return rate;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0) iterations = DEFAULT_ITERATIONS;
+
+    run("legacy", parse_legacy, iterations / 10); // warm-up
+    run("tokens", parse_tokens, iterations / 10);
+    printf("\n");
+
+    double legacy = run("legacy", parse_legacy, iterations);
+    double tokens = run("tokens", parse_tokens, iterations);
+    printf("speedup  %.2fx\n", tokens / legacy);
+    return 0;
+}
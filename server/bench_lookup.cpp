@@ -0,0 +1,129 @@
+// bench_lookup.cpp - get_client() / get_client_by_username() cost vs connected clients
+//
+// Build & run: make bench-lookup
+// Fills the registry with N logged-in fake clients (no sockets) and times
+// random lookups through sock_index / name_index. The legacy column is the
+// slot scan the server did before the indexes, for comparison.
+
+#define BATTLESHIP_NO_MAIN
+#include "server_full.cpp"
+
+#define BENCH_MAX_CLIENTS 100000
+#define BENCH_LOOKUPS 1000000
+#define LEGACY_LOOKUPS 2000
+#define BENCH_SOCK_BASE 1000000  // never a real fd
+
+static volatile long sink; // keeps the compiler from dropping the lookups
+
+// What get_client() / get_client_by_username() did before the indexes
+static Client *legacy_get_client(int sock) {
+    for (int i = 0; i < client_slots.high; i++) {
+        if (client_at(i) != NULL && client_at(i)->sock == sock) return client_at(i);
+    }
+    return NULL;
+}
+
+static Client *legacy_get_client_by_username(const char *username) {
+    for (int i = 0; i < client_slots.high; i++) {
+        if (client_at(i) != NULL &&
+            client_at(i)->status != PLAYER_OFFLINE &&
+            strcmp(client_at(i)->username, username) == 0) {
+            return client_at(i);
+        }
+    }
+    return NULL;
+}
+
+static double ns_per_lookup(unsigned long start, int lookups) {
+    return (monotonic_us() - start) * 1000.0 / lookups;
+}
+
+// Fills ns[] with: by sock, by name, legacy by sock, legacy by name
+static void run(int count, double ns[4]) {
+    static Client *clients[BENCH_MAX_CLIENTS];
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    char name[USERNAME_SIZE];
+
+    for (int i = 0; i < count; i++) {
+        clients[i] = create_client(BENCH_SOCK_BASE + i, &address);
+        if (!clients[i]) {
+            fprintf(stderr, "create_client failed at %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+        snprintf(name, sizeof(name), "player_%d", i);
+        set_username(clients[i], name);
+        set_status(clients[i], PLAYER_ONLINE);
+    }
+
+    // Same pseudo-random targets for every column
+    unsigned int seed = 12345;
+    unsigned long start = monotonic_us();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        sink += (long)get_client(BENCH_SOCK_BASE + (int)(rand_r(&seed) % count));
+    }
+    ns[0] = ns_per_lookup(start, BENCH_LOOKUPS);
+
+    seed = 12345;
+    start = monotonic_us();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        snprintf(name, sizeof(name), "player_%d", (int)(rand_r(&seed) % count));
+        sink += (long)get_client_by_username(name);
+    }
+    ns[1] = ns_per_lookup(start, BENCH_LOOKUPS);
+
+    seed = 12345;
+    start = monotonic_us();
+    for (int i = 0; i < LEGACY_LOOKUPS; i++) {
+        pthread_mutex_lock(&clients_mutex);
+        sink += (long)legacy_get_client(BENCH_SOCK_BASE + (int)(rand_r(&seed) % count));
+        pthread_mutex_unlock(&clients_mutex);
+    }
+    ns[2] = ns_per_lookup(start, LEGACY_LOOKUPS);
+
+    seed = 12345;
+    start = monotonic_us();
+    for (int i = 0; i < LEGACY_LOOKUPS; i++) {
+        snprintf(name, sizeof(name), "player_%d", (int)(rand_r(&seed) % count));
+        pthread_mutex_lock(&clients_mutex);
+        sink += (long)legacy_get_client_by_username(name);
+        pthread_mutex_unlock(&clients_mutex);
+    }
+    ns[3] = ns_per_lookup(start, LEGACY_LOOKUPS);
+
+    for (int i = 0; i < count; i++) {
+        handle_disconnect(clients[i]);
+        release_client(clients[i]);
+    }
+}
+
+int main() {
+    // Silence the per-client connect/disconnect logging
+    FILE *log = fopen("/dev/null", "w");
+    int out = dup(STDOUT_FILENO);
+    if (!log || out < 0) {
+        perror("/dev/null");
+        return EXIT_FAILURE;
+    }
+
+    slot_table_init(&client_slots, BENCH_MAX_CLIENTS);
+    slot_table_init(&game_slots, BENCH_MAX_CLIENTS / 2);
+    client_index_init(&sock_index, BENCH_MAX_CLIENTS);
+    client_index_init(&name_index, BENCH_MAX_CLIENTS);
+    timers_init();
+    idle_timeout = 0;
+
+    printf("ns per lookup (indexed, then the legacy slot scan)\n");
+    printf("%8s %12s %12s %14s %14s\n", "clients", "by sock", "by name", "legacy sock", "legacy name");
+    int counts[] = { 100, 1000, 10000, 100000 };
+    for (int i = 0; i < 4; i++) {
+        double ns[4];
+        fflush(stdout);
+        dup2(fileno(log), STDOUT_FILENO);
+        run(counts[i], ns);
+        fflush(stdout);
+        dup2(out, STDOUT_FILENO);
+        printf("%8d %12.0f %12.0f %14.0f %14.0f\n", counts[i], ns[0], ns[1], ns[2], ns[3]);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,210 @@
+// fuzz_commands.cpp - in-process fuzz harness and throughput benchmark for the command layer
+//
+// Compiles server_full.cpp without its main() and drives two fake clients
+// through client_feed_input(), i.e. the same framing, tokenizer, dispatch and
+// handlers as a socket read, but with no sockets: queued replies are counted
+// and dropped by a stub IoBackend.
+//
+// Input format: bytes go to client A; every 0xFF byte switches to the other
+// client (0xFF never appears in UTF-8 JSON). Seeds live in fuzz_corpus/.
+//
+//   make fuzz                      ASan/UBSan build, replays fuzz_corpus/ once
+//   ./fuzz_commands FILE...        replay inputs (also the AFL entry point:
+//                                  afl-fuzz -i fuzz_corpus -o findings -- ./fuzz_commands @@)
+//   make fuzz-libfuzzer            clang -fsanitize=fuzzer build, then
+//                                  ./fuzz_commands_lf fuzz_corpus
+//   make bench-commands            -O2 build, replays the corpus as sessions/sec
+//
+// users.dat and history/ are written to a private directory under /tmp, which
+// becomes the working directory: give libFuzzer absolute corpus paths.
+
+#include <sys/stat.h>
+
+#define BATTLESHIP_NO_MAIN
+#include "server_full.cpp"
+
+#define FUZZ_SWITCH_CLIENT 0xFF
+#define FUZZ_SOCK_BASE 1000000     // never a real fd, so close()/shutdown() fail harmlessly
+#define BENCH_SECONDS 3
+
+static unsigned long fuzz_reply_bytes = 0;
+static unsigned long fuzz_reply_messages = 0;
+
+static int fuzz_init(int port) { (void)port; return 0; }
+static void fuzz_run() {}
+
+// Every reply ends up here instead of in a socket
+static void fuzz_flush(Client *client) {
+    pthread_mutex_lock(&client->out_mutex);
+    for (OutChunk *chunk = client->out_head; chunk; chunk = chunk->next) {
+        __atomic_add_fetch(&fuzz_reply_messages, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&fuzz_reply_bytes, client->out_bytes, __ATOMIC_RELAXED);
+    out_drop(client);
+    pthread_mutex_unlock(&client->out_mutex);
+}
+
+static IoBackend fuzz_backend = { "fuzz", fuzz_init, fuzz_run, fuzz_flush };
+
+static void fuzz_setup(int verbose) {
+    static int ready = 0;
+    if (ready) return;
+    ready = 1;
+
+    char dir[] = "/tmp/battleship-fuzz-XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0 || mkdir("history", 0755) != 0) {
+        perror("fuzz workspace");
+        exit(EXIT_FAILURE);
+    }
+    // The server logs every message; that would dominate both fuzzing and the benchmark
+    if (!verbose && !freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+        exit(EXIT_FAILURE);
+    }
+
+    slot_table_init(&client_slots, DEFAULT_MAX_CLIENTS);
+    slot_table_init(&game_slots, DEFAULT_MAX_CLIENTS / 2);
+    client_index_init(&sock_index, DEFAULT_MAX_CLIENTS);
+    client_index_init(&name_index, DEFAULT_MAX_CLIENTS);
+    io_backend = &fuzz_backend;
+    timers_init();   // armed but never fired: no callback runs between inputs
+    queries_start();
+    game_workers_start();
+}
+
+// One input = one pair of connections, from WELCOME to disconnect
+static void fuzz_session(const unsigned char *data, size_t size) {
+    static int next_sock = FUZZ_SOCK_BASE;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+
+    Client *clients[2];
+    for (int i = 0; i < 2; i++) {
+        clients[i] = create_client(next_sock++, &address);
+        if (!clients[i]) {
+            fprintf(stderr, "fuzz: create_client failed\n");
+            abort();
+        }
+        send_welcome(clients[i]);
+        flush_pending_output();
+    }
+
+    int current = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= size; i++) {
+        if (i < size && data[i] != FUZZ_SWITCH_CLIENT) continue;
+        if (i > start) client_feed_input(clients[current], (const char *)data + start, i - start);
+        current ^= 1;
+        start = i + 1;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        handle_disconnect(clients[i]);
+        release_client(clients[i]);
+    }
+    if (next_sock > FUZZ_SOCK_BASE + 1000000) next_sock = FUZZ_SOCK_BASE;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size) {
+    fuzz_setup(0);
+    fuzz_session(data, size);
+    return 0;
+}
+
+#ifndef BATTLESHIP_LIBFUZZER
+
+static unsigned char *read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    size_t cap = 4096, len = 0;
+    unsigned char *data = (unsigned char *)malloc(cap);
+    size_t n;
+    while (data && (n = fread(data + len, 1, cap - len, fp)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            unsigned char *grown = (unsigned char *)realloc(data, cap);
+            if (!grown) free(data);
+            data = grown;
+        }
+    }
+    fclose(fp);
+    *size = len;
+    return data;
+}
+
+static unsigned long total_commands() {
+    unsigned long total = 0;
+    for (int i = 0; i < CMD_COUNT; i++) {
+        total += __atomic_load_n(&command_stats[i].calls, __ATOMIC_RELAXED) +
+                 __atomic_load_n(&command_stats[i].refused, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// Replay every corpus file round-robin for BENCH_SECONDS
+static int run_bench(unsigned char **inputs, size_t *sizes, int count) {
+    size_t corpus_bytes = 0;
+    for (int i = 0; i < count; i++) corpus_bytes += sizes[i];
+
+    fuzz_setup(0);
+    for (int i = 0; i < count; i++) fuzz_session(inputs[i], sizes[i]); // warm up users.dat
+
+    unsigned long commands_before = total_commands();
+    unsigned long replies_before = fuzz_reply_messages;
+    unsigned long rounds = 0;
+    unsigned long start = monotonic_us();
+    unsigned long elapsed;
+    do {
+        for (int i = 0; i < count; i++) fuzz_session(inputs[i], sizes[i]);
+        rounds++;
+        elapsed = monotonic_us() - start;
+    } while (elapsed < BENCH_SECONDS * 1000000UL);
+
+    double seconds = elapsed / 1e6;
+    fprintf(stderr, "Corpus: %d files, %zu bytes\n", count, corpus_bytes);
+    fprintf(stderr, "%-12s %12.0f/s\n", "sessions", rounds * count / seconds);
+    fprintf(stderr, "%-12s %12.0f/s\n", "commands", (total_commands() - commands_before) / seconds);
+    fprintf(stderr, "%-12s %12.0f/s\n", "replies", (fuzz_reply_messages - replies_before) / seconds);
+    fprintf(stderr, "%-12s %12.1f MB/s\n", "input", rounds * corpus_bytes / seconds / 1e6);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    int verbose = 0, bench = 0, first = 1;
+    for (; first < argc && argv[first][0] == '-'; first++) {
+        if (strcmp(argv[first], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[first], "-v") == 0) {
+            verbose = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-v] [--bench] FILE...\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (first == argc) {
+        fprintf(stderr, "Usage: %s [-v] [--bench] FILE...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Read everything first: fuzz_setup() changes the working directory
+    int count = argc - first;
+    unsigned char **inputs = (unsigned char **)calloc(count, sizeof(*inputs));
+    size_t *sizes = (size_t *)calloc(count, sizeof(*sizes));
+    for (int i = 0; i < count; i++) {
+        inputs[i] = read_file(argv[first + i], &sizes[i]);
+        if (!inputs[i]) {
+            fprintf(stderr, "cannot read %s\n", argv[first + i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (bench) return run_bench(inputs, sizes, count);
+
+    fuzz_setup(verbose);
+    for (int i = 0; i < count; i++) fuzz_session(inputs[i], sizes[i]);
+    fprintf(stderr, "Replayed %d inputs, %lu replies\n", count, fuzz_reply_messages);
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -4,18 +4,62 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <stddef.h>
+#include <zlib.h>
+#include "json_tokens.h"
+#include "battleship_wire.h"
+#include "battleship_messages.h"
 
 #define PORT 8080
-#define MAX_CLIENTS 100
+#define DEFAULT_MAX_CLIENTS 50000 // overridden with --max-clients
+#define SLOT_INITIAL_CAPACITY 64
+#define MAX_ACCOUNTS 100 // users.dat lines kept in memory
 #define BUFFER_SIZE 4096
 #define USERNAME_SIZE 50
 #define PASSWORD_SIZE 100
 #define GRID_SIZE 10
 #define MAX_SHIPS 5
+#define MAX_EPOLL_EVENTS 256
+#define MAX_REACTORS 64
+#define STATS_INTERVAL 30 // seconds between [STATS] reports
+#define URING_ENTRIES 1024
+#define URING_BUF_COUNT 512 // provided recv buffers per ring (power of 2)
+#define URING_BUF_GROUP 0
+#define OUTQ_HIGH_WATER (256 * 1024) // queued bytes before a slow client is dropped
+#define OUTQ_MAX_IOV 64              // iovecs per writev()
+#define FLUSH_LIST_SIZE 64
+#define TIMER_TICK_MS 100
+#define TIMER_WHEEL_SLOTS 512        // power of 2; one revolution = 51.2s
+#define TIMER_BATCH 64               // callbacks run per timer_mutex release
+#define IDLE_TIMEOUT 300             // seconds of silence before disconnecting (--idle-timeout)
+#define MATCH_ACCEPT_TIMEOUT 30      // seconds to accept a MATCH_FOUND
+#define HEARTBEAT_INTERVAL_MS 1000   // server-measured RTT via HEARTBEAT / HEARTBEAT_ACK
+#define OVERLOAD_QUEUE_BYTES (64UL * 1024 * 1024) // total queued output that counts as overload
+#define OVERLOAD_LATENCY_US 50000    // average command latency that counts as overload
+#define REPLY_INITIAL 512            // first size of a response buffer (grows as needed)
+#define REPLY_SPARE_MAX (64 * 1024)  // larger response buffers are not kept for reuse
+#define REQUEST_ID_SIZE 65           // longest request "id" echoed back (raw JSON text)
+#define QUERY_WORKERS 2              // threads answering LEADERBOARD / MATCH_HISTORY
+#define QUERY_QUEUE_MAX 1024         // slow queries waiting before new ones are refused
+#define MAX_GAME_WORKERS 64          // --game-workers cap (default: one per core)
+#define BATCH_MAX_COMMANDS 32        // commands in one BATCH
+#define COMPRESS_MIN_BYTES 256       // shorter replies are never deflated
+#define PLAYER_LIST_MAX_BYTES BUFFER_SIZE // longer PLAYER_LIST replies are truncated (see "total")
+#define PLAYER_LIST_MAX_ENTRIES (PLAYER_LIST_MAX_BYTES / 32) // no entry is shorter than 32 bytes
 
 // Enums for game states
 typedef enum {
@@ -25,6 +69,62 @@ typedef enum {
     PLAYER_IN_GAME = 3
 } PlayerStatus;
 
+// Rate limit / admission classes
+typedef enum {
+    CMD_CLASS_GAME = 0,     // in-game actions, heartbeats: never shed
+    CMD_CLASS_CONTROL = 1,  // login, matchmaking, challenges, chat
+    CMD_CLASS_QUERY = 2,    // disk-backed lists: first to go under load
+    CMD_CLASS_COUNT = 3
+} CommandClass;
+
+// Framing of a connection, chosen with HELLO before LOGIN
+typedef enum {
+    PROTO_JSON = 0,    // newline-delimited JSON (default)
+    PROTO_BINARY = 1   // battleship_wire.h frames
+} WireProtocol;
+
+// Token bucket in millitokens so refill needs no floating point
+typedef struct {
+    long tokens;
+    unsigned long last_ms;
+} TokenBucket;
+
+// Every client command, defined once: X(NAME, handler, class). Expands into
+// CommandId, the dispatch table and switch, the WELCOME command list and the
+// per-command [STATS] rows.
+#define COMMAND_TABLE(X) \
+    X(HELLO,           cmd_hello,           CMD_CLASS_CONTROL) \
+    X(REGISTER,        cmd_register,        CMD_CLASS_CONTROL) \
+    X(LOGIN,           cmd_login,           CMD_CLASS_CONTROL) \
+    X(PLAYER_LIST,     cmd_player_list,     CMD_CLASS_QUERY) \
+    X(MATCH_HISTORY,   cmd_match_history,   CMD_CLASS_QUERY) \
+    X(CHALLENGE,       cmd_challenge,       CMD_CLASS_CONTROL) \
+    X(CHALLENGE_REPLY, cmd_challenge_reply, CMD_CLASS_CONTROL) \
+    X(PLACE_SHIPS,     cmd_place_ships,     CMD_CLASS_GAME) \
+    X(MOVE,            cmd_move,            CMD_CLASS_GAME) \
+    X(CHAT,            cmd_chat,            CMD_CLASS_CONTROL) \
+    X(SURRENDER,       cmd_surrender,       CMD_CLASS_GAME) \
+    X(DRAW_OFFER,      cmd_draw_offer,      CMD_CLASS_GAME) \
+    X(DRAW_REPLY,      cmd_draw_reply,      CMD_CLASS_GAME) \
+    X(START_MATCHING,  cmd_start_matching,  CMD_CLASS_CONTROL) \
+    X(CANCEL_MATCHING, cmd_cancel_matching, CMD_CLASS_CONTROL) \
+    X(MATCH_READY,     cmd_match_ready,     CMD_CLASS_CONTROL) \
+    X(MATCH_DECLINE,   cmd_match_decline,   CMD_CLASS_CONTROL) \
+    X(LEADERBOARD,     cmd_leaderboard,     CMD_CLASS_QUERY) \
+    X(LOGOUT,          cmd_logout,          CMD_CLASS_CONTROL) \
+    X(PING,            cmd_ping,            CMD_CLASS_GAME) \
+    X(HEARTBEAT_ACK,   cmd_heartbeat_ack,   CMD_CLASS_GAME) \
+    X(UPDATE_PING,     cmd_update_ping,     CMD_CLASS_GAME) \
+    X(BATCH,           cmd_batch,           CMD_CLASS_CONTROL)
+
+typedef enum {
+#define X(name, handler, cls) CMD_##name,
+    COMMAND_TABLE(X)
+#undef X
+    CMD_COUNT,
+    CMD_UNKNOWN = CMD_COUNT
+} CommandId;
+
 typedef enum {
     GAME_WAITING = 0,
     GAME_PLACING_SHIPS = 1,
@@ -32,6 +132,13 @@ typedef enum {
     GAME_FINISHED = 3
 } GameStatus;
 
+// I/O model used to serve client sockets
+typedef enum {
+    SERVER_MODE_THREADED = 0, // 1 thread / client, blocking recv()
+    SERVER_MODE_EPOLL = 1,    // edge-triggered epoll reactor
+    SERVER_MODE_URING = 2     // io_uring rings (falls back to epoll)
+} ServerMode;
+
 // Ship structure
 typedef struct {
     char name[30];
@@ -60,69 +167,263 @@ typedef struct {
     int hits_received;
 } GameBoard;
 
-// Client structure
+// Timing wheel entry, embedded in the object it times. The callback gets the
+// owner's slot index and id instead of a pointer: the owner may be freed
+// after the timer fired but before the callback runs.
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer *prev;
+    unsigned long expires;  // absolute tick
+    void (*fn)(int slot, unsigned long id);
+    int slot;
+    unsigned long id;
+    int armed;
+} Timer;
+
+// Link in the retire list of an object freed through epoch_retire()
+typedef struct EpochNode {
+    struct EpochNode *next;
+    unsigned long epoch;    // global epoch when it was retired
+    void (*free_fn)(struct EpochNode *node);
+} EpochNode;
+
+typedef struct UringRing UringRing;
+
+// I/O thread: epoll instance or io_uring ring + SO_REUSEPORT listener
 typedef struct {
+    int id;
+    int epfd;
+    UringRing *uring;
+    int listen_fd;
+    pthread_t thread;
+    unsigned long accepted; // connections accepted so far
+    int active;             // connections currently open
+    unsigned long enters;   // io_uring_enter() syscalls
+    unsigned long sqes;     // SQEs submitted
+} Reactor;
+
+// Immutable message shared by many outbound queues (lobby-wide broadcasts)
+typedef struct OutFrame {
+    int refs;
+    size_t len;
+    char data[1];
+} OutFrame;
+
+// One queued outbound message: private bytes stored inline, or a shared frame
+typedef struct OutChunk {
+    struct OutChunk *next;
+    const char *data;
+    size_t len;
+    OutFrame *frame;        // NULL for inline data
+    size_t cap;             // reply buffers: bytes of inline_data, 0 otherwise
+    char inline_data[1];
+} OutChunk;
+
+// Client structure
+typedef struct Client {
     int sock;
-    PlayerStatus status;
+    PlayerStatus status; // atomic, xem get_status()
     char username[USERNAME_SIZE];
     char session_token[64]; // Token để xác thực session
     time_t last_active; // Thời gian hoạt động cuối
     struct sockaddr_in address;
-    int in_game_with; // socket của đối thủ
+    int in_game_with; // socket của đối thủ khi MATCH_FOUND đang chờ xác nhận (giữ clients_mutex)
+    struct GameSession *session; // ván đang chơi, NULL nếu không có (ghi khi giữ games_mutex, đọc qua session_get())
     GameBoard board;
-    int ready; // đã đặt xong tàu chưa
+    int ready; // đã đặt xong tàu chưa (board, ready, is_turn: chỉ worker của ván đọc/ghi)
     int is_turn; // lượt của mình không
-    int is_matching; // đang tìm trận không
-    int match_ready; // đã sẵn sàng sau khi matching
-    int ping; // ping của client (ms)
-    time_t last_ping_time; // thời điểm gửi ping gần nhất
+    int is_matching; // đang tìm trận không (giữ clients_mutex)
+    int match_ready; // đã sẵn sàng sau khi matching (giữ clients_mutex)
+    int ping; // RTT do server đo, đã làm mượt (ms)
+    int jitter; // độ dao động của RTT (ms)
+    int rtt_samples;
+    unsigned int ping_seq; // số thứ tự của HEARTBEAT gần nhất
+    unsigned long last_ping_time; // thời điểm gửi HEARTBEAT chưa được ACK (ms đơn điệu, 0 = không có)
+    char recv_buffer[BUFFER_SIZE]; // Buffer for incomplete messages
+    int recv_offset;               // Current offset in recv_buffer
+    int recv_discard;              // Skipping the rest of an oversized message
+    WireProtocol protocol;         // Only changes before LOGIN, so no other thread sends meanwhile
+    int compress;                  // Large replies as WIRE_OP_JSON_DEFLATE (binary only, set with protocol)
+    Reactor *reactor;              // I/O thread owning the socket (NULL in threaded mode)
+    void *io_ctx;                  // Backend per-connection state
+    int wake_fd;                   // Threaded mode: eventfd poked when output is left for the owner (-1 otherwise)
+    pthread_mutex_t out_mutex;     // Guards the outbound queue below
+    OutChunk *out_head;            // Messages waiting to be written
+    OutChunk *out_tail;
+    size_t out_offset;             // Bytes of out_head already written
+    size_t out_bytes;              // Total bytes queued
+    int out_inflight;              // io_uring SENDMSG currently owns the head of the queue
+    int out_closed;                // Output dropped (slow consumer or send error)
+    int slot;                      // Index in client_slots
+    struct Client *sock_next;      // Chain in sock_index (read without clients_mutex)
+    struct Client *name_next;      // Chain in name_index (once a username is set)
+    unsigned long id;              // Unique for the server's lifetime (validates timer callbacks)
+    Timer idle_timer;              // Idle eviction, re-armed lazily from last_active
+    Timer match_timer;             // MATCH_FOUND acceptance deadline
+    Timer heartbeat_timer;         // Next HEARTBEAT (logged-in clients only)
+    TokenBucket buckets[CMD_CLASS_COUNT]; // Per-connection rate limits
+    int refs;                      // the connection until release_client() + queued GameTasks
+    EpochNode retire;
 } Client;
 
-// Game session structure
+// I/O backend: how client sockets are accepted, read and written
+typedef struct {
+    const char *name;
+    int (*init)(int port);          // 0 = ready, -1 = not supported on this host
+    void (*run)(void);              // never returns
+    void (*flush)(Client *client);  // write queued output, callable from any thread
+} IoBackend;
+
+// Acquisitions of one mutex, and how many of them had to wait
 typedef struct {
-    int player1_sock;
-    int player2_sock;
+    unsigned long acquired;
+    unsigned long contended; // trylock failed, the thread blocked
+    unsigned long wait_us;   // total time spent blocked
+} LockStats;
+
+// Game session structure
+typedef struct GameSession {
+    Client *player1;        // NULL while that player is away (reconnect grace)
+    Client *player2;
     char player1_username[USERNAME_SIZE]; // Lưu username để reconnect
     char player2_username[USERNAME_SIZE];
     GameStatus status;
-    int current_turn; // socket của người chơi đang có lượt
+    Client *current_turn;   // người chơi đang có lượt
     time_t start_time;
     time_t player1_disconnect_time; // Thời gian disconnect
     time_t player2_disconnect_time;
     int player1_disconnected; // 0 = connected, 1 = disconnected
     int player2_disconnected;
     char log_id[50];
+    int slot; // Index in game_slots
+    unsigned long id;
+    Timer grace_timer;      // Reconnect grace of the disconnected player
+    GameBoard saved_board;  // Disconnected player's state, restored on reconnect
+    int saved_ready;
+    int saved_turn;
+    struct GameWorker *owner; // Thread that runs everything touching this game
+    int refs;               // game_slots until detached + queued GameTasks
+    EpochNode retire;
 } GameSession;
 
+// Growable slot array with a free list: O(1) alloc/free, stable indexes,
+// live entries are the non-NULL slots in [0, high)
+typedef struct {
+    void **slots;
+    int *next_free;
+    int capacity;  // slots allocated
+    int limit;     // runtime cap (--max-clients)
+    int high;      // slots ever handed out
+    int free_head; // -1 = free list empty
+    int used;
+} SlotTable;
+
+// Hash index over the clients in client_slots, chained through the Client itself
+typedef struct {
+    Client **buckets;
+    unsigned int mask;  // bucket count - 1 (power of two)
+} ClientIndex;
+
+
 // Global variables
-Client *clients[MAX_CLIENTS];
-GameSession *game_sessions[MAX_CLIENTS / 2];
+SlotTable client_slots;  // Client*, guarded by clients_mutex
+SlotTable game_slots;    // GameSession*, guarded by games_mutex
+ClientIndex sock_index;  // by sock, guarded by clients_mutex
+ClientIndex name_index;  // by username (logged-in or held clients), guarded by clients_mutex
+int max_clients = DEFAULT_MAX_CLIENTS;
+int idle_timeout = IDLE_TIMEOUT;  // 0 = never evict idle connections
+int reconnect_grace = 0;          // 0 = disconnect during a game is an instant loss
+unsigned long next_object_id = 0;
 pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t games_mutex = PTHREAD_MUTEX_INITIALIZER;
+LockStats clients_lock_stats;   // written while holding clients_mutex
+LockStats games_lock_stats;     // written while holding games_mutex
+ServerMode server_mode = SERVER_MODE_THREADED;
+unsigned long out_messages = 0; // messages queued for sending
+unsigned long out_writes = 0;   // gather writes (sendmsg / SENDMSG SQE) that carried them
+unsigned long out_queued_bytes = 0; // bytes waiting in all outbound queues
+unsigned long handler_latency_us = 0; // EWMA of handle_command() time
+unsigned long rate_limited = 0;     // commands refused by a token bucket
+unsigned long shed_queries = 0;     // low-priority commands refused while overloaded
+unsigned long rejected_connections = 0;
+IoBackend *io_backend = NULL;
+Reactor *reactors = NULL;
+int reactor_count = 1;
 
 // Function prototypes
-void add_client(Client *client);
-void remove_client(int sock);
+void slot_table_init(SlotTable *table, int limit);
+void client_index_init(ClientIndex *index, int capacity);
+int slot_alloc(SlotTable *table, void *item);
+void slot_free(SlotTable *table, int index);
+int add_client(Client *client);
+void timer_init(Timer *timer);
+void timer_schedule(Timer *timer, unsigned int delay_ms, void (*fn)(int, unsigned long), int slot, unsigned long id);
+void timer_cancel(Timer *timer);
+void timers_start();
+void epoch_enter();
+void epoch_exit();
+void epoch_retire(EpochNode *node, void (*free_fn)(EpochNode *node));
+void epoch_reclaim();
+void client_idle_expired(int slot, unsigned long id);
+void match_accept_expired(int slot, unsigned long id);
+void reconnect_grace_expired(int slot, unsigned long id);
+void client_heartbeat(int slot, unsigned long id);
+void handle_heartbeat_ack(Client *client, unsigned int seq);
+int server_overloaded();
+CommandId command_lookup(const char *cmd);
+void send_welcome(Client *client);
+int begin_reconnect_grace(Client *client);
+int resume_game(Client *client);
+void remove_client(Client *client);
 Client* get_client(int sock);
 Client* get_client_by_username(const char *username);
 void send_message(int sock, const char *message);
+void send_to_client(Client *client, const char *message);
+void queue_message(Client *client, const char *message, size_t len);
+BsWriter* reply_begin();
+void reply_send(Client *client);
+void reply_discard();
+void queue_packed(Client *client, int opcode, const void *body, size_t len);
+void send_move_result(Client *to, const char *coord, const char *result, const char *ship_sunk, int your_shot, int game_over);
+void send_turn_change(Client *to, int your_turn);
+OutFrame* frame_create(const char *message, size_t len);
+void frame_release(OutFrame *frame);
+void queue_frame(Client *client, OutFrame *frame);
+int flush_client_output(Client *client);
+int client_has_output(Client *client);
+void flush_pending_output();
 void broadcast_message(const char *message, int sender_sock);
 int authenticate_user(const char *username, const char *password);
 int register_user(const char *username, const char *password);
 void handle_client(Client *client);
 void *client_thread(void *arg);
-void handle_command(Client *client, const char *cmd, const char *payload);
-void send_player_list(int sock);
+Client* create_client(int sock, struct sockaddr_in *address);
+void release_client(Client *client);
+void process_message(Client *client, char *buffer);
+void process_frame(Client *client, const WireFrame *frame);
+void client_process_input(Client *client, int len);
+void client_feed_input(Client *client, const char *data, int len);
+void handle_command(Client *client, CommandId id, const JsonDoc *doc, int payload);
+void dispatch_message(Client *client, const JsonDoc *doc, int msg);
+void run_threaded_server(int server_fd);
+void *reactor_thread(void *arg);
+void *uring_thread(void *arg);
+int create_listener(int port, int reuseport);
+void run_io_threads(void *(*thread_fn)(void *));
+void print_server_stats();
+void print_command_stats();
+void raise_fd_limit(int clients);
+void send_player_list(Client *client, unsigned long version);
 void handle_challenge(Client *challenger, const char *target_username);
 void handle_challenge_reply(Client *client, const char *challenger_username, const char *status);
 void start_game(Client *player1, Client *player2);
-void handle_place_ships(Client *client, const char *ships_data);
+void handle_place_ships(Client *client, const JsonDoc *doc, int ships);
 void handle_move(Client *client, const char *coord);
-void check_game_end(GameSession *session);
-void end_game(GameSession *session, int winner_sock, const char *reason);
+void end_game(GameSession *session, Client *winner, const char *reason);
 void handle_surrender(Client *client);
 void handle_draw_offer(Client *client);
 void handle_draw_reply(Client *client, const char *status);
+void handle_chat(Client *client, const char *message);
 void cleanup_game_on_exit(Client *client, int notify_opponent);
 void handle_disconnect(Client *client);
 void handle_logout(Client *client);
@@ -131,9 +432,70 @@ void handle_start_matching(Client *client);
 void handle_cancel_matching(Client *client);
 void handle_match_ready(Client *client);
 void handle_match_decline(Client *client);
-void handle_leaderboard(Client *client);
+int write_leaderboard();
+void write_match_history(const char *username);
+void query_submit(Client *client, CommandId cmd);
+void queries_start();
 void try_match_players();
 
+// ==================== VIEW VERSIONS ====================
+// LEADERBOARD and PLAYER_LIST replies carry a "version". A client that sends
+// back the version it holds gets NOT_MODIFIED instead of a rebuilt list.
+// leaderboard_version moves whenever users.dat is rewritten. The player list
+// also depends on who is online and in which state (presence_version), so its
+// version is the sum of both. Versions are bumped after the change and read
+// before a list is built, so a reply is never tagged newer than its content.
+// Both start from the boot time (view_versions_init()), so a version handed
+// out before a restart does not match the new server's lists by accident.
+
+static unsigned long leaderboard_version = 1;
+static unsigned long presence_version = 1;
+
+void view_versions_init() {
+    // 2^20 changes per second between boots; the sum stays below 2^53 (exact in a JavaScript number)
+    unsigned long seed = (unsigned long)time(NULL) << 20;
+    leaderboard_version = seed;
+    presence_version = seed;
+}
+
+static void presence_changed() {
+    __atomic_add_fetch(&presence_version, 1, __ATOMIC_RELEASE);
+}
+
+// status is atomic (relaxed): lists, heartbeats and command checks read it on
+// any thread, and nothing else is published through it. The game itself is
+// in the session, and a match being confirmed is under clients_mutex.
+static PlayerStatus get_status(const Client *client) {
+    return __atomic_load_n(&client->status, __ATOMIC_RELAXED);
+}
+
+// LOGIN and leaving (LOGOUT, disconnect): always takes effect
+static void store_status(Client *client, PlayerStatus status) {
+    if (__atomic_exchange_n(&client->status, status, __ATOMIC_RELAXED) != status) {
+        presence_changed();
+    }
+}
+
+// Lobby and game transitions. A game or match ending on another thread must
+// not bring back a player who has just gone PLAYER_OFFLINE, so that status
+// is only left through store_status().
+static void set_status(Client *client, PlayerStatus status) {
+    PlayerStatus old = get_status(client);
+    do {
+        if (old == status || old == PLAYER_OFFLINE) return;
+    } while (!__atomic_compare_exchange_n(&client->status, &old, status, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    presence_changed();
+}
+
+static void leaderboard_changed() {
+    __atomic_add_fetch(&leaderboard_version, 1, __ATOMIC_RELEASE);
+}
+
+static unsigned long player_list_version() {
+    return __atomic_load_n(&presence_version, __ATOMIC_ACQUIRE) +
+           __atomic_load_n(&leaderboard_version, __ATOMIC_ACQUIRE);
+}
+
 // Utility functions
 void init_board(GameBoard *board) {
     memset(board->grid, 0, sizeof(board->grid));
@@ -147,1357 +509,4469 @@ void generate_session_token(char *token) {
     sprintf(token, "%ld_%d", time(NULL), rand());
 }
 
-void add_client(Client *client) {
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] == NULL) {
-            clients[i] = client;
-            break;
-        }
-    }
-    pthread_mutex_unlock(&clients_mutex);
-}
+// ==================== SLOT TABLES ====================
 
-void remove_client(int sock) {
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] != NULL && clients[i]->sock == sock) {
-            clients[i] = NULL;
-            break;
-        }
-    }
-    pthread_mutex_unlock(&clients_mutex);
+void slot_table_init(SlotTable *table, int limit) {
+    table->slots = NULL;
+    table->next_free = NULL;
+    table->capacity = 0;
+    table->limit = limit;
+    table->high = 0;
+    table->free_head = -1;
+    table->used = 0;
 }
 
-Client* get_client(int sock) {
-    pthread_mutex_lock(&clients_mutex);
-    Client *result = NULL;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] != NULL && clients[i]->sock == sock) {
-            result = clients[i];
-            break;
+// Returns the slot index, or -1 when the table is at its limit (or out of memory)
+int slot_alloc(SlotTable *table, void *item) {
+    int index;
+    if (table->free_head >= 0) {
+        index = table->free_head;
+        table->free_head = table->next_free[index];
+    } else {
+        if (table->high == table->limit) return -1;
+        if (table->high == table->capacity) {
+            // Double, so the amortized cost per allocation stays O(1)
+            int capacity = table->capacity ? table->capacity * 2 : SLOT_INITIAL_CAPACITY;
+            if (capacity > table->limit) capacity = table->limit;
+            void **slots = (void **)realloc(table->slots, capacity * sizeof(void *));
+            if (!slots) return -1;
+            table->slots = slots;
+            int *next_free = (int *)realloc(table->next_free, capacity * sizeof(int));
+            if (!next_free) return -1;
+            table->next_free = next_free;
+            table->capacity = capacity;
         }
+        index = table->high++;
     }
-    pthread_mutex_unlock(&clients_mutex);
-    return result;
+    table->slots[index] = item;
+    table->used++;
+    return index;
 }
 
-Client* get_client_by_username(const char *username) {
-    pthread_mutex_lock(&clients_mutex);
-    Client *result = NULL;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] != NULL && 
-            clients[i]->status != PLAYER_OFFLINE &&
-            strcmp(clients[i]->username, username) == 0) {
-            result = clients[i];
-            break;
-        }
-    }
-    pthread_mutex_unlock(&clients_mutex);
-    return result;
+void slot_free(SlotTable *table, int index) {
+    table->slots[index] = NULL;
+    table->next_free[index] = table->free_head;
+    table->free_head = index;
+    table->used--;
 }
 
-void send_message(int sock, const char *message) {
-    if (send(sock, message, strlen(message), MSG_NOSIGNAL) < 0) {
-        printf("Send failed to socket %d: %s\n", sock, strerror(errno));
-    }
+// ==================== TIMING WHEEL ====================
+// Hashed wheel: a timer due at tick T lives in bucket T % TIMER_WHEEL_SLOTS,
+// so scheduling and cancelling are O(1) list operations. One thread advances
+// the wheel every TIMER_TICK_MS and fires the due timers of each bucket;
+// timers more than one revolution away stay put until their round comes.
+// timer_mutex is a leaf lock: it may be taken while holding clients_mutex or
+// games_mutex, and callbacks run without it.
+
+static Timer timer_wheel[TIMER_WHEEL_SLOTS]; // list heads
+static unsigned long timer_tick = 0;         // last tick processed
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void timer_init(Timer *timer) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->armed = 0;
 }
 
-void broadcast_message(const char *message, int sender_sock) {
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] != NULL && 
-            clients[i]->sock != sender_sock && 
-            clients[i]->status != PLAYER_OFFLINE) {
-            send_message(clients[i]->sock, message);
-        }
-    }
-    pthread_mutex_unlock(&clients_mutex);
+static void timer_unlink(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->armed = 0;
 }
 
-// Authentication functions (simple file-based storage)
-int register_user(const char *username, const char *password) {
-    FILE *fp = fopen("users.dat", "a+");
-    if (!fp) return 0;
+// (Re)arm a timer; delays are rounded up to whole ticks
+void timer_schedule(Timer *timer, unsigned int delay_ms, void (*fn)(int, unsigned long), int slot, unsigned long id) {
+    unsigned long ticks = (delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks == 0) ticks = 1;
     
-    // Check if username exists
-    char line[256];
-    rewind(fp);
-    while (fgets(line, sizeof(line), fp)) {
-        char stored_user[USERNAME_SIZE];
-        sscanf(line, "%[^:]:", stored_user);
-        if (strcmp(stored_user, username) == 0) {
-            fclose(fp);
-            return 0; // Username already exists
-        }
-    }
+    pthread_mutex_lock(&timer_mutex);
+    if (timer->armed) timer_unlink(timer);
+    timer->expires = timer_tick + ticks;
+    timer->fn = fn;
+    timer->slot = slot;
+    timer->id = id;
     
-    // Add new user with default ELO 800
-    fprintf(fp, "%s:%s:800:0:0\n", username, password);
-    fclose(fp);
-    return 1;
+    Timer *head = &timer_wheel[timer->expires & (TIMER_WHEEL_SLOTS - 1)];
+    timer->next = head->next;
+    timer->prev = head;
+    head->next->prev = timer;
+    head->next = timer;
+    timer->armed = 1;
+    pthread_mutex_unlock(&timer_mutex);
 }
 
-int authenticate_user(const char *username, const char *password) {
-    FILE *fp = fopen("users.dat", "r");
-    if (!fp) return 0;
+// Safe on timers that never fired, already fired or were never armed
+void timer_cancel(Timer *timer) {
+    pthread_mutex_lock(&timer_mutex);
+    if (timer->armed) timer_unlink(timer);
+    pthread_mutex_unlock(&timer_mutex);
+}
+
+static unsigned long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void timer_fire_bucket(Timer *head) {
+    struct { void (*fn)(int, unsigned long); int slot; unsigned long id; } due[TIMER_BATCH];
     
-    char line[256];
-    while (fgets(line, sizeof(line), fp)) {
-        char stored_user[USERNAME_SIZE];
-        char stored_pass[PASSWORD_SIZE];
-        sscanf(line, "%[^:]:%[^:]:", stored_user, stored_pass);
-        if (strcmp(stored_user, username) == 0 && strcmp(stored_pass, password) == 0) {
-            fclose(fp);
-            return 1;
+    while (1) {
+        int count = 0;
+        pthread_mutex_lock(&timer_mutex);
+        Timer *timer = head->next;
+        while (timer != head && count < TIMER_BATCH) {
+            Timer *next = timer->next;
+            if (timer->expires <= timer_tick) {
+                // Copy out: the owner may free the timer as soon as we unlock
+                due[count].fn = timer->fn;
+                due[count].slot = timer->slot;
+                due[count].id = timer->id;
+                count++;
+                timer_unlink(timer);
+            }
+            timer = next;
         }
+        int more = timer != head;
+        pthread_mutex_unlock(&timer_mutex);
+        
+        epoch_enter();
+        for (int i = 0; i < count; i++) {
+            due[i].fn(due[i].slot, due[i].id);
+        }
+        flush_pending_output();
+        epoch_exit();
+        if (!more) break;
     }
-    
-    fclose(fp);
-    return 0;
 }
 
-// Get player ELO
-int get_player_elo(const char *username) {
-    FILE *fp = fopen("users.dat", "r");
-    if (!fp) return 800; // Default ELO
+void *timer_thread(void *arg) {
+    (void)arg;
+    unsigned long start = monotonic_ms();
     
-    char line[256];
-    while (fgets(line, sizeof(line), fp)) {
-        char stored_user[USERNAME_SIZE];
-        char stored_pass[PASSWORD_SIZE];
-        int elo, games_played, games_won;
-        sscanf(line, "%[^:]:%[^:]:%d:%d:%d", stored_user, stored_pass, &elo, &games_played, &games_won);
-        if (strcmp(stored_user, username) == 0) {
-            fclose(fp);
-            return elo;
+    while (1) {
+        struct timespec pause = { 0, TIMER_TICK_MS * 1000000L };
+        nanosleep(&pause, NULL);
+        
+        // Catch up on every tick that elapsed, even if a callback was slow
+        unsigned long target = (monotonic_ms() - start) / TIMER_TICK_MS;
+        while (1) {
+            pthread_mutex_lock(&timer_mutex);
+            if (timer_tick >= target) {
+                pthread_mutex_unlock(&timer_mutex);
+                break;
+            }
+            timer_tick++;
+            Timer *head = &timer_wheel[timer_tick & (TIMER_WHEEL_SLOTS - 1)];
+            pthread_mutex_unlock(&timer_mutex);
+            timer_fire_bucket(head);
         }
+        epoch_reclaim(); // retired objects are otherwise only freed by the next retire
     }
-    
-    fclose(fp);
-    return 800;
+    return NULL;
 }
 
-// Update player ELO and stats
-void update_player_stats(const char *username, int elo_change, int is_winner) {
-    FILE *fp = fopen("users.dat", "r");
-    if (!fp) return;
-    
-    char lines[MAX_CLIENTS][256];
-    int line_count = 0;
-    
-    // Read all lines
-    while (fgets(lines[line_count], 256, fp) && line_count < MAX_CLIENTS) {
-        line_count++;
+// Empty wheel; timers can be armed from here on, they fire once timers_start() runs
+void timers_init() {
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        timer_wheel[i].next = &timer_wheel[i];
+        timer_wheel[i].prev = &timer_wheel[i];
     }
-    fclose(fp);
-    
-    // Update the user's line
-    fp = fopen("users.dat", "w");
-    if (!fp) return;
+}
+
+void timers_start() {
+    timers_init();
     
-    for (int i = 0; i < line_count; i++) {
-        char stored_user[USERNAME_SIZE];
-        char stored_pass[PASSWORD_SIZE];
-        int elo, games_played, games_won;
-        sscanf(lines[i], "%[^:]:%[^:]:%d:%d:%d", stored_user, stored_pass, &elo, &games_played, &games_won);
-        
-        if (strcmp(stored_user, username) == 0) {
-            elo += elo_change;
-            if (elo < 0) elo = 0; // Minimum ELO is 0
-            games_played++;
-            if (is_winner) games_won++;
-            fprintf(fp, "%s:%s:%d:%d:%d\n", stored_user, stored_pass, elo, games_played, games_won);
-        } else {
-            fprintf(fp, "%s", lines[i]);
-        }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, timer_thread, NULL) != 0) {
+        perror("pthread_create timer failed");
+        exit(EXIT_FAILURE);
     }
-    
-    fclose(fp);
+    pthread_detach(tid);
 }
 
-// Save match history to user's history file
-// Format: timestamp:opponent:result (WIN/LOSE/DRAW)
-void save_match_history(const char *username, const char *opponent, const char *result) {
-    // Create history directory if it doesn't exist
-    system("mkdir -p history");
-    
-    char filename[128];
-    sprintf(filename, "history/match_history_%s.dat", username);
-    
-    FILE *fp = fopen(filename, "a");
-    if (!fp) return;
-    
-    time_t now = time(NULL);
-    fprintf(fp, "%ld:%s:%s\n", now, opponent, result);
-    fclose(fp);
-    
-    printf("[MATCH_HISTORY] Saved for %s vs %s: %s\n", username, opponent, result);
+// ==================== LOCK CONTENTION ====================
+// clients_mutex and games_mutex are taken through lock_counted(): a trylock
+// first, and only when that fails a timed blocking lock. The counters are
+// written while holding the mutex, so they cost no atomics.
+// print_server_stats() reports both.
+
+void lock_counted(pthread_mutex_t *mutex, LockStats *stats) {
+    if (pthread_mutex_trylock(mutex) != 0) {
+        unsigned long start = monotonic_us();
+        pthread_mutex_lock(mutex);
+        stats->contended++;
+        stats->wait_us += monotonic_us() - start;
+    }
+    stats->acquired++;
 }
 
-// Get match history for a user
-void send_match_history(int sock, const char *username) {
-    char filename[128];
-    sprintf(filename, "history/match_history_%s.dat", username);
-    
-    FILE *fp = fopen(filename, "r");
-    
-    char response[BUFFER_SIZE * 4]; // Larger buffer for history
-    int offset = sprintf(response, "{\"cmd\":\"MATCH_HISTORY\",\"payload\":{\"matches\":[");
-    
-    if (fp) {
-        char line[256];
-        int first = 1;
-        int count = 0;
-        
-        // Read last 50 matches (or all if less)
-        char matches[50][256];
-        int match_count = 0;
-        while (fgets(line, sizeof(line), fp) && match_count < 50) {
-            strcpy(matches[match_count++], line);
-        }
-        fclose(fp);
-        
-        // Send in reverse order (newest first)
-        for (int i = match_count - 1; i >= 0; i--) {
-            long timestamp;
-            char opponent[USERNAME_SIZE];
-            char result[10];
-            
-            if (sscanf(matches[i], "%ld:%[^:]:%s", &timestamp, opponent, result) == 3) {
-                if (!first) offset += sprintf(response + offset, ",");
-                offset += sprintf(response + offset, 
-                    "{\"timestamp\":%ld,\"opponent\":\"%s\",\"result\":\"%s\"}", 
-                    timestamp, opponent, result);
-                first = 0;
-                count++;
-            }
+static void print_lock_stats(const char *name, const LockStats *stats) {
+    printf("[STATS] lock %s: acquired=%lu contended=%lu (%.2f%%) wait_us=%lu\n", name,
+           stats->acquired, stats->contended,
+           stats->acquired ? 100.0 * stats->contended / stats->acquired : 0.0, stats->wait_us);
+}
+
+// ==================== SAFE RECLAMATION ====================
+// Clients and game sessions are looked up without locks (get_client(),
+// session_get()) and used after the lookup, so one must not be freed while
+// another thread may still hold a pointer to it. Instead of free() they go to
+// epoch_retire(), and are freed once no thread can still see them
+// (epoch-based reclamation).
+//
+// A thread between epoch_enter() and epoch_exit() is pinned to the global
+// epoch it saw. The epoch only moves on once every pinned thread has seen the
+// current one, so an object unlinked and retired in epoch e is unreachable
+// for everyone by epoch e + 2. Each unit of work pins itself (input handling,
+// a timer batch, a game task), and a thread stays pinned while its flush list
+// holds clients. Pins nest, and must never span a blocking socket read.
+// Pointers kept beyond that (queued GameTasks) take a reference instead.
+
+typedef struct EpochRecord {
+    struct EpochRecord *next;   // every record ever made; never unlinked
+    unsigned long state;        // (epoch << 1) | 1 while pinned, 0 otherwise
+    int in_use;                 // claimed by a live thread
+    int nesting;                // owner thread only
+} EpochRecord;
+
+static unsigned long global_epoch = 0;
+static EpochRecord *epoch_records = NULL;
+static pthread_key_t epoch_key;          // destructor returns a thread's record
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+static __thread EpochRecord *epoch_self;
+static pthread_mutex_t retire_mutex = PTHREAD_MUTEX_INITIALIZER;
+static EpochNode *retire_head = NULL;    // oldest first, guarded by retire_mutex
+static EpochNode *retire_tail = NULL;
+static unsigned long retired_objects = 0;
+static unsigned long freed_objects = 0;
+
+static void epoch_thread_exit(void *arg) {
+    EpochRecord *record = (EpochRecord *)arg;
+    record->nesting = 0;
+    __atomic_store_n(&record->state, 0UL, __ATOMIC_RELEASE);
+    __atomic_store_n(&record->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_make_key() {
+    pthread_key_create(&epoch_key, epoch_thread_exit);
+}
+
+// This thread's record: a free one if an exited thread left it, else a new one
+static EpochRecord *epoch_register() {
+    pthread_once(&epoch_key_once, epoch_make_key);
+    EpochRecord *record;
+    for (record = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); record; record = record->next) {
+        int free_record = 0;
+        if (__atomic_compare_exchange_n(&record->in_use, &free_record, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+    if (!record) {
+        record = (EpochRecord *)calloc(1, sizeof(EpochRecord));
+        if (!record) {
+            perror("calloc epoch record failed");
+            exit(EXIT_FAILURE);
         }
+        record->in_use = 1;
+        record->next = __atomic_load_n(&epoch_records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&epoch_records, &record->next, record, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
     }
-    
-    offset += sprintf(response + offset, "]}}\n");
-    send_message(sock, response);
+    pthread_setspecific(epoch_key, record);
+    epoch_self = record;
+    return record;
 }
 
-void send_player_list(int sock) {
-    char response[BUFFER_SIZE];
-    int offset = sprintf(response, "{\"cmd\":\"PLAYER_LIST\",\"payload\":{\"players\":[");
-    
-    pthread_mutex_lock(&clients_mutex);
-    int first = 1;
-    int count = 0;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] != NULL && 
-            clients[i]->status != PLAYER_OFFLINE && 
-            clients[i]->status != PLAYER_IN_GAME &&
-            clients[i]->sock != sock) {
-            
-            if (!first) offset += sprintf(response + offset, ",");
-            int elo = get_player_elo(clients[i]->username);
-            offset += sprintf(response + offset, 
-                "{\"username\":\"%s\",\"status\":%d,\"elo\":%d}", 
-                clients[i]->username, clients[i]->status, elo);
-            first = 0;
-            count++;
-        }
+void epoch_enter() {
+    EpochRecord *self = epoch_self ? epoch_self : epoch_register();
+    if (self->nesting++ > 0) return;
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    while (1) {
+        __atomic_store_n(&self->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+        unsigned long now = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+        if (now == epoch) return; // no advance slipped in before the pin was visible
+        epoch = now;
     }
-    pthread_mutex_unlock(&clients_mutex);
-    
-    offset += sprintf(response + offset, "]}}\n");
-    printf("[PLAYER_LIST] Sending %d players to socket %d\n", count, sock);
-    send_message(sock, response);
 }
 
-void handle_challenge(Client *challenger, const char *target_username) {
-    Client *target = get_client_by_username(target_username);
-    
-    if (!target) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":404,\"message\":\"Player not found or offline\"}}\n");
-        send_message(challenger->sock, response);
-        return;
+void epoch_exit() {
+    if (--epoch_self->nesting > 0) return;
+    __atomic_store_n(&epoch_self->state, 0UL, __ATOMIC_RELEASE);
+}
+
+// Move the epoch on if every pinned thread has seen it (retire_mutex held)
+static void epoch_try_advance() {
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    for (EpochRecord *record = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); record; record = record->next) {
+        unsigned long state = __atomic_load_n(&record->state, __ATOMIC_SEQ_CST);
+        if ((state & 1) && (state >> 1) != epoch) return;
     }
+    __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+// Free whatever has been retired for two epochs; also called on every timer tick
+void epoch_reclaim() {
+    if (!__atomic_load_n(&retire_head, __ATOMIC_RELAXED)) return;
     
-    if (target->status == PLAYER_IN_GAME) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Player is in game\"}}\n");
-        send_message(challenger->sock, response);
-        return;
+    pthread_mutex_lock(&retire_mutex);
+    epoch_try_advance();
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    EpochNode *done = retire_head, *last = NULL, *node = retire_head;
+    while (node && node->epoch + 2 <= epoch) {
+        last = node;
+        node = node->next;
     }
+    if (last) {
+        last->next = NULL;
+    } else {
+        done = NULL;
+    }
+    __atomic_store_n(&retire_head, node, __ATOMIC_RELAXED);
+    if (!node) retire_tail = NULL;
+    pthread_mutex_unlock(&retire_mutex);
     
-    // Send challenge to target
-    char message[BUFFER_SIZE];
-    sprintf(message, "{\"cmd\":\"CHALLENGE\",\"payload\":{\"challenger\":\"%s\"}}\n", challenger->username);
-    send_message(target->sock, message);
-    
-    // Notify challenger
-    sprintf(message, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":200,\"message\":\"Challenge sent to %s\"}}\n", target_username);
-    send_message(challenger->sock, message);
+    while (done) {
+        EpochNode *next = done->next;
+        done->free_fn(done);
+        __atomic_add_fetch(&freed_objects, 1, __ATOMIC_RELAXED);
+        done = next;
+    }
 }
 
-void handle_challenge_reply(Client *client, const char *challenger_username, const char *status) {
-    Client *challenger = get_client_by_username(challenger_username);
+// Free node's object once no pinned thread can reach it. It must be unlinked
+// from everything lookups walk already.
+void epoch_retire(EpochNode *node, void (*free_fn)(EpochNode *node)) {
+    node->free_fn = free_fn;
+    node->next = NULL;
+    pthread_mutex_lock(&retire_mutex);
+    node->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    if (retire_tail) {
+        retire_tail->next = node;
+    } else {
+        __atomic_store_n(&retire_head, node, __ATOMIC_RELAXED);
+    }
+    retire_tail = node;
+    __atomic_add_fetch(&retired_objects, 1, __ATOMIC_RELAXED); // before anyone can count it freed
+    pthread_mutex_unlock(&retire_mutex);
+    epoch_reclaim();
+}
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+static void client_free(EpochNode *node) {
+    Client *client = container_of(node, Client, retire);
+    pthread_mutex_destroy(&client->out_mutex);
+    free(client);
+}
+
+// Another reference to a client; the caller must hold one already
+static void client_hold(Client *client) {
+    __atomic_add_fetch(&client->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void client_put(Client *client) {
+    if (__atomic_sub_fetch(&client->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        epoch_retire(&client->retire, client_free);
+    }
+}
+
+#define client_at(i) ((Client *)client_slots.slots[i])
+#define session_at(i) ((GameSession *)game_slots.slots[i])
+
+// ==================== CLIENT INDEXES ====================
+// sock_index and name_index make get_client() and get_client_by_username()
+// O(1) instead of a scan over every slot. Both have a fixed bucket count
+// (--max-clients rounded up to a power of two) and chain through
+// Client.sock_next / Client.name_next, so indexing never allocates.
+// add_client(), remove_client() and set_username() keep them current, all
+// under clients_mutex. name_index also holds clients that logged out or are
+// waiting out a reconnect: the status check stays in the lookup.
+//
+// get_client() walks sock_index without the lock: links are published with
+// release stores, and a removed client keeps its sock_next, so a walk that
+// is standing on it carries on. Clients are retired (SAFE RECLAMATION), so
+// the caller must be pinned for as long as it uses the result. A LOGIN
+// rewrites username in place, so name lookups still take clients_mutex.
+
+void client_index_init(ClientIndex *index, int capacity) {
+    unsigned int count = 16;
+    while (count < (unsigned int)capacity) count <<= 1;
+    index->buckets = (Client **)calloc(count, sizeof(Client *));
+    if (!index->buckets) {
+        perror("client index");
+        exit(EXIT_FAILURE);
+    }
+    index->mask = count - 1;
+}
+
+static unsigned int sock_hash(int sock) {
+    return (unsigned int)sock; // fds are small and dense already
+}
+
+static unsigned int name_hash(const char *name) {
+    unsigned int h = 2166136261u; // FNV-1a, like command_hash()
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h;
+}
+
+// The helpers below expect clients_mutex to be held
+static void sock_index_remove(Client *client) {
+    Client **link = &sock_index.buckets[sock_hash(client->sock) & sock_index.mask];
+    while (*link && *link != client) link = &(*link)->sock_next;
+    if (*link) __atomic_store_n(link, client->sock_next, __ATOMIC_RELEASE);
+}
+
+static void name_index_add(Client *client) {
+    Client **head = &name_index.buckets[name_hash(client->username) & name_index.mask];
+    client->name_next = *head;
+    *head = client;
+}
+
+static void name_index_remove(Client *client) {
+    Client **link = &name_index.buckets[name_hash(client->username) & name_index.mask];
+    while (*link && *link != client) link = &(*link)->name_next;
+    if (*link) *link = client->name_next;
+    client->name_next = NULL;
+}
+
+Client* find_client_by_username_locked(const char *username) {
+    Client *client = name_index.buckets[name_hash(username) & name_index.mask];
+    while (client && (get_status(client) == PLAYER_OFFLINE ||
+                      strcmp(client->username, username) != 0)) {
+        client = client->name_next;
+    }
+    return client;
+}
+
+// Returns -1 when the server is at --max-clients
+int add_client(Client *client) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    client->slot = slot_alloc(&client_slots, client);
+    if (client->slot >= 0) {
+        Client **head = &sock_index.buckets[sock_hash(client->sock) & sock_index.mask];
+        client->sock_next = *head;
+        __atomic_store_n(head, client, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return client->slot;
+}
+
+void remove_client(Client *client) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    if (client->slot >= 0) {
+        slot_free(&client_slots, client->slot);
+        client->slot = -1;
+        sock_index_remove(client);
+        if (client->username[0]) name_index_remove(client);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Login: the only place a connection's username changes
+void set_username(Client *client, const char *username) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    int renamed = strncmp(client->username, username, USERNAME_SIZE - 1) != 0;
+    if (client->username[0]) name_index_remove(client);
+    strncpy(client->username, username, USERNAME_SIZE - 1);
+    client->username[USERNAME_SIZE - 1] = '\0';
+    if (client->username[0]) name_index_add(client);
+    pthread_mutex_unlock(&clients_mutex);
+    // Another LOGIN on a connection already listed changes the player list without a status change
+    if (renamed && get_status(client) != PLAYER_OFFLINE) presence_changed();
+}
+
+// Lock-free; call pinned (epoch_enter()), the result is only safe until epoch_exit()
+Client* get_client(int sock) {
+    Client *client = __atomic_load_n(&sock_index.buckets[sock_hash(sock) & sock_index.mask], __ATOMIC_ACQUIRE);
+    while (client && client->sock != sock) client = __atomic_load_n(&client->sock_next, __ATOMIC_ACQUIRE);
+    return client;
+}
+
+Client* get_client_by_username(const char *username) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    Client *result = find_client_by_username_locked(username);
+    pthread_mutex_unlock(&clients_mutex);
+    return result;
+}
+
+// ==================== OUTBOUND QUEUES ====================
+// send_message() never touches the socket: it appends to the client's queue
+// and remembers the client in a per-thread flush list. flush_pending_output()
+// runs once the current handler/read is done (outside every global lock), so
+// all messages one handler produced for a client (MOVE_RESULT + TURN_CHANGE)
+// leave in a single gather write. Whatever the socket does not take stays
+// queued until the owning I/O thread sees it writable. A thread is pinned
+// (SAFE RECLAMATION) while its flush list is not empty.
+
+static __thread Client *flush_list[FLUSH_LIST_SIZE];
+static __thread int flush_count = 0;
+
+// ==================== SHARED FRAMES ====================
+
+OutFrame* frame_create(const char *message, size_t len) {
+    OutFrame *frame = (OutFrame *)malloc(offsetof(OutFrame, data) + len);
+    if (!frame) return NULL;
+    frame->refs = 1;
+    frame->len = len;
+    memcpy(frame->data, message, len);
+    return frame;
+}
+
+void frame_release(OutFrame *frame) {
+    if (__atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(frame);
+    }
+}
+
+static __thread OutChunk *spare_reply; // freed reply buffer kept for reply_begin()
+
+static void out_chunk_free(OutChunk *chunk) {
+    if (chunk->frame) frame_release(chunk->frame);
+    if (chunk->cap && chunk->cap <= REPLY_SPARE_MAX && !spare_reply) {
+        spare_reply = chunk;
+        return;
+    }
+    free(chunk);
+}
+
+// The helpers below expect client->out_mutex to be held
+static void out_drop(Client *client) {
+    if (client->out_inflight) return; // the io_uring completion drops it
+    while (client->out_head) {
+        OutChunk *chunk = client->out_head;
+        client->out_head = chunk->next;
+        out_chunk_free(chunk);
+    }
+    __atomic_sub_fetch(&out_queued_bytes, client->out_bytes, __ATOMIC_RELAXED);
+    client->out_tail = NULL;
+    client->out_offset = 0;
+    client->out_bytes = 0;
+}
+
+static int out_fill_iovec(Client *client, struct iovec *iov, int max_iov) {
+    int count = 0;
+    size_t offset = client->out_offset;
+    for (OutChunk *chunk = client->out_head; chunk && count < max_iov; chunk = chunk->next) {
+        iov[count].iov_base = (void *)(chunk->data + offset);
+        iov[count].iov_len = chunk->len - offset;
+        offset = 0;
+        count++;
+    }
+    return count;
+}
+
+static void out_consume(Client *client, size_t sent) {
+    client->out_bytes -= sent;
+    __atomic_sub_fetch(&out_queued_bytes, sent, __ATOMIC_RELAXED);
+    while (sent > 0 && client->out_head) {
+        OutChunk *chunk = client->out_head;
+        size_t left = chunk->len - client->out_offset;
+        if (sent < left) {
+            client->out_offset += sent;
+            return;
+        }
+        sent -= left;
+        client->out_head = chunk->next;
+        client->out_offset = 0;
+        out_chunk_free(chunk);
+    }
+    if (!client->out_head) client->out_tail = NULL;
+}
+
+static void schedule_flush(Client *client) {
+    for (int i = 0; i < flush_count; i++) {
+        if (flush_list[i] == client) return;
+    }
+    if (flush_count == FLUSH_LIST_SIZE) {
+        flush_pending_output();
+    }
+    if (flush_count == 0) epoch_enter();
+    flush_list[flush_count++] = client;
+}
+
+// Push out everything queued by this thread since the last flush
+void flush_pending_output() {
+    int count = flush_count;
+    flush_count = 0;
+    for (int i = 0; i < count; i++) {
+        io_backend->flush(flush_list[i]);
+    }
+    if (count > 0) epoch_exit();
+}
+
+static void forget_pending_flush(Client *client) {
+    for (int i = 0; i < flush_count; i++) {
+        if (flush_list[i] == client) {
+            flush_list[i] = flush_list[--flush_count];
+            if (flush_count == 0) epoch_exit();
+            return;
+        }
+    }
+}
+
+// Append a chunk to the queue, or drop it (and the slow client's output) past the high-water mark
+static void out_append(Client *client, OutChunk *chunk) {
+    chunk->next = NULL;
+    
+    pthread_mutex_lock(&client->out_mutex);
+    if (client->out_closed) {
+        pthread_mutex_unlock(&client->out_mutex);
+        out_chunk_free(chunk);
+        return;
+    }
+    if (client->out_bytes + chunk->len > OUTQ_HIGH_WATER) {
+        // Slow consumer: drop its output and let the owning thread run the normal disconnect
+        printf("[BACKPRESSURE] %s (sock %d) has %zu bytes unsent, disconnecting\n",
+               client->username[0] ? client->username : "unknown", client->sock, client->out_bytes);
+        client->out_closed = 1;
+        out_drop(client);
+        shutdown(client->sock, SHUT_RDWR);
+        pthread_mutex_unlock(&client->out_mutex);
+        out_chunk_free(chunk);
+        return;
+    }
+    if (client->out_tail) {
+        client->out_tail->next = chunk;
+    } else {
+        client->out_head = chunk;
+    }
+    client->out_tail = chunk;
+    client->out_bytes += chunk->len;
+    __atomic_add_fetch(&out_queued_bytes, chunk->len, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&client->out_mutex);
+    
+    __atomic_add_fetch(&out_messages, 1, __ATOMIC_RELAXED);
+    schedule_flush(client);
+}
+
+// ==================== COMPRESSION ====================
+// Clients that asked for it in HELLO get replies of COMPRESS_MIN_BYTES or
+// more (in practice the lists) as WIRE_OP_JSON_DEFLATE frames: raw deflate
+// primed with WIRE_DEFLATE_DICTIONARY (battleship_wire.h), so even a single
+// list compresses well. Each frame is compressed on its own. A stream per
+// connection would gain a little on repeats, but would cost a deflate state
+// per client and force the threads queueing to one client into one order.
+
+static __thread z_stream *deflater;     // this thread's compressor, made on first use
+static unsigned long compress_messages = 0;
+static unsigned long compress_bytes_in = 0;
+static unsigned long compress_bytes_out = 0;
+static unsigned long compress_cpu_us = 0; // thread CPU time spent in deflate, skipped frames included
+
+static unsigned long thread_cpu_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// WIRE_OP_JSON_DEFLATE frame for text, or NULL to send it as it is
+static OutChunk *compress_reply(const char *text, size_t len) {
+    if (!deflater) {
+        z_stream *z = (z_stream *)calloc(1, sizeof(z_stream));
+        if (!z) return NULL;
+        if (deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(z);
+            return NULL;
+        }
+        deflater = z;
+    }
+    
+    unsigned long start = thread_cpu_us();
+    deflateReset(deflater);
+    deflateSetDictionary(deflater, (const Bytef *)WIRE_DEFLATE_DICTIONARY, sizeof(WIRE_DEFLATE_DICTIONARY) - 1);
+    size_t bound = deflateBound(deflater, len);
+    OutChunk *chunk = (OutChunk *)malloc(offsetof(OutChunk, inline_data) + WIRE_MAX_HEADER + bound);
+    if (!chunk) return NULL;
+    
+    unsigned char *body = (unsigned char *)chunk->inline_data + WIRE_MAX_HEADER;
+    deflater->next_in = (Bytef *)text;
+    deflater->avail_in = len;
+    deflater->next_out = body;
+    deflater->avail_out = bound;
+    int status = deflate(deflater, Z_FINISH);
+    size_t body_len = bound - deflater->avail_out;
+    __atomic_add_fetch(&compress_cpu_us, thread_cpu_us() - start, __ATOMIC_RELAXED);
+    if (status != Z_STREAM_END || body_len >= len) {
+        free(chunk);
+        return NULL;
+    }
+    
+    unsigned char header[WIRE_MAX_HEADER];
+    int header_len = wire_put_header(header, body_len, WIRE_OP_JSON_DEFLATE);
+    chunk->data = (const char *)body - header_len;
+    memcpy((char *)chunk->data, header, header_len);
+    chunk->len = header_len + body_len;
+    chunk->frame = NULL;
+    chunk->cap = 0;
+    
+    __atomic_add_fetch(&compress_messages, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&compress_bytes_in, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&compress_bytes_out, body_len, __ATOMIC_RELAXED);
+    return chunk;
+}
+
+// ==================== RESPONSE BUILDER ====================
+// A response is written once, straight into the chunk that will sit in the
+// client's queue. reply_begin() returns a BsWriter (battleship_messages.h) on
+// this thread's reply buffer, which grows as needed; reply_send() frames the
+// text for the client and appends the chunk. WIRE_MAX_HEADER bytes are kept in
+// front of the text so a binary client's WIRE_OP_JSON header fits without a
+// copy. Once flushed, the buffer comes back as this thread's spare_reply.
+//
+// A request may carry an optional top-level "id" (JSON string or number).
+// While it is handled, every reply to the requesting client gets the same
+// "id" member, so clients can pipeline requests and match answers that come
+// back out of order (see SLOW QUERIES). Messages to other clients are not tagged.
+//
+// While a BATCH runs (cmd_batch), replies to the requesting client are not
+// queued one by one but appended to this thread's batch buffer, which goes
+// out as a single BATCH_RESULT once the last command is done.
+
+typedef struct {
+    OutChunk *chunk;   // NULL if none
+    BsWriter writer;
+    int failed;        // out of memory while growing
+} ReplyBuffer;
+
+static __thread ReplyBuffer reply;      // response being written
+static __thread ReplyBuffer batch;      // BATCH_RESULT being collected, chunk NULL outside a batch
+static __thread int batch_replies;
+static __thread Client *request_client; // client whose request this thread is handling
+static __thread char request_id[REQUEST_ID_SIZE]; // its "id" as raw JSON, "" if none
+
+// Start handling a request from client; t is its "id" token or -1.
+// Returns 0 if the id is not a string or number, or too long to echo.
+static int request_begin(Client *client, const JsonDoc *doc, int t) {
+    request_client = client;
+    request_id[0] = '\0';
+    if (t < 0) return 1;
+    
+    const JsonToken *token = &doc->tokens[t];
+    int start = token->start, end = token->end;
+    if (token->type == JSON_STRING) {
+        start--; // keep the quotes, the escapes stay as the client sent them
+        end++;
+    } else if (token->type != JSON_NUMBER) {
+        return 0;
+    }
+    if (end - start >= REQUEST_ID_SIZE) return 0;
+    memcpy(request_id, doc->text + start, end - start);
+    request_id[end - start] = '\0';
+    return 1;
+}
+
+static void request_end() {
+    request_client = NULL;
+    request_id[0] = '\0';
+}
+
+static void reply_grow(BsWriter *w, size_t need) {
+    ReplyBuffer *rb = (ReplyBuffer *)((char *)w - offsetof(ReplyBuffer, writer));
+    size_t cap = rb->chunk ? rb->chunk->cap : 0;
+    if (cap >= need + WIRE_MAX_HEADER + 1) return;
+    size_t new_cap = cap * 2 > need + WIRE_MAX_HEADER + 1 ? cap * 2 : need + WIRE_MAX_HEADER + 1;
+    OutChunk *chunk = (OutChunk *)realloc(rb->chunk, offsetof(OutChunk, inline_data) + new_cap);
+    if (!chunk) {
+        rb->failed = 1;
+        return;
+    }
+    chunk->cap = new_cap;
+    rb->chunk = chunk;
+    // one byte past the writer's size is left for the '\n' of JSON framing
+    w->buf = chunk->inline_data + WIRE_MAX_HEADER;
+    w->size = new_cap - WIRE_MAX_HEADER - 1;
+}
+
+static void reply_buffer_open(ReplyBuffer *rb) {
+    if (!rb->chunk && spare_reply) {
+        rb->chunk = spare_reply;
+        spare_reply = NULL;
+    } else if (!rb->chunk) {
+        rb->chunk = (OutChunk *)malloc(offsetof(OutChunk, inline_data) + REPLY_INITIAL);
+        if (rb->chunk) rb->chunk->cap = REPLY_INITIAL;
+    }
+    
+    BsWriter *w = &rb->writer;
+    bs_writer_init(w, NULL, 0);
+    w->grow = reply_grow;
+    rb->failed = 0;
+    if (rb->chunk) {
+        rb->chunk->frame = NULL; // out_chunk_free() may see it before it is queued
+        w->buf = rb->chunk->inline_data + WIRE_MAX_HEADER;
+        w->size = rb->chunk->cap - WIRE_MAX_HEADER - 1;
+    }
+}
+
+static int reply_buffer_ok(const ReplyBuffer *rb) {
+    return rb->chunk && !rb->failed && rb->writer.len < rb->writer.size;
+}
+
+// Frame the buffer's text for client and queue it; the buffer is empty afterwards
+static void reply_buffer_queue(ReplyBuffer *rb, Client *client) {
+    OutChunk *chunk = rb->chunk;
+    BsWriter *w = &rb->writer;
+    if (!reply_buffer_ok(rb)) {
+        printf("Send failed to socket %d: out of memory\n", client->sock);
+        if (chunk) free(chunk);
+        rb->chunk = NULL;
+        return;
+    }
+    rb->chunk = NULL;
+    if (client->protocol == PROTO_BINARY && w->len > WIRE_MAX_BODY) {
+        // Its length would not fit the WIRE_MAX_HEADER bytes reserved in front
+        printf("Send failed to socket %d: %zu byte reply is too large for a frame\n", client->sock, w->len);
+        out_chunk_free(chunk);
+        return;
+    }
+    
+    char *text = chunk->inline_data + WIRE_MAX_HEADER;
+    OutChunk *deflated = client->compress && w->len >= COMPRESS_MIN_BYTES ? compress_reply(text, w->len) : NULL;
+    if (deflated) {
+        out_chunk_free(chunk);
+        out_append(client, deflated);
+        return;
+    }
+    if (client->protocol == PROTO_BINARY) {
+        // No packed form: the JSON text travels in a WIRE_OP_JSON frame
+        unsigned char header[WIRE_MAX_HEADER];
+        int header_len = wire_put_header(header, w->len, WIRE_OP_JSON);
+        chunk->data = text - header_len;
+        memcpy((char *)chunk->data, header, header_len);
+        chunk->len = header_len + w->len;
+    } else {
+        text[w->len] = '\n';
+        chunk->data = text;
+        chunk->len = w->len + 1;
+    }
+    chunk->frame = NULL;
+    out_append(client, chunk);
+}
+
+// Add the current request's "id" to the message just written
+static void reply_tag(BsWriter *w) {
+    if (request_id[0] && w->len > 0 && w->buf[w->len - 1] == '}') {
+        w->len--; // reopen the top-level object
+        bs_put_str(w, ",\"id\":");
+        bs_put_str(w, request_id);
+        bs_put(w, "}", 1);
+    }
+}
+
+// Start a response (one JSON message, without the trailing newline)
+BsWriter* reply_begin() {
+    if (reply.chunk) printf("[REPLY] Unsent response discarded\n");
+    reply_buffer_open(&reply);
+    return &reply.writer;
+}
+
+// Queue the response started by reply_begin() for client
+void reply_send(Client *client) {
+    if (client != request_client) {
+        reply_buffer_queue(&reply, client);
+        return;
+    }
+    
+    reply_tag(&reply.writer);
+    if (!batch.chunk) {
+        reply_buffer_queue(&reply, client);
+        return;
+    }
+    
+    // Inside a BATCH: one more entry of BATCH_RESULT's "replies"
+    if (reply_buffer_ok(&reply)) {
+        if (batch_replies++ > 0) bs_put(&batch.writer, ",", 1);
+        bs_put(&batch.writer, reply.writer.buf, reply.writer.len);
+    } else {
+        batch.failed = 1;
+    }
+    reply_discard();
+}
+
+// Drop the response started by reply_begin() (its client went away)
+void reply_discard() {
+    if (reply.chunk) {
+        out_chunk_free(reply.chunk);
+        reply.chunk = NULL;
+    }
+}
+
+void queue_message(Client *client, const char *message, size_t len) {
+    if (len > 0 && message[len - 1] == '\n') len--;
+    bs_put(reply_begin(), message, len);
+    reply_send(client);
+}
+
+// Queue one binary frame; header and body share a chunk
+void queue_packed(Client *client, int opcode, const void *body, size_t len) {
+    if (len > WIRE_MAX_BODY) {
+        printf("Send failed to socket %d: %zu byte frame is too large\n", client->sock, len);
+        return;
+    }
+    OutChunk *chunk = (OutChunk *)malloc(offsetof(OutChunk, inline_data) + WIRE_MAX_HEADER + len);
+    if (!chunk) {
+        printf("Send failed to socket %d: out of memory\n", client->sock);
+        return;
+    }
+    int header = wire_put_header((unsigned char *)chunk->inline_data, len, opcode);
+    memcpy(chunk->inline_data + header, body, len);
+    chunk->data = chunk->inline_data;
+    chunk->len = header + len;
+    chunk->frame = NULL;
+    chunk->cap = 0;
+    out_append(client, chunk);
+}
+
+// Packed body of `count` (0-2) varint fields
+static void queue_packed_varints(Client *client, int opcode, int count, unsigned long a, unsigned long b) {
+    unsigned char body[2 * WIRE_MAX_FIELD_VARINT];
+    size_t len = 0;
+    if (count > 0) len += wire_put_varint(body + len, a);
+    if (count > 1) len += wire_put_varint(body + len, b);
+    queue_packed(client, opcode, body, len);
+}
+
+// Queue a shared frame without copying it; the queue takes its own reference
+void queue_frame(Client *client, OutFrame *frame) {
+    OutChunk *chunk = (OutChunk *)malloc(sizeof(OutChunk));
+    if (!chunk) {
+        printf("Send failed to socket %d: out of memory\n", client->sock);
+        return;
+    }
+    __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+    chunk->data = frame->data;
+    chunk->len = frame->len;
+    chunk->frame = frame;
+    chunk->cap = 0;
+    out_append(client, chunk);
+}
+
+// Write as much of the queue as the socket takes without blocking; returns 1 if bytes remain
+int flush_client_output(Client *client) {
+    pthread_mutex_lock(&client->out_mutex);
+    while (client->out_head && !client->out_inflight) {
+        struct iovec iov[OUTQ_MAX_IOV];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = out_fill_iovec(client, iov, OUTQ_MAX_IOV);
+        
+        // sendmsg() is writev() plus MSG_NOSIGNAL/MSG_DONTWAIT, so sockets can stay blocking for recv
+        ssize_t sent = sendmsg(client->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        __atomic_add_fetch(&out_writes, 1, __ATOMIC_RELAXED);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            printf("Send failed to socket %d: %s\n", client->sock, strerror(errno));
+            client->out_closed = 1;
+            out_drop(client);
+            break;
+        }
+        out_consume(client, (size_t)sent);
+    }
+    int pending = client->out_head != NULL;
+    pthread_mutex_unlock(&client->out_mutex);
+    return pending;
+}
+
+int client_has_output(Client *client) {
+    pthread_mutex_lock(&client->out_mutex);
+    int pending = client->out_head != NULL;
+    pthread_mutex_unlock(&client->out_mutex);
+    return pending;
+}
+
+void send_to_client(Client *client, const char *message) {
+    queue_message(client, message, strlen(message));
+}
+
+void send_message(int sock, const char *message) {
+    Client *client = get_client(sock);
+    if (!client) {
+        printf("Send failed to socket %d: no such client\n", sock);
+        return;
+    }
+    send_to_client(client, message);
+}
+
+// Serialized once per framing; every recipient's queue references the same frame
+void broadcast_message(const char *message, int sender_sock) {
+    size_t len = strlen(message);
+    OutFrame *frame = frame_create(message, len);
+    OutFrame *packed = NULL; // built on the first binary recipient
+    if (!frame) {
+        printf("Broadcast failed: out of memory\n");
+        return;
+    }
+    
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    for (int i = 0; i < client_slots.high; i++) {
+        Client *client = client_at(i);
+        if (client == NULL || client->sock == sender_sock || get_status(client) == PLAYER_OFFLINE) continue;
+        
+        if (client->protocol == PROTO_JSON) {
+            queue_frame(client, frame);
+            continue;
+        }
+        if (!packed) {
+            unsigned char header[WIRE_MAX_HEADER];
+            size_t body = len > 0 && message[len - 1] == '\n' ? len - 1 : len;
+            int header_len = wire_put_header(header, body, WIRE_OP_JSON);
+            packed = frame_create((const char *)header, header_len + body);
+            if (!packed) continue;
+            memcpy(packed->data + header_len, message, body);
+        }
+        queue_frame(client, packed);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    
+    frame_release(frame);
+    if (packed) frame_release(packed);
+}
+
+// ==================== SCHEMA MESSAGES ====================
+// Messages listed in battleship_messages.h are written by its generated
+// bs_write_<name>() straight into the recipient's queue.
+
+#define SEND_MESSAGE(client, name, ...) \
+    do { bs_write_##name(reply_begin(), __VA_ARGS__); reply_send(client); } while (0)
+
+// ==================== PACKED MESSAGES ====================
+// The hottest in-game messages have a compact form (battleship_wire.h);
+// these helpers send it or the JSON text, whichever the recipient negotiated.
+
+void send_move_result(Client *to, const char *coord, const char *result, const char *ship_sunk, int your_shot, int game_over) {
+    if (to->protocol == PROTO_BINARY) {
+        unsigned char body[4 + 32];
+        size_t sunk_len = strnlen(ship_sunk, 32);
+        body[0] = (unsigned char)(coord[0] - 'A');
+        body[1] = (unsigned char)atoi(coord + 1);
+        body[2] = (strcmp(result, "MISS") == 0 ? 0 : strcmp(result, "HIT") == 0 ? 1 : 2) |
+                  (your_shot ? WIRE_MOVE_YOUR_SHOT : 0) | (game_over ? WIRE_MOVE_GAME_OVER : 0);
+        body[3] = (unsigned char)sunk_len;
+        memcpy(body + 4, ship_sunk, sunk_len);
+        queue_packed(to, WIRE_OP_MOVE_RESULT, body, 4 + sunk_len);
+        return;
+    }
+    
+    SEND_MESSAGE(to, MOVE_RESULT, coord, result, ship_sunk, your_shot, game_over);
+}
+
+void send_turn_change(Client *to, int your_turn) {
+    if (to->protocol == PROTO_BINARY) {
+        unsigned char body = your_turn ? 1 : 0;
+        queue_packed(to, WIRE_OP_TURN_CHANGE, &body, 1);
+        return;
+    }
+    SEND_MESSAGE(to, TURN_CHANGE, your_turn);
+}
+
+// Authentication functions (simple file-based storage)
+// Games end on several workers at once while query workers and I/O threads
+// read users.dat, and update_player_stats() rewrites it in place. users_lock
+// keeps readers off a half-written file and writers from losing each other's
+// update. It is a leaf lock: taken last and never held across a send.
+static pthread_rwlock_t users_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+int register_user(const char *username, const char *password) {
+    pthread_rwlock_wrlock(&users_lock);
+    FILE *fp = fopen("users.dat", "a+");
+    if (!fp) {
+        pthread_rwlock_unlock(&users_lock);
+        return 0;
+    }
+    
+    // Check if username exists
+    char line[256];
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp)) {
+        char stored_user[USERNAME_SIZE];
+        sscanf(line, "%[^:]:", stored_user);
+        if (strcmp(stored_user, username) == 0) {
+            fclose(fp);
+            pthread_rwlock_unlock(&users_lock);
+            return 0; // Username already exists
+        }
+    }
+    
+    // Add new user with default ELO 800
+    fprintf(fp, "%s:%s:800:0:0\n", username, password);
+    fclose(fp);
+    pthread_rwlock_unlock(&users_lock);
+    leaderboard_changed();
+    return 1;
+}
+
+int authenticate_user(const char *username, const char *password) {
+    pthread_rwlock_rdlock(&users_lock);
+    FILE *fp = fopen("users.dat", "r");
+    if (!fp) {
+        pthread_rwlock_unlock(&users_lock);
+        return 0;
+    }
+    
+    int found = 0;
+    char line[256];
+    while (!found && fgets(line, sizeof(line), fp)) {
+        char stored_user[USERNAME_SIZE];
+        char stored_pass[PASSWORD_SIZE];
+        sscanf(line, "%[^:]:%[^:]:", stored_user, stored_pass);
+        found = strcmp(stored_user, username) == 0 && strcmp(stored_pass, password) == 0;
+    }
+    
+    fclose(fp);
+    pthread_rwlock_unlock(&users_lock);
+    return found;
+}
+
+// Get player ELO
+int get_player_elo(const char *username) {
+    pthread_rwlock_rdlock(&users_lock);
+    FILE *fp = fopen("users.dat", "r");
+    if (!fp) {
+        pthread_rwlock_unlock(&users_lock);
+        return 800; // Default ELO
+    }
+    
+    int player_elo = 800;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        char stored_user[USERNAME_SIZE];
+        char stored_pass[PASSWORD_SIZE];
+        int elo, games_played, games_won;
+        sscanf(line, "%[^:]:%[^:]:%d:%d:%d", stored_user, stored_pass, &elo, &games_played, &games_won);
+        if (strcmp(stored_user, username) == 0) {
+            player_elo = elo;
+            break;
+        }
+    }
+    
+    fclose(fp);
+    pthread_rwlock_unlock(&users_lock);
+    return player_elo;
+}
+
+// Update player ELO and stats
+void update_player_stats(const char *username, int elo_change, int is_winner) {
+    pthread_rwlock_wrlock(&users_lock);
+    FILE *fp = fopen("users.dat", "r");
+    if (!fp) {
+        pthread_rwlock_unlock(&users_lock);
+        return;
+    }
+    
+    char lines[MAX_ACCOUNTS][256];
+    int line_count = 0;
+    
+    // Read all lines
+    while (line_count < MAX_ACCOUNTS && fgets(lines[line_count], 256, fp)) {
+        line_count++;
+    }
+    fclose(fp);
+    
+    // Update the user's line
+    fp = fopen("users.dat", "w");
+    if (!fp) {
+        pthread_rwlock_unlock(&users_lock);
+        return;
+    }
+    
+    for (int i = 0; i < line_count; i++) {
+        char stored_user[USERNAME_SIZE];
+        char stored_pass[PASSWORD_SIZE];
+        int elo, games_played, games_won;
+        sscanf(lines[i], "%[^:]:%[^:]:%d:%d:%d", stored_user, stored_pass, &elo, &games_played, &games_won);
+        
+        if (strcmp(stored_user, username) == 0) {
+            elo += elo_change;
+            if (elo < 0) elo = 0; // Minimum ELO is 0
+            games_played++;
+            if (is_winner) games_won++;
+            fprintf(fp, "%s:%s:%d:%d:%d\n", stored_user, stored_pass, elo, games_played, games_won);
+        } else {
+            fprintf(fp, "%s", lines[i]);
+        }
+    }
+    
+    fclose(fp);
+    pthread_rwlock_unlock(&users_lock);
+    leaderboard_changed();
+}
+
+// Save match history to user's history file
+// Format: timestamp:opponent:result (WIN/LOSE/DRAW)
+void save_match_history(const char *username, const char *opponent, const char *result) {
+    // Create history directory if it doesn't exist
+    system("mkdir -p history");
+    
+    char filename[128];
+    sprintf(filename, "history/match_history_%s.dat", username);
+    
+    FILE *fp = fopen(filename, "a");
+    if (!fp) return;
+    
+    time_t now = time(NULL);
+    fprintf(fp, "%ld:%s:%s\n", now, opponent, result);
+    fclose(fp);
+    
+    printf("[MATCH_HISTORY] Saved for %s vs %s: %s\n", username, opponent, result);
+}
+
+// Write a user's MATCH_HISTORY reply (reply_begin() buffer, not sent yet)
+void write_match_history(const char *username) {
+    char filename[128];
+    sprintf(filename, "history/match_history_%s.dat", username);
+    
+    FILE *fp = fopen(filename, "r");
+    
+    BsWriter *w = reply_begin();
+    bs_put_str(w, "{\"cmd\":\"MATCH_HISTORY\",\"payload\":{\"matches\":[");
+    
+    if (fp) {
+        char line[256];
+        int first = 1;
+        int count = 0;
+        
+        // Read last 50 matches (or all if less)
+        char matches[50][256];
+        int match_count = 0;
+        while (fgets(line, sizeof(line), fp) && match_count < 50) {
+            strcpy(matches[match_count++], line);
+        }
+        fclose(fp);
+        
+        // Send in reverse order (newest first)
+        for (int i = match_count - 1; i >= 0; i--) {
+            long timestamp;
+            char opponent[USERNAME_SIZE];
+            char result[10];
+            
+            if (sscanf(matches[i], "%ld:%49[^:]:%9s", &timestamp, opponent, result) == 3) {
+                if (!first) bs_put(w, ",", 1);
+                bs_put_str(w, "{\"timestamp\":");
+                bs_put_long(w, timestamp);
+                bs_put_str(w, ",\"opponent\":\"");
+                bs_put_escaped(w, opponent);
+                bs_put_str(w, "\",\"result\":\"");
+                bs_put_escaped(w, result);
+                bs_put_str(w, "\"}");
+                first = 0;
+                count++;
+            }
+        }
+    }
+    
+    bs_put_str(w, "]}}");
+}
+
+typedef struct {
+    char username[USERNAME_SIZE];
+    PlayerStatus status;
+    int elo;
+} ListedPlayer;
+
+// Fill in the ELO of count players with one pass over users.dat (800 if not found)
+static void lookup_player_elos(ListedPlayer *players, int count) {
+    for (int i = 0; i < count; i++) players[i].elo = 800;
+    
+    pthread_rwlock_rdlock(&users_lock);
+    FILE *fp = fopen("users.dat", "r");
+    if (fp) {
+        char line[256];
+        while (fgets(line, sizeof(line), fp)) {
+            char stored_user[USERNAME_SIZE];
+            char stored_pass[PASSWORD_SIZE];
+            int elo, games_played, games_won;
+            sscanf(line, "%[^:]:%[^:]:%d:%d:%d", stored_user, stored_pass, &elo, &games_played, &games_won);
+            for (int i = 0; i < count; i++) {
+                if (strcmp(players[i].username, stored_user) == 0) players[i].elo = elo;
+            }
+        }
+        fclose(fp);
+    }
+    pthread_rwlock_unlock(&users_lock);
+}
+
+// Players stop being listed near PLAYER_LIST_MAX_BYTES, so the reply stays far
+// below OUTQ_HIGH_WATER and fits a client's receive buffer; "total" says how many players there are.
+// clients_mutex is only held to copy out who is listed; ELOs are read from
+// users.dat after it is released.
+void send_player_list(Client *client, unsigned long version) {
+    ListedPlayer listed[PLAYER_LIST_MAX_ENTRIES];
+    int listed_count = 0;
+    int total = 0;
+    
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    for (int i = 0; i < client_slots.high; i++) {
+        Client *player = client_at(i);
+        PlayerStatus status = player ? get_status(player) : PLAYER_OFFLINE;
+        if (player != NULL && 
+            status != PLAYER_OFFLINE && 
+            status != PLAYER_IN_GAME &&
+            player != client) {
+            total++;
+            if (listed_count == PLAYER_LIST_MAX_ENTRIES) continue;
+            strcpy(listed[listed_count].username, player->username);
+            listed[listed_count].status = status;
+            listed_count++;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    
+    lookup_player_elos(listed, listed_count);
+    
+    BsWriter *w = reply_begin();
+    bs_put_str(w, "{\"cmd\":\"PLAYER_LIST\",\"payload\":{\"players\":[");
+    int count = 0;
+    for (; count < listed_count; count++) {
+        // Room for the longest entry (every username byte escaped as \u00XX) and the tail
+        if (w->len > PLAYER_LIST_MAX_BYTES - 6 * USERNAME_SIZE - 96) break;
+        if (count > 0) bs_put(w, ",", 1);
+        bs_put_str(w, "{\"username\":\"");
+        bs_put_escaped(w, listed[count].username);
+        bs_put_str(w, "\",\"status\":");
+        bs_put_long(w, listed[count].status);
+        bs_put_str(w, ",\"elo\":");
+        bs_put_long(w, listed[count].elo);
+        bs_put(w, "}", 1);
+    }
+    
+    bs_put_str(w, "],\"total\":");
+    bs_put_long(w, total);
+    bs_put_str(w, ",\"version\":");
+    bs_put_long(w, version);
+    bs_put_str(w, "}}");
+    printf("[PLAYER_LIST] Sending %d of %d players to socket %d\n", count, total, client->sock);
+    reply_send(client);
+}
+
+void handle_challenge(Client *challenger, const char *target_username) {
+    Client *target = get_client_by_username(target_username);
+    
+    if (!target) {
+        send_to_client(challenger, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":404,\"message\":\"Player not found or offline\"}}\n");
+        return;
+    }
+    
+    if (get_status(target) == PLAYER_IN_GAME) {
+        send_to_client(challenger, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Player is in game\"}}\n");
+        return;
+    }
+    
+    // Send challenge to target
+    SEND_MESSAGE(target, CHALLENGE, challenger->username);
+    
+    // Notify challenger
+    char text[BS_TEXT_SIZE];
+    snprintf(text, sizeof(text), "Challenge sent to %s", target_username);
+    SEND_MESSAGE(challenger, SYSTEM_MSG, 200, text, "");
+}
+
+void handle_challenge_reply(Client *client, const char *challenger_username, const char *status) {
+    Client *challenger = get_client_by_username(challenger_username);
+    
+    if (!challenger) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":404,\"message\":\"Challenger not found\"}}\n");
+        return;
+    }
+    
+    if (strcmp(status, "ACCEPT") == 0) {
+        // Start game
+        start_game(challenger, client);
+    } else {
+        // Notify challenger of rejection
+        SEND_MESSAGE(challenger, CHALLENGE_REPLY, client->username, "REJECT");
+    }
+}
+
+// ==================== GAME ACTORS ====================
+// Every GameSession belongs to one game worker thread, picked round-robin when
+// the game starts. Whatever reads or writes the session, or its players'
+// board, ready and is_turn, runs on that thread as a GameTask taken from the
+// worker's mailbox, one at a time, so game state needs no lock. I/O threads
+// post MOVE, PLACE_SHIPS, SURRENDER, DRAW_* and in-game CHAT, and start games, and go back
+// to their sockets; like slow queries, the replies keep the request "id".
+// Disconnect, logout and reconnect wait for their task (session_run()): the
+// caller goes on to free the client, or to handle its next command, which
+// must see the game already left or resumed. That happens once per login or
+// connection, and the wait is bounded by the worker's queue: a game task
+// never waits for a socket or another thread, only for games_mutex and the
+// users.dat and history appends at the end of a game. A mailbox is FIFO, so
+// every task a client posted earlier has run by then.
+//
+// The mailbox is an intrusive MPSC queue (Vyukov): a push is one atomic
+// exchange, and a worker that ran out of tasks sleeps on a condition
+// variable that producers only signal when it is idle.
+//
+// Sessions and players point at each other, so no command searches
+// game_slots. games_mutex covers only membership: game_slots, Client.session,
+// and the disconnect flags resume_game() scans for. Commands read
+// Client.session without it (session_get()). A session is retired with its
+// last reference: game_slots holds one until the game is detached, and every
+// queued task holds one, plus one on its sender and request client.
+
+typedef struct GameTask GameTask;
+typedef void (*GameTaskFn)(GameSession *session, Client *client, GameTask *task);
+
+struct GameTask {
+    GameTask *next;             // mailbox link
+    GameTaskFn fn;
+    GameSession *session;       // referenced until the task has run
+    Client *client;             // sender: skipped unless still a player. NULL = no check
+    void *arg;
+    int result;                 // set by fn, returned by session_run() (0 if skipped)
+    sem_t *done;                // session_run() waits on it; NULL = freed after running
+    Client *request_client;     // request context of the posting thread
+    char request_id[REQUEST_ID_SIZE];
+    int len;
+    char text[1];               // command argument: coord, ships array, draw reply
+};
+
+typedef struct GameWorker {
+    GameTask *head;             // last pushed; producers swap it atomically
+    GameTask *tail;             // next to run; worker only
+    GameTask stub;
+    int idle;                   // about to sleep: producers must signal wake
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    int sessions;               // games owned
+    unsigned long tasks;        // tasks run
+    unsigned long wakeups;
+} GameWorker;
+
+GameWorker *game_workers = NULL;
+int game_worker_count = 0;      // --game-workers, 0 = one per core
+
+static void mailbox_push(GameWorker *worker, GameTask *task) {
+    __atomic_store_n(&task->next, (GameTask *)NULL, __ATOMIC_RELAXED);
+    GameTask *prev = __atomic_exchange_n(&worker->head, task, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&prev->next, task, __ATOMIC_RELEASE);
+}
+
+// Next task, or NULL if there is none (or a push is halfway through)
+static GameTask *mailbox_pop(GameWorker *worker) {
+    GameTask *tail = worker->tail;
+    GameTask *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &worker->stub) {
+        if (!next) return NULL;
+        worker->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        worker->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&worker->head, __ATOMIC_SEQ_CST)) return NULL;
+    mailbox_push(worker, &worker->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        worker->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static int mailbox_empty(GameWorker *worker) {
+    return worker->tail == &worker->stub &&
+           __atomic_load_n(&worker->head, __ATOMIC_SEQ_CST) == &worker->stub;
+}
+
+static void game_worker_post(GameWorker *worker, GameTask *task) {
+    mailbox_push(worker, task);
+    if (__atomic_load_n(&worker->idle, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&worker->mutex);
+        pthread_cond_signal(&worker->wake);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
+static Client *session_opponent(GameSession *session, Client *client) {
+    return session->player1 == client ? session->player2 : session->player1;
+}
+
+// Reference a session found under games_mutex, so it outlives the unlock
+static void session_hold(GameSession *session) {
+    __atomic_add_fetch(&session->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void session_free(EpochNode *node) {
+    free(container_of(node, GameSession, retire));
+}
+
+static void session_put(GameSession *session) {
+    if (__atomic_sub_fetch(&session->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        epoch_retire(&session->retire, session_free);
+    }
+}
+
+// The game client is playing, referenced; NULL if none. Lock-free: a session
+// whose last reference is already gone only waits for reclamation.
+static GameSession *session_get(Client *client) {
+    epoch_enter();
+    GameSession *session = __atomic_load_n(&client->session, __ATOMIC_ACQUIRE);
+    if (session) {
+        int refs = __atomic_load_n(&session->refs, __ATOMIC_RELAXED);
+        do {
+            if (refs == 0) {
+                session = NULL;
+                break;
+            }
+        } while (!__atomic_compare_exchange_n(&session->refs, &refs, refs + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    }
+    epoch_exit();
+    return session;
+}
+
+// Mark the session over. The worker detaches it once the running task is done
+// with the players, so neither can be released while that task still uses it.
+void finish_session(GameSession *session) {
+    session->status = GAME_FINISHED;
+}
+
+// Unbind the players of a finished session and drop the game_slots reference
+static void session_detach(GameSession *session) {
+    lock_counted(&games_mutex, &games_lock_stats);
+    if (session->player1 && session->player1->session == session) {
+        __atomic_store_n(&session->player1->session, (GameSession *)NULL, __ATOMIC_RELEASE);
+    }
+    if (session->player2 && session->player2->session == session) {
+        __atomic_store_n(&session->player2->session, (GameSession *)NULL, __ATOMIC_RELEASE);
+    }
+    slot_free(&game_slots, session->slot);
+    session->slot = -1;
+    pthread_mutex_unlock(&games_mutex);
+    timer_cancel(&session->grace_timer);
+    __atomic_sub_fetch(&session->owner->sessions, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&session->refs, 1, __ATOMIC_RELEASE); // the running task still holds one
+}
+
+static void game_task_run(GameWorker *worker, GameTask *task) {
+    GameSession *session = task->session;
+    Client *client = task->client;
+    epoch_enter();
+    // A sender that left the game (or a finished game's players) may be released already
+    if (session->status != GAME_FINISHED &&
+        (!client || session->player1 == client || session->player2 == client)) {
+        request_client = task->request_client;
+        strcpy(request_id, task->request_id);
+        task->fn(session, client, task);
+        request_end();
+    }
+    flush_pending_output(); // before the players can be released
+    if (session->status == GAME_FINISHED && session->slot >= 0) {
+        session_detach(session);
+    }
+    __atomic_add_fetch(&worker->tasks, 1, __ATOMIC_RELAXED);
+    session_put(session);
+    if (client) client_put(client);
+    if (task->request_client) client_put(task->request_client);
+    epoch_exit();
+    if (task->done) {
+        sem_post(task->done); // the poster owns the task
+    } else {
+        free(task);
+    }
+}
+
+void *game_worker_thread(void *arg) {
+    GameWorker *worker = (GameWorker *)arg;
+    while (1) {
+        GameTask *task = mailbox_pop(worker);
+        if (task) {
+            game_task_run(worker, task);
+            continue;
+        }
+        
+        pthread_mutex_lock(&worker->mutex);
+        __atomic_store_n(&worker->idle, 1, __ATOMIC_SEQ_CST);
+        if (mailbox_empty(worker)) {
+            pthread_cond_wait(&worker->wake, &worker->mutex);
+            __atomic_add_fetch(&worker->wakeups, 1, __ATOMIC_RELAXED); // read by print_server_stats()
+        }
+        __atomic_store_n(&worker->idle, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+    return NULL;
+}
+
+void game_workers_start() {
+    if (game_worker_count <= 0) game_worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (game_worker_count < 1) game_worker_count = 1;
+    if (game_worker_count > MAX_GAME_WORKERS) game_worker_count = MAX_GAME_WORKERS;
+    
+    game_workers = (GameWorker *)calloc(game_worker_count, sizeof(GameWorker));
+    if (!game_workers) {
+        perror("calloc game workers failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < game_worker_count; i++) {
+        GameWorker *worker = &game_workers[i];
+        worker->head = &worker->stub;
+        worker->tail = &worker->stub;
+        pthread_mutex_init(&worker->mutex, NULL);
+        pthread_cond_init(&worker->wake, NULL);
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, game_worker_thread, worker) != 0) {
+            perror("pthread_create game worker failed");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(tid);
+    }
+}
+
+// Fill a task for session (the caller's reference passes to it)
+static void game_task_init(GameTask *task, GameSession *session, Client *client, GameTaskFn fn, void *arg) {
+    task->fn = fn;
+    task->session = session;
+    task->client = client;
+    task->arg = arg;
+    task->result = 0;
+    task->done = NULL;
+    task->request_client = request_client;
+    strcpy(task->request_id, request_id);
+    task->len = 0;
+    task->text[0] = '\0';
+}
+
+// Queue a filled task on its session's worker. Its clients stay allocated
+// until it has run, even if their connections are released meanwhile.
+static void game_task_post(GameTask *task) {
+    if (task->client) client_hold(task->client);
+    if (task->request_client) client_hold(task->request_client);
+    game_worker_post(task->session->owner, task);
+}
+
+// Queue fn for client's game with text as its argument; 0 if client is in none
+static int session_post(Client *client, GameTaskFn fn, const char *text, int len) {
+    GameSession *session = session_get(client);
+    if (!session) return 0;
+    
+    GameTask *task = (GameTask *)malloc(sizeof(GameTask) + len);
+    if (!task) {
+        session_put(session);
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":503,\"message\":\"Server busy\"}}\n");
+        return 1;
+    }
+    game_task_init(task, session, client, fn, NULL);
+    memcpy(task->text, text, len);
+    task->text[len] = '\0';
+    task->len = len;
+    game_task_post(task);
+    return 1;
+}
+
+// Wait for a task posted with a done semaphore; returns its result
+static int session_wait(GameTask *task, sem_t *done) {
+    while (sem_wait(done) != 0 && errno == EINTR) {}
+    sem_destroy(done);
+    return task->result;
+}
+
+// Run fn on a referenced session's worker and wait for it. Never call this from a game worker.
+static int session_run(GameSession *session, Client *client, GameTaskFn fn, void *arg) {
+    GameTask task;
+    sem_t done;
+    sem_init(&done, 0, 0);
+    game_task_init(&task, session, client, fn, arg);
+    task.done = &done;
+    game_task_post(&task);
+    return session_wait(&task, &done);
+}
+
+// session_run() on client's game; 0 if client is in none
+static int session_call(Client *client, GameTaskFn fn, void *arg) {
+    GameSession *session = session_get(client);
+    return session ? session_run(session, client, fn, arg) : 0;
+}
+
+static void task_start_game(GameSession *session, Client *client, GameTask *task) {
+    Client *player1 = session->player1;
+    Client *player2 = session->player2;
+    
+    // Update players (start_game() already made them PLAYER_IN_GAME)
+    player1->ready = 0;
+    player1->is_turn = 1;
+    init_board(&player1->board);
+    
+    player2->ready = 0;
+    player2->is_turn = 0;
+    init_board(&player2->board);
+    
+    // Notify both players
+    SEND_MESSAGE(player1, GAME_START, player2->username, player1->is_turn);
+    
+    SEND_MESSAGE(player2, GAME_START, player1->username, player2->is_turn);
+    
+    printf("Game started: %s vs %s\n", player1->username, player2->username);
+}
+
+// Caller holds clients_mutex. Returns 0 (players told why) if the game could not start.
+static int start_game_locked(Client *player1, Client *player2) {
+    // Create game session
+    GameSession *session = (GameSession *)malloc(sizeof(GameSession));
+    if (!session) {
+        const char *full = "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":500,\"message\":\"Server full\"}}\n";
+        send_to_client(player1, full);
+        send_to_client(player2, full);
+        return 0;
+    }
+    
+    // Initialize session before it becomes visible in game_slots
+    session->player1 = player1;
+    session->player2 = player2;
+    strncpy(session->player1_username, player1->username, USERNAME_SIZE - 1);
+    strncpy(session->player2_username, player2->username, USERNAME_SIZE - 1);
+    session->status = GAME_PLACING_SHIPS;
+    session->current_turn = player1;
+    session->start_time = time(NULL);
+    session->player1_disconnected = 0;
+    session->player2_disconnected = 0;
+    session->player1_disconnect_time = 0;
+    session->player2_disconnect_time = 0;
+    session->id = __atomic_add_fetch(&next_object_id, 1, __ATOMIC_RELAXED);
+    timer_init(&session->grace_timer);
+    sprintf(session->log_id, "game_%ld", session->start_time);
+    session->owner = &game_workers[session->id % game_worker_count];
+    session->refs = 2; // game_slots + the start task
+    
+    GameTask *task = (GameTask *)malloc(sizeof(GameTask));
+    if (!task) {
+        const char *full = "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":500,\"message\":\"Server full\"}}\n";
+        send_to_client(player1, full);
+        send_to_client(player2, full);
+        free(session);
+        return 0;
+    }
+    game_task_init(task, session, NULL, task_start_game, NULL);
+    
+    // Register it and bind both players, unless one is already playing or has
+    // left: under clients_mutex, a player that goes PLAYER_OFFLINE either does
+    // so before this check or finds the session bound afterwards. The start
+    // task is queued first, so any command for this game runs after it.
+    lock_counted(&games_mutex, &games_lock_stats);
+    int gone = get_status(player1) == PLAYER_OFFLINE || get_status(player2) == PLAYER_OFFLINE;
+    int busy = player1->session || player2->session;
+    session->slot = gone || busy ? -1 : slot_alloc(&game_slots, session);
+    if (session->slot >= 0) {
+        __atomic_add_fetch(&session->owner->sessions, 1, __ATOMIC_RELAXED);
+        game_task_post(task);
+        __atomic_store_n(&player1->session, session, __ATOMIC_RELEASE);
+        __atomic_store_n(&player2->session, session, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&games_mutex);
+    
+    if (session->slot < 0) {
+        const char *reason = gone
+            ? "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":404,\"message\":\"Player not found or offline\"}}\n"
+            : busy
+            ? "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Player is in game\"}}\n"
+            : "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":500,\"message\":\"Server full\"}}\n";
+        send_to_client(player1, reason);
+        send_to_client(player2, reason);
+        free(task);
+        free(session);
+        return 0;
+    }
+    
+    // Out of the lobby: a challenge accepted while matching or confirming a
+    // MATCH_FOUND ends that too
+    Client *players[2] = { player1, player2 };
+    for (int i = 0; i < 2; i++) {
+        set_status(players[i], PLAYER_IN_GAME);
+        players[i]->in_game_with = 0;
+        players[i]->is_matching = 0;
+        players[i]->match_ready = 0;
+        timer_cancel(&players[i]->match_timer);
+    }
+    return 1;
+}
+
+void start_game(Client *player1, Client *player2) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    start_game_locked(player1, player2);
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+static void place_ships(GameSession *session, Client *client, const JsonDoc *doc, int ships) {
+    // ships: [{"name":"Carrier","size":5,"row":0,"col":0,"horizontal":true}, ...]
+    
+    init_board(&client->board);
+    
+    int count = (ships >= 0 && doc->tokens[ships].type == JSON_ARRAY) ? doc->tokens[ships].count : 0;
+    int element = ships + 1;
+    for (int n = 0; n < count; n++, element = doc->tokens[element].next) {
+        char name[30];
+        int size, row, col;
+        
+        if (json_string(doc, json_find(doc, element, "name"), name, sizeof(name)) &&
+            json_int(doc, json_find(doc, element, "size"), &size) &&
+            json_int(doc, json_find(doc, element, "row"), &row) &&
+            json_int(doc, json_find(doc, element, "col"), &col)) {
+            
+            int horizontal = json_bool(doc, json_find(doc, element, "horizontal"));
+            
+            if (client->board.ship_count < MAX_SHIPS && 
+                size > 0 && size <= GRID_SIZE &&
+                row >= 0 && row < GRID_SIZE && 
+                col >= 0 && col < GRID_SIZE) {
+                
+                Ship *ship = &client->board.ships[client->board.ship_count];
+                strncpy(ship->name, name, sizeof(ship->name) - 1);
+                ship->name[sizeof(ship->name) - 1] = '\0'; // a 29-char name filled it without a terminator
+                ship->size = size;
+                ship->start_row = row;
+                ship->start_col = col;
+                ship->is_horizontal = horizontal;
+                ship->hits = 0;
+                
+                // Place ship on grid
+                for (int i = 0; i < size; i++) {
+                    int r = row + (horizontal ? 0 : i);
+                    int c = col + (horizontal ? i : 0);
+                    if (r < GRID_SIZE && c < GRID_SIZE) {
+                        client->board.grid[r][c] = 1;
+                        client->board.total_ship_cells++;
+                    }
+                }
+                
+                client->board.ship_count++;
+            }
+        }
+    }
+    
+    
+    client->ready = 1;
+    
+    // Check if opponent is ready
+    Client *opponent = session_opponent(session, client);
+    if (opponent && opponent->ready) {
+        // Both ready, start game
+        session->status = GAME_PLAYING;
+        session->current_turn = session->player1;
+        
+        // Set turn flags correctly
+        Client *p1 = session->player1;
+        Client *p2 = session->player2;
+        p1->is_turn = 1;
+        p2->is_turn = 0;
+        
+        // Notify both players
+        SEND_MESSAGE(p1, GAME_READY, "Game starting!", 1);
+        
+        SEND_MESSAGE(p2, GAME_READY, "Game starting!", 0);
+    } else {
+        send_to_client(client, "{\"cmd\":\"PLACE_SHIP_ACK\",\"payload\":{\"message\":\"Waiting for opponent\"}}\n");
+    }
+}
+
+// The ships array travels as text and is tokenized again on the game's worker
+static void task_place_ships(GameSession *session, Client *client, GameTask *task) {
+    JsonDoc doc;
+    int ships = task->len > 0 && json_tokenize(&doc, task->text, task->len) == 0 ? 0 : -1;
+    place_ships(session, client, &doc, ships);
+}
+
+void handle_place_ships(Client *client, const JsonDoc *doc, int ships) {
+    printf("[DEBUG] handle_place_ships called for user: %s\n", client->username);
+    
+    const JsonToken *token = &doc->tokens[ships];
+    int is_array = token->type == JSON_ARRAY;
+    if (!session_post(client, task_place_ships, is_array ? doc->text + token->start : "",
+                      is_array ? token->end - token->start : 0)) {
+        send_to_client(client, "{\"cmd\":\"ERROR\",\"payload\":{\"message\":\"Not in a game\"}}\n");
+    }
+}
+
+// handle_move() body; session is NULL when client is not in a game
+static void play_move(GameSession *session, Client *client, const char *coord) {
+    // Check if client has placed ships
+    if (!client->ready || client->board.total_ship_cells == 0) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"You haven't placed your ships yet\"}}\n");
+        return;
+    }
+    
+    Client *opponent = session ? session_opponent(session, client) : NULL;
+    if (!opponent) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":404,\"message\":\"Opponent not found\"}}\n");
+        return;
+    }
+    
+    // Check if opponent has placed ships
+    if (!opponent->ready || opponent->board.total_ship_cells == 0) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Opponent hasn't placed ships yet\"}}\n");
+        return;
+    }
+    
+    // Check if it's the player's turn
+    if (!client->is_turn) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Not your turn\"}}\n");
+        return;
+    }
+    
+    // Parse coordinate (e.g., "A5" -> row=0, col=4)
+    int row = coord[0] - 'A';
+    int col = atoi(coord + 1);
+    
+    if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Invalid coordinate\"}}\n");
+        return;
+    }
+    
+    // Check hit or miss
+    int cell = opponent->board.grid[row][col];
+    char result[20];
+    char ship_sunk[30] = "";
+    
+    if (cell == 1) {
+        strcpy(result, "HIT");
+        opponent->board.grid[row][col] = 2; // mark as hit
+        opponent->board.hits_received++;
+        
+        // Find which ship was hit and increment its hit counter
+        for (int i = 0; i < opponent->board.ship_count; i++) {
+            Ship *ship = &opponent->board.ships[i];
+            // Check if this coordinate belongs to this ship
+            for (int j = 0; j < ship->size; j++) {
+                int r = ship->start_row + (ship->is_horizontal ? 0 : j);
+                int c = ship->start_col + (ship->is_horizontal ? j : 0);
+                if (r == row && c == col) {
+                    // This is the ship that was hit
+                    ship->hits++;
+                    // Only report sunk if this hit completes the ship (prevents duplicate sunk messages)
+                    if (ship->hits == ship->size) {
+                        strcpy(ship_sunk, ship->name);
+                    }
+                    break;
+                }
+            }
+            if (ship_sunk[0] != '\0') break; // Found the ship, no need to check others
+        }
+    } else if (cell == 0) {
+        strcpy(result, "MISS");
+        opponent->board.grid[row][col] = 3; // mark as miss
+    } else {
+        strcpy(result, "ALREADY_HIT");
+    }
+    
+    // Check game end FIRST - opponent must have ships and all ships sunk
+    if (opponent->board.total_ship_cells > 0 && 
+        opponent->board.hits_received >= opponent->board.total_ship_cells) {
+        // Game is over - include final ship sunk info in GAME_END message
+        // Send final MOVE_RESULT with game_over flag to suppress popup
+        send_move_result(client, coord, result, ship_sunk, 1, 1);
+        send_move_result(opponent, coord, result, ship_sunk, 0, 1);
+        
+        // Now end the game - the worker detaches the session after this task
+        end_game(session, client, "ALL_SHIPS_SUNK");
+        return;
+    }
+    
+    // Game continues - send normal MOVE_RESULT
+    send_move_result(client, coord, result, ship_sunk, 1, 0);
+    send_move_result(opponent, coord, result, ship_sunk, 0, 0);
+    
+    // Switch turns
+    client->is_turn = 0;
+    opponent->is_turn = 1;
+    session->current_turn = opponent;
+    
+    send_turn_change(client, 0);
+    send_turn_change(opponent, 1);
+}
+
+static void task_move(GameSession *session, Client *client, GameTask *task) {
+    play_move(session, client, task->text);
+}
+
+void handle_move(Client *client, const char *coord) {
+    if (!session_post(client, task_move, coord, (int)strlen(coord))) {
+        play_move(NULL, client, coord);
+    }
+}
+
+// Runs on the session's worker
+void end_game(GameSession *session, Client *winner, const char *reason) {
+    finish_session(session);
+    Client *loser = session_opponent(session, winner);
+    
+    // Update ELO ratings and save match history
+    if (winner && loser) {
+        update_player_stats(winner->username, 10, 1);  // +10 ELO, win
+        update_player_stats(loser->username, -10, 0);  // -10 ELO, lose
+        
+        // Save match history for both players
+        save_match_history(winner->username, loser->username, "WIN");
+        save_match_history(loser->username, winner->username, "LOSE");
+        
+        printf("[ELO] %s +10, %s -10\n", winner->username, loser->username);
+    }
+    
+    if (winner) {
+        int new_elo = get_player_elo(winner->username);
+        SEND_MESSAGE(winner, GAME_END, "WIN", reason, session->log_id, "", "", new_elo);
+        
+        // Reset winner state completely
+        set_status(winner, PLAYER_ONLINE);
+        winner->ready = 0;
+        winner->is_turn = 0;
+        init_board(&winner->board);
+        
+        printf("[END_GAME] %s wins, status set to ONLINE, ELO: %d\n", winner->username, new_elo);
+    }
+    
+    if (loser) {
+        int new_elo = get_player_elo(loser->username);
+        SEND_MESSAGE(loser, GAME_END, "LOSE", reason, session->log_id, "", "", new_elo);
+        
+        // Reset loser state completely
+        set_status(loser, PLAYER_ONLINE);
+        loser->ready = 0;
+        loser->is_turn = 0;
+        init_board(&loser->board);
+        
+        printf("[END_GAME] %s loses, status set to ONLINE, ELO: %d\n", loser->username, new_elo);
+    }
+    
+    printf("[END_GAME] Game session removed\n");
+    
+    printf("Game ended: %s\n", reason);
+}
+
+// Helper function to handle game cleanup (used by both disconnect and logout)
+// Opponent left for good: record the win and put the opponent back in the lobby
+void award_disconnect_win(Client *opponent, const char *loser_username) {
+    // Save match history
+    save_match_history(opponent->username, loser_username, "WIN");
+    save_match_history(loser_username, opponent->username, "LOSE");
+    
+    // Update ELO - opponent wins
+    update_player_stats(opponent->username, 10, 1);  // Winner +10
+    update_player_stats(loser_username, -10, 0);     // Loser -10
+    
+    int new_elo = get_player_elo(opponent->username);
+    
+    // Send WIN notification to opponent
+    SEND_MESSAGE(opponent, GAME_END, "WIN", "OPPONENT_DISCONNECTED", "", loser_username, 
+                   "Đối thủ đã ngắt kết nối. Bạn thắng!", new_elo);
+    
+    // Reset opponent state to online
+    set_status(opponent, PLAYER_ONLINE);
+    opponent->ready = 0;
+    opponent->is_turn = 0;
+    init_board(&opponent->board);
+}
+
+// client left for good during a game: opponent wins
+static void award_exit_win(GameSession *session, Client *client, Client *opponent) {
+    // Determine phase for better messaging
+    const char *phase = (session->status == GAME_PLACING_SHIPS) ? "đặt thuyền" : "chơi game";
+    
+    printf("[GAME_CLEANUP] %s left during %s - %s wins\n", 
+           client->username, phase, opponent->username);
+    
+    award_disconnect_win(opponent, client->username);
+}
+
+// arg: notify_opponent. The result is decided here, from the session, so it
+// is recorded once however the game and the exit race.
+static void task_leave_game(GameSession *session, Client *client, GameTask *task) {
+    Client *opponent = session_opponent(session, client);
+    if (!opponent) {
+        // Both players gone: drop the session without a result
+        printf("[GAME_CLEANUP] %s left while the opponent was reconnecting, session abandoned\n", client->username);
+    } else if (*(int *)task->arg) {
+        award_exit_win(session, client, opponent);
+    }
+    finish_session(session);
+    printf("[GAME_CLEANUP] Game session removed\n");
+    task->result = 1;
+}
+
+// is_matching, match_ready and in_game_with (the other half of a MATCH_FOUND,
+// 0 outside one) belong to the lobby and are only used under clients_mutex.
+// Once a game starts, start_game_locked() clears them; from then on the
+// opponent is whoever the session says.
+
+// client's MATCH_FOUND partner, or NULL. Caller holds clients_mutex, which
+// also keeps the partner registered.
+static Client *match_partner(Client *client) {
+    if (client->in_game_with <= 0) return NULL;
+    Client *partner = get_client(client->in_game_with);
+    return partner && partner->in_game_with == client->sock ? partner : NULL;
+}
+
+// Back to the lobby from a MATCH_FOUND that will not be played, after
+// sending notice (if any). Caller holds clients_mutex.
+static void match_cancel(Client *client, const char *notice) {
+    if (notice) send_to_client(client, notice);
+    client->in_game_with = 0;
+    client->match_ready = 0;
+    client->is_matching = 0;
+    set_status(client, PLAYER_ONLINE);
+    timer_cancel(&client->match_timer);
+}
+
+// LOGOUT or disconnect: from here on no game can start with client (see
+// start_game()). A MATCH_FOUND still being confirmed is declined for the
+// other player; no game was played, so it has no result.
+static void leave_lobby(Client *client) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    store_status(client, PLAYER_OFFLINE);
+    Client *partner = match_partner(client);
+    if (partner) {
+        printf("[MATCHING] %s left before the match started, %s is back in the lobby\n", client->username, partner->username);
+        match_cancel(partner, "{\"cmd\":\"MATCH_DECLINED\",\"payload\":{\"message\":\"Đối thủ đã rời đi\"}}\n");
+    }
+    match_cancel(client, NULL); // stays PLAYER_OFFLINE
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// After leave_lobby(): end client's game, if any, on its worker
+void cleanup_game_on_exit(Client *client, int notify_opponent) {
+    session_call(client, task_leave_game, &notify_opponent);
+}
+
+static void task_begin_grace(GameSession *session, Client *client, GameTask *task) {
+    Client *opponent = session_opponent(session, client);
+    if (!opponent) return;
+    
+    if (session->current_turn == client) session->current_turn = NULL;
+    session->saved_board = client->board;
+    session->saved_ready = client->ready;
+    session->saved_turn = client->is_turn;
+    lock_counted(&games_mutex, &games_lock_stats);
+    if (session->player1 == client) {
+        session->player1 = NULL;
+        session->player1_disconnected = 1;
+        session->player1_disconnect_time = time(NULL);
+    } else {
+        session->player2 = NULL;
+        session->player2_disconnected = 1;
+        session->player2_disconnect_time = time(NULL);
+    }
+    __atomic_store_n(&client->session, (GameSession *)NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&games_mutex);
+    timer_schedule(&session->grace_timer, reconnect_grace * 1000, reconnect_grace_expired, session->slot, session->id);
+    
+    SEND_MESSAGE(opponent, OPPONENT_DISCONNECTED, client->username, reconnect_grace);
+    task->result = 1;
+}
+
+// Disconnected mid-game: keep the session for reconnect_grace seconds. Returns 0 if not applicable.
+int begin_reconnect_grace(Client *client) {
+    if (!session_call(client, task_begin_grace, NULL)) return 0;
+    
+    printf("[RECONNECT] %s disconnected mid-game, holding the session for %ds\n", client->username, reconnect_grace);
+    return 1;
+}
+
+static void task_grace_expired(GameSession *session, Client *client, GameTask *task) {
+    if (!(session->player1_disconnected || session->player2_disconnected)) return; // resumed
+    
+    int first_left = session->player1_disconnected;
+    char loser[USERNAME_SIZE], winner[USERNAME_SIZE];
+    strcpy(loser, first_left ? session->player1_username : session->player2_username);
+    strcpy(winner, first_left ? session->player2_username : session->player1_username);
+    Client *remaining = first_left ? session->player2 : session->player1;
+    finish_session(session);
+    
+    printf("[RECONNECT] %s did not come back in %ds - %s wins\n", loser, reconnect_grace, winner);
+    
+    if (remaining) {
+        award_disconnect_win(remaining, loser);
+    }
+}
+
+// Grace window over: the disconnected player loses (decided on the game's worker)
+void reconnect_grace_expired(int slot, unsigned long id) {
+    lock_counted(&games_mutex, &games_lock_stats);
+    GameSession *session = slot < game_slots.high ? session_at(slot) : NULL;
+    if (!session || session->id != id) {
+        pthread_mutex_unlock(&games_mutex); // already gone
+        return;
+    }
+    session_hold(session);
+    pthread_mutex_unlock(&games_mutex);
+    
+    GameTask *task = (GameTask *)malloc(sizeof(GameTask));
+    if (!task) {
+        timer_schedule(&session->grace_timer, TIMER_TICK_MS, reconnect_grace_expired, slot, id); // retry
+        session_put(session);
+        return;
+    }
+    game_task_init(task, session, NULL, task_grace_expired, NULL);
+    game_task_post(task);
+}
+
+// arg: the client logging back in
+static void task_resume_game(GameSession *session, Client *unused, GameTask *task) {
+    Client *client = (Client *)task->arg;
+    int first = session->player1_disconnected && strcmp(session->player1_username, client->username) == 0;
+    int second = session->player2_disconnected && strcmp(session->player2_username, client->username) == 0;
+    if (!first && !second) return; // resumed from another connection meanwhile
+    
+    timer_cancel(&session->grace_timer);
+    Client *opponent;
+    lock_counted(&games_mutex, &games_lock_stats);
+    if (first) {
+        session->player1 = client;
+        session->player1_disconnected = 0;
+        opponent = session->player2;
+    } else {
+        session->player2 = client;
+        session->player2_disconnected = 0;
+        opponent = session->player1;
+    }
+    __atomic_store_n(&client->session, session, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&games_mutex);
+    if (!session->current_turn) session->current_turn = client;
+    
+    client->board = session->saved_board;
+    client->ready = session->saved_ready;
+    client->is_turn = session->saved_turn;
+    set_status(client, PLAYER_IN_GAME);
+    
+    char opponent_name[USERNAME_SIZE] = "";
+    int opponent_ready = 0;
+    if (opponent) {
+        strcpy(opponent_name, opponent->username);
+        opponent_ready = opponent->ready;
+    }
+    
+    SEND_MESSAGE(client, GAME_RESUMED, opponent_name, client->is_turn, client->ready, opponent_ready);
+    
+    if (opponent) {
+        SEND_MESSAGE(opponent, OPPONENT_RECONNECTED, client->username);
+    }
+    
+    printf("[RECONNECT] %s resumed the game against %s (sock %d)\n", client->username, opponent_name, client->sock);
+    task->result = 1;
+}
+
+// Logged back in during the grace window: rebind the session to the new socket
+int resume_game(Client *client) {
+    if (reconnect_grace <= 0) return 0;
+    
+    lock_counted(&games_mutex, &games_lock_stats);
+    GameSession *session = NULL;
+    for (int i = 0; i < game_slots.high; i++) {
+        GameSession *candidate = session_at(i);
+        if (candidate && 
+            ((candidate->player1_disconnected && strcmp(candidate->player1_username, client->username) == 0) ||
+             (candidate->player2_disconnected && strcmp(candidate->player2_username, client->username) == 0))) {
+            session = candidate;
+            session_hold(session);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&games_mutex);
+    
+    return session ? session_run(session, NULL, task_resume_game, client) : 0;
+}
+
+void handle_disconnect(Client *client) {
+    printf("[DISCONNECT] %s disconnected (sock %d, status %d)\n", 
+           client->username, client->sock, get_status(client));
+    leave_lobby(client);
+    
+    // Mid-game drop with a grace window: the opponent waits instead of winning at once
+    if (reconnect_grace > 0 && begin_reconnect_grace(client)) {
+        return;
+    }
+    
+    // Cleanup game with opponent notification
+    cleanup_game_on_exit(client, 1);
+}
+
+static void task_surrender(GameSession *session, Client *client, GameTask *task) {
+    Client *opponent = session_opponent(session, client);
+    if (!opponent) {
+        printf("[SURRENDER] No opponent found\n");
+        return;
+    }
+    printf("[SURRENDER] Ending game, opponent %s wins\n", opponent->username);
+
+    end_game(session, opponent, "SURRENDER");
+}
+
+void handle_surrender(Client *client) {
+    printf("[SURRENDER] %s wants to surrender\n", client->username);
+    // Whether there is still an opponent is up to the game's worker
+    if (!session_post(client, task_surrender, "", 0)) {
+        send_to_client(client, "{\"cmd\":\"ERROR\",\"payload\":{\"message\":\"Not in a game\"}}\n");
+    }
+}
+
+static void task_draw_offer(GameSession *session, Client *client, GameTask *task) {
+    Client *opponent = session_opponent(session, client);
+    if (!opponent) {
+        printf("[DRAW_OFFER] No opponent found\n");
+        return;
+    }
+
+    // Send draw offer to opponent
+    printf("[DRAW_OFFER] Sending to %s (sock %d)\n", opponent->username, opponent->sock);
+    SEND_MESSAGE(opponent, DRAW_OFFER, client->username);
+}
+
+void handle_draw_offer(Client *client) {
+    printf("[DRAW_OFFER] %s offers draw\n", client->username);
+    // Whether there is still an opponent is up to the game's worker
+    if (!session_post(client, task_draw_offer, "", 0)) {
+        send_to_client(client, "{\"cmd\":\"ERROR\",\"payload\":{\"message\":\"Not in a game\"}}\n");
+    }
+}
+
+// task->text: the reply status
+static void task_draw_reply(GameSession *session, Client *client, GameTask *task) {
+    Client *opponent = session_opponent(session, client);
+    if (!opponent) {
+        printf("[DRAW_REPLY] No opponent found\n");
+        return;
+    }
+
+    if (strcmp(task->text, "accept") == 0) {
+        printf("[DRAW_REPLY] Draw accepted, ending game\n");
+        // Save match history for both players as DRAW
+        save_match_history(client->username, opponent->username, "DRAW");
+        save_match_history(opponent->username, client->username, "DRAW");
+        
+        // No ELO change for draw
+        int client_elo = get_player_elo(client->username);
+        int opponent_elo = get_player_elo(opponent->username);
+        
+        // Send DRAW to both players with current ELO
+        SEND_MESSAGE(client, GAME_END, "DRAW", "DRAW_ACCEPTED", "", "", "", client_elo);
+        SEND_MESSAGE(opponent, GAME_END, "DRAW", "DRAW_ACCEPTED", "", "", "", opponent_elo);
+
+        set_status(client, PLAYER_ONLINE);
+        set_status(opponent, PLAYER_ONLINE);
+
+        finish_session(session);
+    } else {
+        // Reject - notify opponent
+        send_to_client(opponent, "{\"cmd\":\"DRAW_REJECTED\",\"payload\":{}}\n");
+    }
+}
+
+void handle_draw_reply(Client *client, const char *status) {
+    printf("[DRAW_REPLY] %s replies: %s\n", client->username, status);
+    if (!session_post(client, task_draw_reply, status, (int)strlen(status))) {
+        printf("[DRAW_REPLY] %s is not in a game\n", client->username);
+    }
+}
+
+// task->text: the message
+static void task_chat(GameSession *session, Client *client, GameTask *task) {
+    Client *opponent = session_opponent(session, client);
+    if (!opponent) {
+        printf("[CHAT] No opponent found for %s\n", client->username);
+        return;
+    }
+    printf("[CHAT] Sending to opponent: %s (sock %d)\n", opponent->username, opponent->sock);
+    SEND_MESSAGE(opponent, CHAT, client->username, task->text);
+}
+
+// In a game the worker knows the opponent; before it, the MATCH_FOUND partner
+void handle_chat(Client *client, const char *message) {
+    printf("[CHAT] From: %s, Message: %s\n", client->username, message);
+    if (session_post(client, task_chat, message, (int)strlen(message))) return;
+    
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    Client *opponent = match_partner(client);
+    if (opponent) {
+        printf("[CHAT] Sending to opponent: %s (sock %d)\n", opponent->username, opponent->sock);
+        SEND_MESSAGE(opponent, CHAT, client->username, message);
+    } else {
+        printf("[CHAT] No opponent found for %s\n", client->username);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Matching functions
+void handle_start_matching(Client *client) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    if (get_status(client) != PLAYER_ONLINE) {
+        pthread_mutex_unlock(&clients_mutex);
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Cannot start matching\"}}\n");
+        return;
+    }
+    
+    client->is_matching = 1;
+    set_status(client, PLAYER_IN_LOBBY);
+    pthread_mutex_unlock(&clients_mutex);
+    
+    send_to_client(client, "{\"cmd\":\"MATCHING_STARTED\",\"payload\":{\"message\":\"Đang tìm đối thủ...\"}}\n");
+    
+    printf("[MATCHING] %s started matching (ELO: %d)\n", client->username, get_player_elo(client->username));
+    
+    // Try to match immediately
+    try_match_players();
+}
+
+void handle_cancel_matching(Client *client) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    if (!client->is_matching) {
+        pthread_mutex_unlock(&clients_mutex);
+        return;
+    }
+    
+    client->is_matching = 0;
+    set_status(client, PLAYER_ONLINE);
+    pthread_mutex_unlock(&clients_mutex);
     
-    if (!challenger) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":404,\"message\":\"Challenger not found\"}}\n");
-        send_message(client->sock, response);
+    send_to_client(client, "{\"cmd\":\"MATCHING_CANCELLED\",\"payload\":{\"message\":\"Đã hủy tìm trận\"}}\n");
+    
+    printf("[MATCHING] %s cancelled matching\n", client->username);
+}
+
+void try_match_players() {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    
+    // Find all players in matching queue
+    Client **matching_players = (Client **)malloc((client_slots.high + 1) * sizeof(Client *));
+    int matching_count = 0;
+    if (!matching_players) {
+        pthread_mutex_unlock(&clients_mutex);
+        return;
+    }
+    
+    for (int i = 0; i < client_slots.high; i++) {
+        if (client_at(i) != NULL && client_at(i)->is_matching) {
+            matching_players[matching_count++] = client_at(i);
+        }
+    }
+    
+    // Try to match players with similar ELO (±100)
+    for (int i = 0; i < matching_count - 1; i++) {
+        if (!matching_players[i]->is_matching) continue; // Already matched
+        
+        int player1_elo = get_player_elo(matching_players[i]->username);
+        
+        for (int j = i + 1; j < matching_count; j++) {
+            if (!matching_players[j]->is_matching) continue;
+            
+            int player2_elo = get_player_elo(matching_players[j]->username);
+            int elo_diff = abs(player1_elo - player2_elo);
+            
+            if (elo_diff <= 100) {
+                // Match found!
+                Client *p1 = matching_players[i];
+                Client *p2 = matching_players[j];
+                
+                p1->is_matching = 0;
+                p2->is_matching = 0;
+                p1->match_ready = 0;
+                p2->match_ready = 0;
+                p1->in_game_with = p2->sock;
+                p2->in_game_with = p1->sock;
+                set_status(p1, PLAYER_IN_LOBBY);
+                set_status(p2, PLAYER_IN_LOBBY);
+                
+                printf("[MATCHING] Matched %s (ELO: %d) with %s (ELO: %d)\n",
+                       p1->username, player1_elo, p2->username, player2_elo);
+                
+                // Send match found notification
+                SEND_MESSAGE(p1, MATCH_FOUND, p2->username, player2_elo);
+                
+                SEND_MESSAGE(p2, MATCH_FOUND, p1->username, player1_elo);
+                
+                timer_schedule(&p1->match_timer, MATCH_ACCEPT_TIMEOUT * 1000, match_accept_expired, p1->slot, p1->id);
+                timer_schedule(&p2->match_timer, MATCH_ACCEPT_TIMEOUT * 1000, match_accept_expired, p2->slot, p2->id);
+                
+                break;
+            }
+        }
+    }
+    
+    pthread_mutex_unlock(&clients_mutex);
+    free(matching_players);
+}
+
+void handle_match_ready(Client *client) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    Client *opponent = match_partner(client);
+    if (!opponent) {
+        pthread_mutex_unlock(&clients_mutex);
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"No match found\"}}\n");
+        return;
+    }
+    
+    client->match_ready = 1;
+    
+    // Notify opponent that this player is ready
+    SEND_MESSAGE(opponent, OPPONENT_READY, client->username);
+    
+    // Check if both players are ready
+    if (opponent->match_ready) {
+        printf("[MATCH_READY] Both players ready, starting game: %s vs %s\n", 
+               client->username, opponent->username);
+        
+        // Start the game; it resets both players' match state, still under
+        // clients_mutex, so a MATCH_DECLINE or timeout cannot slip in between
+        if (!start_game_locked(client, opponent)) {
+            match_cancel(client, NULL);
+            match_cancel(opponent, NULL);
+        }
+    } else {
+        send_to_client(client, "{\"cmd\":\"WAITING_OPPONENT\",\"payload\":{\"message\":\"Đang chờ đối thủ sẵn sàng...\"}}\n");
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+void handle_match_decline(Client *client) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    if (client->in_game_with == 0) {
+        pthread_mutex_unlock(&clients_mutex);
+        return;
+    }
+    
+    printf("[MATCH_DECLINE] %s declined match\n", client->username);
+    
+    Client *opponent = match_partner(client);
+    if (opponent) {
+        match_cancel(opponent, "{\"cmd\":\"MATCH_DECLINED\",\"payload\":{\"message\":\"Đối thủ đã từ chối trận đấu\"}}\n");
+    }
+    
+    // Confirm to the person who declined and reset their state
+    match_cancel(client, "{\"cmd\":\"MATCH_DECLINED\",\"payload\":{\"message\":\"Bạn đã từ chối trận đấu\"}}\n");
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// MATCH_FOUND not confirmed in time: cancel the match for both players
+void match_accept_expired(int slot, unsigned long id) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    Client *client = slot < client_slots.high ? client_at(slot) : NULL;
+    if (!client || client->id != id || get_status(client) != PLAYER_IN_LOBBY || 
+        client->in_game_with <= 0 || client->is_matching || client->match_ready) {
+        pthread_mutex_unlock(&clients_mutex); // confirmed, declined or gone
+        return;
+    }
+    
+    Client *opponent = match_partner(client);
+    
+    printf("[MATCH_TIMEOUT] %s did not confirm the match within %ds\n", client->username, MATCH_ACCEPT_TIMEOUT);
+    
+    if (opponent) {
+        match_cancel(opponent, "{\"cmd\":\"MATCH_DECLINED\",\"payload\":{\"message\":\"Đối thủ không xác nhận trận đấu kịp thời\"}}\n");
+    }
+    
+    match_cancel(client, "{\"cmd\":\"MATCH_DECLINED\",\"payload\":{\"message\":\"Hết thời gian xác nhận trận đấu\"}}\n");
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Write the LEADERBOARD reply (reply_begin() buffer, not sent yet); returns the player count
+int write_leaderboard() {
+    unsigned long version = __atomic_load_n(&leaderboard_version, __ATOMIC_ACQUIRE);
+    BsWriter *w = reply_begin();
+    bs_put_str(w, "{\"cmd\":\"LEADERBOARD\",\"payload\":{\"players\":[");
+    
+    pthread_rwlock_rdlock(&users_lock);
+    FILE *fp = fopen("users.dat", "r");
+    if (!fp) {
+        pthread_rwlock_unlock(&users_lock);
+        bs_put_str(w, "],\"version\":");
+        bs_put_long(w, version);
+        bs_put_str(w, "}}");
+        return 0;
+    }
+    
+    // Read all players
+    PlayerAccount players[MAX_ACCOUNTS];
+    int player_count = 0;
+    
+    char line[256];
+    while (fgets(line, sizeof(line), fp) && player_count < MAX_ACCOUNTS) {
+        sscanf(line, "%[^:]:%[^:]:%d:%d:%d", 
+               players[player_count].username, 
+               players[player_count].password,
+               &players[player_count].elo,
+               &players[player_count].games_played,
+               &players[player_count].games_won);
+        player_count++;
+    }
+    fclose(fp);
+    pthread_rwlock_unlock(&users_lock);
+    
+    // Sort by ELO (descending)
+    for (int i = 0; i < player_count - 1; i++) {
+        for (int j = i + 1; j < player_count; j++) {
+            if (players[j].elo > players[i].elo) {
+                PlayerAccount temp = players[i];
+                players[i] = players[j];
+                players[j] = temp;
+            }
+        }
+    }
+    
+    // Build JSON response
+    for (int i = 0; i < player_count && i < 50; i++) { // Top 50
+        // winrate with one decimal, rounded like %.1f
+        long tenths = players[i].games_played > 0 
+            ? (players[i].games_won * 2000L / players[i].games_played + 1) / 2 
+            : 0;
+        
+        if (i > 0) bs_put(w, ",", 1);
+        bs_put_str(w, "{\"rank\":");
+        bs_put_long(w, i + 1);
+        bs_put_str(w, ",\"username\":\"");
+        bs_put_escaped(w, players[i].username);
+        bs_put_str(w, "\",\"elo\":");
+        bs_put_long(w, players[i].elo);
+        bs_put_str(w, ",\"games\":");
+        bs_put_long(w, players[i].games_played);
+        bs_put_str(w, ",\"wins\":");
+        bs_put_long(w, players[i].games_won);
+        bs_put_str(w, ",\"winrate\":");
+        bs_put_long(w, tenths / 10);
+        char decimal[2] = { '.', (char)('0' + tenths % 10) };
+        bs_put(w, decimal, 2);
+        bs_put(w, "}", 1);
+    }
+    
+    bs_put_str(w, "],\"version\":");
+    bs_put_long(w, version);
+    bs_put_str(w, "}}");
+    return player_count < 50 ? player_count : 50;
+}
+
+void handle_logout(Client *client) {
+    time_t now = time(NULL);
+    printf("[LOGOUT] User: %s\n", client->username);
+    printf("[LOGOUT] Socket: %d\n", client->sock);
+    printf("[LOGOUT] Status: %d\n", get_status(client));
+    printf("[LOGOUT] Time: %s", ctime(&now));
+    
+    // If in game or lobby, cleanup game (notify opponent)
+    leave_lobby(client);
+    cleanup_game_on_exit(client, 1);
+    
+    // Clear session and reset state
+    timer_cancel(&client->heartbeat_timer);
+    memset(client->session_token, 0, sizeof(client->session_token));
+    
+    send_to_client(client, "{\"cmd\":\"LOGOUT_SUCCESS\",\"payload\":{\"message\":\"Logged out successfully\"}}\n");
+    
+    printf("[LOGOUT] %s logout completed\n", client->username);
+}
+
+// ==================== SLOW QUERIES ====================
+// LEADERBOARD and MATCH_HISTORY scan files on disk. They are handed to
+// QUERY_WORKERS threads so the connection's I/O thread goes straight back to
+// its in-game traffic. Their replies can therefore trail (or overtake) those
+// of later requests; clients pair them up through the request "id".
+
+typedef struct SlowQuery {
+    CommandId cmd;
+    int slot;                          // client, resolved like a timer callback
+    unsigned long client_id;
+    char username[USERNAME_SIZE];
+    char request_id[REQUEST_ID_SIZE];
+    struct SlowQuery *next;
+} SlowQuery;
+
+static pthread_mutex_t query_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t query_cond = PTHREAD_COND_INITIALIZER;
+static SlowQuery *query_head = NULL;
+static SlowQuery *query_tail = NULL;
+static int query_pending = 0;        // guarded by query_mutex
+static unsigned long query_answered = 0;
+
+// Queue a slow query for the request being handled on this thread
+void query_submit(Client *client, CommandId cmd) {
+    if (batch.chunk) {
+        // BATCH_RESULT waits for every command anyway: answer inline
+        if (cmd == CMD_LEADERBOARD) {
+            write_leaderboard();
+        } else {
+            write_match_history(client->username);
+        }
+        reply_send(client);
+        return;
+    }
+    
+    SlowQuery *query = (SlowQuery *)malloc(sizeof(SlowQuery));
+    if (query) {
+        query->cmd = cmd;
+        query->slot = client->slot;
+        query->client_id = client->id;
+        strcpy(query->username, client->username);
+        strcpy(query->request_id, client == request_client ? request_id : "");
+        query->next = NULL;
+        
+        pthread_mutex_lock(&query_mutex);
+        if (query_pending < QUERY_QUEUE_MAX) {
+            if (query_tail) {
+                query_tail->next = query;
+            } else {
+                query_head = query;
+            }
+            query_tail = query;
+            query_pending++;
+            pthread_cond_signal(&query_cond);
+        } else {
+            free(query);
+            query = NULL;
+        }
+        pthread_mutex_unlock(&query_mutex);
+    }
+    
+    if (!query) {
+        __atomic_add_fetch(&shed_queries, 1, __ATOMIC_RELAXED);
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":503,\"message\":\"Server busy\"}}\n");
+    }
+}
+
+void *query_worker(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&query_mutex);
+        while (!query_head) {
+            pthread_cond_wait(&query_cond, &query_mutex);
+        }
+        SlowQuery *query = query_head;
+        query_head = query->next;
+        if (!query_head) query_tail = NULL;
+        query_pending--;
+        pthread_mutex_unlock(&query_mutex);
+        
+        // The file work runs without locks; only delivery needs the client
+        int count = 0;
+        if (query->cmd == CMD_LEADERBOARD) {
+            count = write_leaderboard();
+        } else {
+            write_match_history(query->username);
+        }
+        
+        lock_counted(&clients_mutex, &clients_lock_stats);
+        Client *client = query->slot >= 0 && query->slot < client_slots.high ? client_at(query->slot) : NULL;
+        if (client && client->id == query->client_id) {
+            request_client = client;
+            strcpy(request_id, query->request_id);
+            reply_send(client);
+            request_end();
+            flush_pending_output();
+            if (query->cmd == CMD_LEADERBOARD) {
+                printf("[LEADERBOARD] Sent top %d players to %s\n", count, query->username);
+            }
+        } else {
+            reply_discard(); // disconnected while queued
+        }
+        pthread_mutex_unlock(&clients_mutex);
+        
+        __atomic_add_fetch(&query_answered, 1, __ATOMIC_RELAXED);
+        free(query);
+    }
+    return NULL;
+}
+
+void queries_start() {
+    for (int i = 0; i < QUERY_WORKERS; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, query_worker, NULL) != 0) {
+            perror("pthread_create query worker failed");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(tid);
+    }
+}
+
+// ==================== LATENCY ====================
+// Every HEARTBEAT_INTERVAL_MS the timer thread sends a logged-in client
+// HEARTBEAT with a sequence number; the matching HEARTBEAT_ACK yields one RTT
+// sample. Smoothed RTT and jitter follow RFC 6298 (gains 1/8 and 1/4).
+
+void client_heartbeat(int slot, unsigned long id) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    Client *client = slot < client_slots.high ? client_at(slot) : NULL;
+    if (client && client->id == id && get_status(client) != PLAYER_OFFLINE) {
+        // An unanswered heartbeat is simply superseded: only the newest seq is measured
+        client->ping_seq++;
+        client->last_ping_time = monotonic_ms();
+        
+        if (client->protocol == PROTO_BINARY) {
+            queue_packed_varints(client, WIRE_OP_HEARTBEAT, 1, client->ping_seq, 0);
+        } else {
+            SEND_MESSAGE(client, HEARTBEAT, client->ping_seq);
+        }
+        timer_schedule(&client->heartbeat_timer, HEARTBEAT_INTERVAL_MS, client_heartbeat, slot, id);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// task->text: "ping jitter" of client, for its opponent
+static void task_ping_update(GameSession *session, Client *client, GameTask *task) {
+    Client *opponent = session_opponent(session, client);
+    int ping, jitter;
+    if (!opponent || sscanf(task->text, "%d %d", &ping, &jitter) != 2) return;
+    
+    if (opponent->protocol == PROTO_BINARY) {
+        queue_packed_varints(opponent, WIRE_OP_PING_UPDATE, 2, ping, jitter);
+    } else {
+        SEND_MESSAGE(opponent, PING_UPDATE, ping, jitter);
+    }
+}
+
+void handle_heartbeat_ack(Client *client, unsigned int seq) {
+    // clients_mutex orders us against client_heartbeat() on the timer thread
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    if (seq != client->ping_seq || client->last_ping_time == 0) {
+        pthread_mutex_unlock(&clients_mutex); // stale or unsolicited
+        return;
+    }
+    
+    int rtt = (int)(monotonic_ms() - client->last_ping_time);
+    client->last_ping_time = 0;
+    if (client->rtt_samples == 0) {
+        client->ping = rtt;
+        client->jitter = rtt / 2;
+    } else {
+        int deviation = abs(client->ping - rtt);
+        client->jitter = (3 * client->jitter + deviation) / 4;
+        client->ping = (7 * client->ping + rtt) / 8;
+    }
+    client->rtt_samples++;
+    
+    if (client->protocol == PROTO_BINARY) {
+        queue_packed_varints(client, WIRE_OP_LATENCY, 2, client->ping, client->jitter);
+    } else {
+        SEND_MESSAGE(client, LATENCY, client->ping, client->jitter);
+    }
+    
+    char latency[32];
+    int len = snprintf(latency, sizeof(latency), "%d %d", client->ping, client->jitter);
+    pthread_mutex_unlock(&clients_mutex);
+    
+    // In game: the opponent sees our measured latency, sent by the game's worker
+    session_post(client, task_ping_update, latency, len);
+}
+
+// ==================== COMMAND DISPATCH ====================
+// Handlers take the tokenized message and the index of its "payload" object
+// (-1 if absent); see json_tokens.h. Payloads with a schema entry are read
+// with the generated bs_decode_<name>() from battleship_messages.h.
+
+// Switch this connection's framing (see battleship_wire.h). Only allowed
+// before LOGIN: until then nothing but this thread sends to the client, so
+// HELLO_OK is guaranteed to be the last message in the old framing.
+static void cmd_hello(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_HELLO hello;
+    bs_decode_REQ_HELLO(doc, payload, &hello);
+    const char *protocol = hello.protocol;
+    
+    int binary = strcmp(protocol, "binary") == 0;
+    if (!binary && strcmp(protocol, "json") != 0) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Unsupported protocol\"}}\n");
+        return;
+    }
+    // Compressed frames need binary framing: deflate output is not line-safe
+    int deflate = strcmp(hello.compression, "deflate") == 0;
+    if ((hello.compression[0] && !deflate) || (deflate && !binary)) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Unsupported compression\"}}\n");
+        return;
+    }
+    if (client->username[0]) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"HELLO must come before LOGIN\"}}\n");
+        return;
+    }
+    
+    SEND_MESSAGE(client, HELLO_OK, protocol, hello.compression);
+    client->protocol = binary ? PROTO_BINARY : PROTO_JSON;
+    client->compress = deflate;
+    printf("[PROTOCOL] sock %d now uses %s framing%s\n", client->sock, protocol, deflate ? " with deflate" : "");
+}
+
+static void cmd_register(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_REGISTER request;
+    bs_decode_REQ_REGISTER(doc, payload, &request);
+    const char *username = request.username, *password = request.password;
+    
+    if (!username[0] || !password[0]) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Username and password required\"}}\n");
+    } else if (register_user(username, password)) {
+        send_to_client(client, "{\"cmd\":\"REGISTER_SUCCESS\",\"payload\":{\"message\":\"Registration successful\"}}\n");
+    } else {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Username already exists\"}}\n");
+    }
+}
+
+static void cmd_login(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_LOGIN request;
+    bs_decode_REQ_LOGIN(doc, payload, &request);
+    const char *username = request.username, *password = request.password;
+    
+    if (username[0] && authenticate_user(username, password)) {
+        set_username(client, username);
+        store_status(client, PLAYER_ONLINE);
+        generate_session_token(client->session_token);
+        
+        int elo = get_player_elo(username);
+        SEND_MESSAGE(client, LOGIN_SUCCESS, username, "Welcome!", elo, client->session_token);
+        
+        printf("User logged in: %s (socket %d, ELO: %d, token: %s)\n", username, client->sock, elo, client->session_token);
+        resume_game(client);
+        timer_schedule(&client->heartbeat_timer, HEARTBEAT_INTERVAL_MS, client_heartbeat, client->slot, client->id);
+    } else {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":401,\"message\":\"Invalid credentials\"}}\n");
+    }
+}
+
+static void cmd_player_list(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_PLAYER_LIST request;
+    bs_decode_REQ_PLAYER_LIST(doc, payload, &request);
+    unsigned long version = player_list_version();
+    if (request.version == (long)version) {
+        SEND_MESSAGE(client, NOT_MODIFIED, "PLAYER_LIST", (long)version);
+        return;
+    }
+    send_player_list(client, version);
+}
+
+static void cmd_match_history(Client *client, const JsonDoc *doc, int payload) {
+    query_submit(client, CMD_MATCH_HISTORY);
+}
+
+static void cmd_challenge(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_CHALLENGE request;
+    bs_decode_REQ_CHALLENGE(doc, payload, &request);
+    handle_challenge(client, request.target_username);
+}
+
+static void cmd_challenge_reply(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_CHALLENGE_REPLY reply;
+    bs_decode_REQ_CHALLENGE_REPLY(doc, payload, &reply);
+    handle_challenge_reply(client, reply.challenger_username, reply.status);
+}
+
+static void cmd_place_ships(Client *client, const JsonDoc *doc, int payload) {
+    int ships = json_find(doc, payload, "ships");
+    if (ships >= 0) {
+        handle_place_ships(client, doc, ships);
+    }
+}
+
+static void cmd_move(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_MOVE move;
+    bs_decode_REQ_MOVE(doc, payload, &move);
+    handle_move(client, move.coord);
+}
+
+static void cmd_chat(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_CHAT chat;
+    bs_decode_REQ_CHAT(doc, payload, &chat);
+    handle_chat(client, chat.message);
+}
+
+static void cmd_surrender(Client *client, const JsonDoc *doc, int payload) {
+    handle_surrender(client);
+}
+
+static void cmd_draw_offer(Client *client, const JsonDoc *doc, int payload) {
+    handle_draw_offer(client);
+}
+
+static void cmd_draw_reply(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_DRAW_REPLY reply;
+    bs_decode_REQ_DRAW_REPLY(doc, payload, &reply);
+    handle_draw_reply(client, reply.status);
+}
+
+static void cmd_start_matching(Client *client, const JsonDoc *doc, int payload) {
+    handle_start_matching(client);
+}
+
+static void cmd_cancel_matching(Client *client, const JsonDoc *doc, int payload) {
+    handle_cancel_matching(client);
+}
+
+static void cmd_match_ready(Client *client, const JsonDoc *doc, int payload) {
+    handle_match_ready(client);
+}
+
+static void cmd_match_decline(Client *client, const JsonDoc *doc, int payload) {
+    handle_match_decline(client);
+}
+
+static void cmd_leaderboard(Client *client, const JsonDoc *doc, int payload) {
+    // Answered here when unchanged; only a rebuild goes to a query worker
+    Msg_REQ_LEADERBOARD request;
+    bs_decode_REQ_LEADERBOARD(doc, payload, &request);
+    unsigned long version = __atomic_load_n(&leaderboard_version, __ATOMIC_ACQUIRE);
+    if (request.version == (long)version) {
+        SEND_MESSAGE(client, NOT_MODIFIED, "LEADERBOARD", (long)version);
         return;
     }
-    
-    char message[BUFFER_SIZE];
-    
-    if (strcmp(status, "ACCEPT") == 0) {
-        // Start game
-        start_game(challenger, client);
-    } else {
-        // Notify challenger of rejection
-        sprintf(message, "{\"cmd\":\"CHALLENGE_REPLY\",\"payload\":{\"player\":\"%s\",\"status\":\"REJECT\"}}\n", client->username);
-        send_message(challenger->sock, message);
+    query_submit(client, CMD_LEADERBOARD);
+}
+
+static void cmd_logout(Client *client, const JsonDoc *doc, int payload) {
+    handle_logout(client);
+}
+
+static void cmd_ping(Client *client, const JsonDoc *doc, int payload) {
+    // Respond with PONG immediately
+    if (client->protocol == PROTO_BINARY) {
+        queue_packed_varints(client, WIRE_OP_PONG, 1, (unsigned long)time(NULL), 0);
+        return;
     }
+    SEND_MESSAGE(client, PONG, (long)time(NULL));
 }
 
-void start_game(Client *player1, Client *player2) {
-    // Create game session
-    pthread_mutex_lock(&games_mutex);
-    GameSession *session = NULL;
-    for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-        if (game_sessions[i] == NULL) {
-            session = (GameSession *)malloc(sizeof(GameSession));
-            game_sessions[i] = session;
-            break;
-        }
+// BATCH runs payload.commands in order, each like a message of its own (rate
+// limits and "id" included; the envelope takes no token), and answers with one BATCH_RESULT whose
+// "replies" hold what they sent back to this client. Messages to other
+// clients and packed binary frames are sent as usual.
+static void cmd_batch(Client *client, const JsonDoc *doc, int payload) {
+    int list = json_find(doc, payload, "commands");
+    if (list < 0 || doc->tokens[list].type != JSON_ARRAY || doc->tokens[list].count > BATCH_MAX_COMMANDS) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Invalid batch\"}}\n");
+        return;
     }
-    pthread_mutex_unlock(&games_mutex);
-    
-    if (!session) {
-        char msg[BUFFER_SIZE];
-        sprintf(msg, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":500,\"message\":\"Server full\"}}\n");
-        send_message(player1->sock, msg);
-        send_message(player2->sock, msg);
+    if (batch.chunk) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Nested batch\"}}\n");
         return;
     }
     
-    // Initialize session
-    session->player1_sock = player1->sock;
-    session->player2_sock = player2->sock;
-    strncpy(session->player1_username, player1->username, USERNAME_SIZE - 1);
-    strncpy(session->player2_username, player2->username, USERNAME_SIZE - 1);
-    session->status = GAME_PLACING_SHIPS;
-    session->start_time = time(NULL);
-    session->player1_disconnected = 0;
-    session->player2_disconnected = 0;
-    session->player1_disconnect_time = 0;
-    session->player2_disconnect_time = 0;
-    sprintf(session->log_id, "game_%ld", session->start_time);
+    char batch_id[REQUEST_ID_SIZE];
+    strcpy(batch_id, request_id);
+    reply_buffer_open(&batch);
+    batch_replies = 0;
+    bs_put_str(&batch.writer, "{\"cmd\":\"BATCH_RESULT\",\"payload\":{\"replies\":[");
     
-    // Update players
-    player1->status = PLAYER_IN_GAME;
-    player1->in_game_with = player2->sock;
-    player1->ready = 0;
-    player1->is_turn = 1;
-    player1->last_active = time(NULL);
-    init_board(&player1->board);
+    int t = list + 1;
+    for (int i = 0; i < doc->tokens[list].count; i++, t = doc->tokens[t].next) {
+        if (!request_begin(client, doc, json_find(doc, t, "id"))) {
+            send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Invalid id\"}}\n");
+        } else if (doc->tokens[t].type != JSON_OBJECT) {
+            send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Malformed message\"}}\n");
+        } else {
+            dispatch_message(client, doc, t);
+        }
+    }
     
-    player2->status = PLAYER_IN_GAME;
-    player2->in_game_with = player1->sock;
-    player2->ready = 0;
-    player2->is_turn = 0;
-    player2->last_active = time(NULL);
-    init_board(&player2->board);
+    bs_put_str(&batch.writer, "]}}");
+    request_client = client;
+    strcpy(request_id, batch_id);
+    reply_tag(&batch.writer);
+    reply_buffer_queue(&batch, client);
+}
+
+static void cmd_heartbeat_ack(Client *client, const JsonDoc *doc, int payload) {
+    Msg_REQ_HEARTBEAT_ACK ack;
+    bs_decode_REQ_HEARTBEAT_ACK(doc, payload, &ack);
+    handle_heartbeat_ack(client, (unsigned int)ack.seq);
+}
+
+static void cmd_update_ping(Client *client, const JsonDoc *doc, int payload) {
+    // Older clients still report their own ping; RTT now comes from HEARTBEAT_ACK
+}
+
+typedef void (*CommandHandler)(Client *client, const JsonDoc *doc, int payload);
+
+typedef struct {
+    const char *name;
+    CommandHandler handler;
+    CommandClass cls;
+} CommandInfo;
+
+static const CommandInfo commands[CMD_COUNT] = {
+#define X(name, handler, cls) { #name, handler, cls },
+    COMMAND_TABLE(X)
+#undef X
+};
+
+typedef struct {
+    unsigned long calls;
+    unsigned long refused;   // rate limited or shed
+    unsigned long total_us;
+    unsigned long max_us;
+} CommandStats;
+
+static CommandStats command_stats[CMD_COUNT];
+
+// FNV-1a, constexpr so every command name becomes a case label below. Two
+// names hashing alike would be a duplicate case and fail to compile, so the
+// switch is a perfect hash checked at build time.
+constexpr unsigned int command_hash(const char *s, unsigned int h = 2166136261u) {
+    return *s ? command_hash(s + 1, (h ^ (unsigned char)*s) * 16777619u) : h;
+}
+
+CommandId command_lookup(const char *cmd) {
+    CommandId id;
+    switch (command_hash(cmd)) {
+#define X(name, handler, cls) case command_hash(#name): id = CMD_##name; break;
+        COMMAND_TABLE(X)
+#undef X
+        default: return CMD_UNKNOWN;
+    }
+    // Unknown strings can still land on a used hash
+    return strcmp(cmd, commands[id].name) == 0 ? id : CMD_UNKNOWN;
+}
+
+// WELCOME lists the framings (see cmd_hello) and commands this server understands
+void send_welcome(Client *client) {
+    BsWriter *w = reply_begin();
+    bs_put_str(w, "{\"cmd\":\"WELCOME\",\"payload\":{\"message\":\"Welcome to BattleShip Server\",\"protocols\":[\"json\",\"binary\"],\"compression\":[\"deflate\"],\"commands\":[");
+    for (int i = 0; i < CMD_COUNT; i++) {
+        if (i) bs_put(w, ",", 1);
+        bs_put(w, "\"", 1);
+        bs_put_str(w, commands[i].name);
+        bs_put(w, "\"", 1);
+    }
+    bs_put_str(w, "]}}");
+    reply_send(client);
+}
+
+void print_command_stats() {
+    for (int i = 0; i < CMD_COUNT; i++) {
+        unsigned long calls = __atomic_load_n(&command_stats[i].calls, __ATOMIC_RELAXED);
+        unsigned long refused = __atomic_load_n(&command_stats[i].refused, __ATOMIC_RELAXED);
+        if (calls == 0 && refused == 0) continue;
+        printf("[STATS] command %-16s calls=%lu refused=%lu avg_us=%lu max_us=%lu\n",
+               commands[i].name, calls, refused,
+               calls ? __atomic_load_n(&command_stats[i].total_us, __ATOMIC_RELAXED) / calls : 0,
+               __atomic_load_n(&command_stats[i].max_us, __ATOMIC_RELAXED));
+    }
+}
+
+// ==================== ADMISSION CONTROL ====================
+// Each connection has one token bucket per command class. On top of that the
+// server as a whole counts as overloaded while the outbound queues or the
+// average handler time pass their thresholds; then new connections and
+// CMD_CLASS_QUERY commands are refused so MOVE keeps its latency.
+
+typedef struct {
+    int rate;   // tokens per second
+    int burst;  // bucket size
+} RateLimit;
+
+static const RateLimit rate_limits[CMD_CLASS_COUNT] = {
+    { 20, 40 },  // CMD_CLASS_GAME
+    { 5, 10 },   // CMD_CLASS_CONTROL
+    { 1, 20 },   // CMD_CLASS_QUERY
+};
+
+static int bucket_take(TokenBucket *bucket, const RateLimit *limit) {
+    unsigned long now = monotonic_ms();
+    bucket->tokens += (long)(now - bucket->last_ms) * limit->rate; // ms * tokens/s = millitokens
+    bucket->last_ms = now;
+    if (bucket->tokens > limit->burst * 1000L) bucket->tokens = limit->burst * 1000L;
+    if (bucket->tokens < 1000) return 0;
+    bucket->tokens -= 1000;
+    return 1;
+}
+
+static void record_handler_latency(unsigned long sample_us) {
+    // Approximate EWMA (gain 1/8); lost updates between threads don't matter here
+    unsigned long avg = __atomic_load_n(&handler_latency_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&handler_latency_us, avg - avg / 8 + sample_us / 8, __ATOMIC_RELAXED);
+}
+
+int server_overloaded() {
+    return __atomic_load_n(&out_queued_bytes, __ATOMIC_RELAXED) > OVERLOAD_QUEUE_BYTES ||
+           __atomic_load_n(&handler_latency_us, __ATOMIC_RELAXED) > OVERLOAD_LATENCY_US;
+}
+
+// Whether a PLAYER_LIST or LEADERBOARD request already holds the current
+// version: its handler only answers NOT_MODIFIED, so it costs nothing
+static int view_unchanged(CommandId id, const JsonDoc *doc, int payload) {
+    if (id == CMD_PLAYER_LIST) {
+        Msg_REQ_PLAYER_LIST request;
+        bs_decode_REQ_PLAYER_LIST(doc, payload, &request);
+        return request.version == (long)player_list_version();
+    }
+    if (id == CMD_LEADERBOARD) {
+        Msg_REQ_LEADERBOARD request;
+        bs_decode_REQ_LEADERBOARD(doc, payload, &request);
+        return request.version == (long)__atomic_load_n(&leaderboard_version, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+// Returns 0 (after telling the client) when the command must not run.
+// doc and payload are the request (NULL and -1 for packed binary commands).
+static int admit_command(Client *client, CommandId id, const JsonDoc *doc, int payload) {
+    CommandClass cls = commands[id].cls;
     
-    // Notify both players
-    char message[BUFFER_SIZE];
-    sprintf(message, "{\"cmd\":\"GAME_START\",\"payload\":{\"opponent\":\"%s\",\"your_turn\":%d}}\n", 
-            player2->username, player1->is_turn);
-    send_message(player1->sock, message);
+    // The BATCH envelope itself is free: every command inside it is admitted
+    // on its own. So is a list request that will be answered NOT_MODIFIED.
+    if (doc && view_unchanged(id, doc, payload)) return 1;
+    if (id != CMD_BATCH && !bucket_take(&client->buckets[cls], &rate_limits[cls])) {
+        __atomic_add_fetch(&rate_limited, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&command_stats[id].refused, 1, __ATOMIC_RELAXED);
+        SEND_MESSAGE(client, SYSTEM_MSG, 429, "Rate limit exceeded", commands[id].name);
+        return 0;
+    }
+    if (cls == CMD_CLASS_QUERY && server_overloaded()) {
+        __atomic_add_fetch(&shed_queries, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&command_stats[id].refused, 1, __ATOMIC_RELAXED);
+        SEND_MESSAGE(client, SYSTEM_MSG, 503, "Server busy, try again later", commands[id].name);
+        return 0;
+    }
+    return 1;
+}
+
+// Per-command stats and the admission latency average, for a handler started at `start`
+static void command_done(CommandId id, unsigned long start) {
+    unsigned long elapsed = monotonic_us() - start;
+    
+    CommandStats *stats = &command_stats[id];
+    __atomic_add_fetch(&stats->calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->total_us, elapsed, __ATOMIC_RELAXED);
+    if (elapsed > __atomic_load_n(&stats->max_us, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&stats->max_us, elapsed, __ATOMIC_RELAXED); // racy max is fine for stats
+    }
+    record_handler_latency(elapsed);
+}
+
+// Run one admitted command and record its latency
+void handle_command(Client *client, CommandId id, const JsonDoc *doc, int payload) {
+    unsigned long start = monotonic_us();
+    commands[id].handler(client, doc, payload);
+    command_done(id, start);
+}
+
+// Run the command in object token msg ({"cmd":"...","payload":{...}})
+void dispatch_message(Client *client, const JsonDoc *doc, int msg) {
+    char cmd[50];
+    if (!json_string(doc, json_find(doc, msg, "cmd"), cmd, sizeof(cmd)) || !cmd[0]) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Malformed message\"}}\n");
+        return;
+    }
     
-    sprintf(message, "{\"cmd\":\"GAME_START\",\"payload\":{\"opponent\":\"%s\",\"your_turn\":%d}}\n", 
-            player1->username, player2->is_turn);
-    send_message(player2->sock, message);
+    CommandId id = command_lookup(cmd);
+    if (id == CMD_UNKNOWN) {
+        printf("[DISPATCH] Unknown command '%s' from sock %d\n", cmd, client->sock);
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Unknown command\"}}\n");
+        return;
+    }
     
-    printf("Game started: %s vs %s\n", player1->username, player2->username);
+    int payload = json_find(doc, msg, "payload");
+    if (admit_command(client, id, doc, payload)) {
+        handle_command(client, id, doc, payload);
+    }
 }
 
-void handle_place_ships(Client *client, const char *ships_data) {
-    // Parse ships data from JSON
-    // Format: [{"name":"Carrier","size":5,"row":0,"col":0,"horizontal":true}, ...]
+// Parse one message line ({"cmd":"...","payload":{...},"id":...}, newline already stripped) and dispatch it
+void process_message(Client *client, char *buffer) {
+    // Tolerate CRLF line endings
+    size_t length = strlen(buffer);
+    if (length > 0 && buffer[length - 1] == '\r') buffer[--length] = '\0';
     
-    printf("[DEBUG] handle_place_ships called for user: %s\n", client->username);
-    printf("[DEBUG] ships_data: %s\n", ships_data);
+    printf("Received from %s (sock %d): %s\n", client->username[0] ? client->username : "unknown", client->sock, buffer);
+    __atomic_store_n(&client->last_active, time(NULL), __ATOMIC_RELAXED);
     
-    init_board(&client->board);
+    // Tokenize once; handlers read fields straight out of buffer
+    JsonDoc doc;
+    if (json_tokenize(&doc, buffer, length) < 0) {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Malformed message\"}}\n");
+        return;
+    }
     
-    // Simple parsing (in production, use a JSON library)
-    const char *ptr = ships_data;
-    while (*ptr) {
-        if (*ptr == '{') {
-            char name[30];
-            char horizontal_str[10];
-            int size, row, col, horizontal;
-            
-            // Extract ship data - parse horizontal as string first
-            if (sscanf(ptr, "{\"name\":\"%[^\"]\",\"size\":%d,\"row\":%d,\"col\":%d,\"horizontal\":%[^,}]", 
-                      name, &size, &row, &col, horizontal_str) == 5) {
-                
-                // Convert "true"/"false" string to int
-                horizontal = (strstr(horizontal_str, "true") != NULL) ? 1 : 0;
-                
-                if (client->board.ship_count < MAX_SHIPS && 
-                    row >= 0 && row < GRID_SIZE && 
-                    col >= 0 && col < GRID_SIZE) {
-                    
-                    Ship *ship = &client->board.ships[client->board.ship_count];
-                    strncpy(ship->name, name, sizeof(ship->name) - 1);
-                    ship->size = size;
-                    ship->start_row = row;
-                    ship->start_col = col;
-                    ship->is_horizontal = horizontal;
-                    ship->hits = 0;
-                    
-                    // Place ship on grid
-                    for (int i = 0; i < size; i++) {
-                        int r = row + (horizontal ? 0 : i);
-                        int c = col + (horizontal ? i : 0);
-                        if (r < GRID_SIZE && c < GRID_SIZE) {
-                            client->board.grid[r][c] = 1;
-                            client->board.total_ship_cells++;
-                        }
-                    }
-                    
-                    client->board.ship_count++;
-                }
+    // From here on replies to client echo the request's "id"
+    if (request_begin(client, &doc, json_find(&doc, 0, "id"))) {
+        dispatch_message(client, &doc, 0);
+    } else {
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Invalid id\"}}\n");
+    }
+    request_end();
+}
+
+// One binary frame (battleship_wire.h). Packed commands go straight to their
+// handler; WIRE_OP_JSON frames take the normal JSON path.
+void process_frame(Client *client, const WireFrame *frame) {
+    __atomic_store_n(&client->last_active, time(NULL), __ATOMIC_RELAXED);
+    
+    switch (frame->opcode) {
+        case WIRE_OP_JSON: {
+            // NUL-terminate in place for process_message, then restore the next frame's byte
+            char *text = (char *)frame->body;
+            char saved = text[frame->len];
+            text[frame->len] = '\0';
+            process_message(client, text);
+            text[frame->len] = saved;
+            break;
+        }
+        case WIRE_OP_MOVE: {
+            if (frame->len != 2 || !admit_command(client, CMD_MOVE, NULL, -1)) break;
+            char coord[8] = ""; // out of range stays empty and is rejected as an invalid coordinate
+            if (frame->body[0] < GRID_SIZE && frame->body[1] < GRID_SIZE) {
+                sprintf(coord, "%c%d", 'A' + frame->body[0], frame->body[1]);
             }
+            unsigned long start = monotonic_us();
+            handle_move(client, coord);
+            command_done(CMD_MOVE, start);
+            break;
+        }
+        case WIRE_OP_PING:
+            if (admit_command(client, CMD_PING, NULL, -1)) handle_command(client, CMD_PING, NULL, -1);
+            break;
+        case WIRE_OP_HEARTBEAT_ACK: {
+            size_t pos = 0;
+            unsigned long seq;
+            if (!wire_read_varint(frame, &pos, &seq) || !admit_command(client, CMD_HEARTBEAT_ACK, NULL, -1)) break;
+            unsigned long start = monotonic_us();
+            handle_heartbeat_ack(client, (unsigned int)seq);
+            command_done(CMD_HEARTBEAT_ACK, start);
+            break;
         }
-        ptr++;
+        default:
+            printf("[DISPATCH] Unknown opcode 0x%02x from sock %d\n", frame->opcode, client->sock);
+            send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Unknown opcode\"}}\n");
+            break;
     }
+}
+
+// Account for len new bytes at recv_buffer + recv_offset and dispatch every
+// complete message (newline-terminated JSON, or binary frames once HELLO
+// switched the connection); a trailing partial one is kept for the next read
+void client_process_input(Client *client, int len) {
+    epoch_enter(); // handlers look up other clients
+    char *start = client->recv_buffer;
+    char *end = client->recv_buffer + client->recv_offset + len;
     
-    
-    client->ready = 1;
-    
-    // Check if opponent is ready
-    Client *opponent = get_client(client->in_game_with);
-    if (opponent && opponent->ready) {
-        // Both ready, start game
-        char message[BUFFER_SIZE];
-        
-        // Find game session and update status
-        pthread_mutex_lock(&games_mutex);
-        for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-            if (game_sessions[i] && 
-                ((game_sessions[i]->player1_sock == client->sock && game_sessions[i]->player2_sock == opponent->sock) ||
-                 (game_sessions[i]->player2_sock == client->sock && game_sessions[i]->player1_sock == opponent->sock))) {
-                game_sessions[i]->status = GAME_PLAYING;
-                game_sessions[i]->current_turn = game_sessions[i]->player1_sock;
-                
-                // Set turn flags correctly
-                Client *p1 = get_client(game_sessions[i]->player1_sock);
-                Client *p2 = get_client(game_sessions[i]->player2_sock);
-                if (p1 && p2) {
-                    p1->is_turn = 1;
-                    p2->is_turn = 0;
-                    
-                    // Notify both players
-                    sprintf(message, "{\"cmd\":\"GAME_READY\",\"payload\":{\"message\":\"Game starting!\",\"your_turn\":true}}\n");
-                    send_message(p1->sock, message);
-                    
-                    sprintf(message, "{\"cmd\":\"GAME_READY\",\"payload\":{\"message\":\"Game starting!\",\"your_turn\":false}}\n");
-                    send_message(p2->sock, message);
-                }
+    while (start < end) {
+        if (client->protocol == PROTO_BINARY) {
+            WireFrame frame;
+            int size = wire_parse_frame((const unsigned char *)start, end - start, BUFFER_SIZE - 1, &frame);
+            if (size == 0) break;
+            if (size < 0) {
+                // Unlike a too-long line there is no delimiter to resync on
+                printf("[FRAMING] Invalid or oversized frame from sock %d, closing\n", client->sock);
+                send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":413,\"message\":\"Invalid frame\"}}\n");
+                shutdown(client->sock, SHUT_RD);
+                start = end;
                 break;
             }
+            process_frame(client, &frame);
+            start += size;
+        } else {
+            char *newline = (char *)memchr(start, '\n', end - start);
+            if (!newline) break;
+            *newline = '\0';
+            if (client->recv_discard) {
+                client->recv_discard = 0; // end of the oversized message
+            } else if (newline > start) {
+                process_message(client, start);
+            }
+            start = newline + 1;
         }
-        pthread_mutex_unlock(&games_mutex);
-    } else {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"PLACE_SHIP_ACK\",\"payload\":{\"message\":\"Waiting for opponent\"}}\n");
-        send_message(client->sock, response);
     }
+    
+    client->recv_offset = client->recv_discard ? 0 : end - start;
+    if (client->recv_offset > 0 && start != client->recv_buffer) {
+        memmove(client->recv_buffer, start, client->recv_offset);
+    }
+    
+    if (client->recv_offset >= BUFFER_SIZE - 1) {
+        printf("[FRAMING] Message from sock %d exceeds %d bytes, dropped\n", client->sock, BUFFER_SIZE - 1);
+        send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":413,\"message\":\"Message too large\"}}\n");
+        client->recv_offset = 0;
+        client->recv_discard = 1;
+    }
+    
+    flush_pending_output();
+    epoch_exit();
 }
 
-void handle_move(Client *client, const char *coord) {
-    // Check if client has placed ships
-    if (!client->ready || client->board.total_ship_cells == 0) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"You haven't placed your ships yet\"}}\n");
-        send_message(client->sock, response);
-        return;
+// Copy bytes received elsewhere (io_uring provided buffers) into recv_buffer
+void client_feed_input(Client *client, const char *data, int len) {
+    while (len > 0) {
+        int space = BUFFER_SIZE - 1 - client->recv_offset;
+        int chunk = len < space ? len : space;
+        memcpy(client->recv_buffer + client->recv_offset, data, chunk);
+        client_process_input(client, chunk);
+        data += chunk;
+        len -= chunk;
     }
+}
+
+void handle_client(Client *client) {
+    int read_size = 0;
     
-    Client *opponent = get_client(client->in_game_with);
-    if (!opponent) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":404,\"message\":\"Opponent not found\"}}\n");
-        send_message(client->sock, response);
-        return;
-    }
+    send_welcome(client);
+    flush_pending_output();
     
-    // Check if opponent has placed ships
-    if (!opponent->ready || opponent->board.total_ship_cells == 0) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Opponent hasn't placed ships yet\"}}\n");
-        send_message(client->sock, response);
-        return;
+    while (1) {
+        struct pollfd pfd[2];
+        pfd[0].fd = client->sock;
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        if (client_has_output(client)) pfd[0].events |= POLLOUT;
+        // Output other threads could not finish writing (threaded_flush())
+        pfd[1].fd = client->wake_fd;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+        
+        int ready = poll(pfd, 2, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            read_size = -1;
+            break;
+        }
+        if (pfd[1].revents & POLLIN) {
+            unsigned long long pokes;
+            if (read(client->wake_fd, &pokes, sizeof(pokes)) < 0 && errno != EAGAIN) {
+                perror("eventfd read failed");
+            }
+        }
+        if ((pfd[0].revents & POLLOUT) || (pfd[1].revents & POLLIN)) {
+            flush_client_output(client);
+        }
+        if (!(pfd[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        
+        read_size = recv(client->sock, client->recv_buffer + client->recv_offset,
+                         BUFFER_SIZE - 1 - client->recv_offset, MSG_DONTWAIT);
+        if (read_size > 0) {
+            client_process_input(client, read_size);
+        } else if (read_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            continue;
+        } else {
+            break;
+        }
     }
     
-    // Check if it's the player's turn
-    if (!client->is_turn) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Not your turn\"}}\n");
-        send_message(client->sock, response);
-        return;
+    if (read_size == 0) {
+        printf("Client disconnected: %s (sock %d)\n", client->username, client->sock);
+    } else if (read_size == -1) {
+        printf("Recv error from client %s (sock %d): %s\n", client->username, client->sock, strerror(errno));
     }
     
-    // Parse coordinate (e.g., "A5" -> row=0, col=4)
-    int row = coord[0] - 'A';
-    int col = atoi(coord + 1);
+    handle_disconnect(client);
+}
+
+Client* create_client(int sock, struct sockaddr_in *address) {
+    Client *client = (Client *)malloc(sizeof(Client));
+    if (!client) return NULL;
     
-    if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Invalid coordinate\"}}\n");
-        send_message(client->sock, response);
-        return;
+    client->sock = sock;
+    client->status = PLAYER_OFFLINE;
+    strcpy(client->username, "");
+    client->sock_next = NULL;
+    client->name_next = NULL;
+    memset(client->session_token, 0, sizeof(client->session_token));
+    client->last_active = time(NULL);
+    client->address = *address;
+    client->in_game_with = 0;
+    client->session = NULL;
+    client->ready = 0;
+    client->is_turn = 0;
+    client->is_matching = 0;
+    client->match_ready = 0;
+    client->ping = 0;
+    client->jitter = 0;
+    client->rtt_samples = 0;
+    client->ping_seq = 0;
+    client->last_ping_time = 0;
+    client->protocol = PROTO_JSON;
+    client->compress = 0;
+    client->recv_offset = 0;
+    client->recv_discard = 0;
+    client->reactor = NULL;
+    client->io_ctx = NULL;
+    client->wake_fd = -1;
+    pthread_mutex_init(&client->out_mutex, NULL);
+    client->out_head = NULL;
+    client->out_tail = NULL;
+    client->out_offset = 0;
+    client->out_bytes = 0;
+    client->out_inflight = 0;
+    client->out_closed = 0;
+    client->refs = 1;
+    client->id = __atomic_add_fetch(&next_object_id, 1, __ATOMIC_RELAXED);
+    timer_init(&client->idle_timer);
+    timer_init(&client->match_timer);
+    timer_init(&client->heartbeat_timer);
+    unsigned long now_ms = monotonic_ms();
+    for (int i = 0; i < CMD_CLASS_COUNT; i++) {
+        client->buckets[i].tokens = rate_limits[i].burst * 1000L;
+        client->buckets[i].last_ms = now_ms;
     }
+    init_board(&client->board);
     
-    // Check hit or miss
-    int cell = opponent->board.grid[row][col];
-    char result[20];
-    char ship_sunk[30] = "";
+    if (server_overloaded()) {
+        printf("[ADMISSION] Rejecting socket %d: server overloaded\n", sock);
+        __atomic_add_fetch(&rejected_connections, 1, __ATOMIC_RELAXED);
+        const char *busy = "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":503,\"message\":\"Server busy\"}}\n";
+        send(sock, busy, strlen(busy), MSG_DONTWAIT | MSG_NOSIGNAL);
+        pthread_mutex_destroy(&client->out_mutex);
+        free(client);
+        return NULL;
+    }
+    if (add_client(client) < 0) {
+        printf("[CAPACITY] Rejecting socket %d: %d clients connected (max %d)\n",
+               sock, client_slots.used, max_clients);
+        const char *full = "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":503,\"message\":\"Server full\"}}\n";
+        send(sock, full, strlen(full), MSG_DONTWAIT | MSG_NOSIGNAL);
+        pthread_mutex_destroy(&client->out_mutex);
+        free(client);
+        return NULL;
+    }
+    if (idle_timeout > 0) {
+        timer_schedule(&client->idle_timer, idle_timeout * 1000, client_idle_expired, client->slot, client->id);
+    }
+    return client;
+}
+
+// Idle deadline reached: evict if nothing arrived since, else wait out the remainder.
+// last_active is only stored per message, so traffic never touches the wheel;
+// it is a relaxed atomic, as the I/O thread stores it without any lock.
+void client_idle_expired(int slot, unsigned long id) {
+    lock_counted(&clients_mutex, &clients_lock_stats);
+    Client *client = slot < client_slots.high ? client_at(slot) : NULL;
+    if (client && client->id == id) {
+        long idle = (long)(time(NULL) - __atomic_load_n(&client->last_active, __ATOMIC_RELAXED));
+        if (idle < idle_timeout) {
+            timer_schedule(&client->idle_timer, (idle_timeout - idle) * 1000, client_idle_expired, slot, id);
+        } else {
+            printf("[IDLE] %s (sock %d) silent for %lds, disconnecting\n", 
+                   client->username[0] ? client->username : "unknown", client->sock, idle);
+            // The owning thread sees EOF and runs the normal disconnect path
+            shutdown(client->sock, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Drop the client from the registry and close the socket (after handle_disconnect).
+// Threads that found it earlier may still queue to it: that output is dropped,
+// and the memory is retired once the last reference is gone.
+void release_client(Client *client) {
+    // Deliver what handle_disconnect() queued for the opponent
+    forget_pending_flush(client);
+    flush_pending_output();
+    remove_client(client);
+    timer_cancel(&client->idle_timer);
+    timer_cancel(&client->match_timer);
+    timer_cancel(&client->heartbeat_timer);
     
-    if (cell == 1) {
-        strcpy(result, "HIT");
-        opponent->board.grid[row][col] = 2; // mark as hit
-        opponent->board.hits_received++;
+    pthread_mutex_lock(&client->out_mutex);
+    client->out_closed = 1;
+    out_drop(client);
+    close(client->sock);
+    if (client->wake_fd >= 0) close(client->wake_fd);
+    client->wake_fd = -1;
+    pthread_mutex_unlock(&client->out_mutex);
+    client_put(client);
+}
+
+void *client_thread(void *arg) {
+    Client *client = (Client *)arg;
+    handle_client(client);
+    release_client(client);
+    pthread_exit(NULL);
+}
+
+void run_threaded_server(int server_fd) {
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+    
+    while (1) {
+        int new_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
+        if (new_socket < 0) {
+            perror("accept failed");
+            continue;
+        }
         
-        // Find which ship was hit and increment its hit counter
-        for (int i = 0; i < opponent->board.ship_count; i++) {
-            Ship *ship = &opponent->board.ships[i];
-            // Check if this coordinate belongs to this ship
-            for (int j = 0; j < ship->size; j++) {
-                int r = ship->start_row + (ship->is_horizontal ? 0 : j);
-                int c = ship->start_col + (ship->is_horizontal ? j : 0);
-                if (r == row && c == col) {
-                    // This is the ship that was hit
-                    ship->hits++;
-                    // Only report sunk if this hit completes the ship (prevents duplicate sunk messages)
-                    if (ship->hits == ship->size) {
-                        strcpy(ship_sunk, ship->name);
-                    }
-                    break;
-                }
-            }
-            if (ship_sunk[0] != '\0') break; // Found the ship, no need to check others
+        printf("New connection from %s:%d (socket: %d)\n", 
+               inet_ntoa(address.sin_addr), 
+               ntohs(address.sin_port),
+               new_socket);
+        
+        Client *client = create_client(new_socket, &address);
+        if (!client) {
+            close(new_socket);
+            continue;
         }
-    } else if (cell == 0) {
-        strcpy(result, "MISS");
-        opponent->board.grid[row][col] = 3; // mark as miss
-    } else {
-        strcpy(result, "ALREADY_HIT");
-    }
-    
-    // Check game end FIRST - opponent must have ships and all ships sunk
-    if (opponent->board.total_ship_cells > 0 && 
-        opponent->board.hits_received >= opponent->board.total_ship_cells) {
-        // Game is over - include final ship sunk info in GAME_END message
-        pthread_mutex_lock(&games_mutex);
-        GameSession *session = NULL;
-        for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-            if (game_sessions[i] && 
-                ((game_sessions[i]->player1_sock == client->sock && game_sessions[i]->player2_sock == opponent->sock) ||
-                 (game_sessions[i]->player2_sock == client->sock && game_sessions[i]->player1_sock == opponent->sock))) {
-                session = game_sessions[i];
-                break;
-            }
+        
+        // Other threads may already be queueing to the client: set wake_fd
+        // under out_mutex, where threaded_flush() reads it
+        int wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake_fd < 0) {
+            perror("eventfd failed");
+            release_client(client);
+            continue;
         }
-        pthread_mutex_unlock(&games_mutex);
+        pthread_mutex_lock(&client->out_mutex);
+        client->wake_fd = wake_fd;
+        pthread_mutex_unlock(&client->out_mutex);
         
-        if (session) {
-            // Send final MOVE_RESULT with game_over flag to suppress popup
-            char message[BUFFER_SIZE];
-            sprintf(message, "{\"cmd\":\"MOVE_RESULT\",\"payload\":{\"coord\":\"%s\",\"result\":\"%s\",\"ship_sunk\":\"%s\",\"is_your_shot\":true,\"game_over\":true}}\n", 
-                    coord, result, ship_sunk);
-            send_message(client->sock, message);
-            
-            sprintf(message, "{\"cmd\":\"MOVE_RESULT\",\"payload\":{\"coord\":\"%s\",\"result\":\"%s\",\"ship_sunk\":\"%s\",\"is_your_shot\":false,\"game_over\":true}}\n", 
-                    coord, result, ship_sunk);
-            send_message(opponent->sock, message);
-            
-            // Now end the game - end_game() will handle free() and cleanup
-            end_game(session, client->sock, "ALL_SHIPS_SUNK");
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, client_thread, (void *)client) != 0) {
+            perror("pthread_create failed");
+            release_client(client);
+            continue;
         }
-        return;
+        
+        pthread_detach(tid);
     }
-    
-    // Game continues - send normal MOVE_RESULT
-    char message[BUFFER_SIZE];
-    sprintf(message, "{\"cmd\":\"MOVE_RESULT\",\"payload\":{\"coord\":\"%s\",\"result\":\"%s\",\"ship_sunk\":\"%s\",\"is_your_shot\":true}}\n", 
-            coord, result, ship_sunk);
-    send_message(client->sock, message);
-    
-    sprintf(message, "{\"cmd\":\"MOVE_RESULT\",\"payload\":{\"coord\":\"%s\",\"result\":\"%s\",\"ship_sunk\":\"%s\",\"is_your_shot\":false}}\n", 
-            coord, result, ship_sunk);
-    send_message(opponent->sock, message);
-    
-    // Switch turns
-    client->is_turn = 0;
-    opponent->is_turn = 1;
-    
-    sprintf(message, "{\"cmd\":\"TURN_CHANGE\",\"payload\":{\"your_turn\":false}}\n");
-    send_message(client->sock, message);
-    
-    sprintf(message, "{\"cmd\":\"TURN_CHANGE\",\"payload\":{\"your_turn\":true}}\n");
-    send_message(opponent->sock, message);
 }
 
-void end_game(GameSession *session, int winner_sock, const char *reason) {
-    Client *winner = get_client(winner_sock);
-    Client *loser = get_client(winner_sock == session->player1_sock ? session->player2_sock : session->player1_sock);
-    
-    // Update ELO ratings and save match history
-    if (winner && loser) {
-        update_player_stats(winner->username, 10, 1);  // +10 ELO, win
-        update_player_stats(loser->username, -10, 0);  // -10 ELO, lose
+// ==================== EPOLL REACTORS ====================
+// Each reactor thread owns an epoll instance, its own SO_REUSEPORT listening
+// socket and every connection accepted on it, so the kernel spreads incoming
+// connections across reactors. Sockets are registered edge-triggered, so each
+// readiness event must drain the socket until EAGAIN. Reads use MSG_DONTWAIT
+// so the sockets themselves stay blocking; EPOLLOUT tells the owner when a
+// queue that another thread could not finish writing can move again.
+
+static void epoll_close_client(Reactor *reactor, Client *client) {
+    handle_disconnect(client);
+    epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, client->sock, NULL);
+    release_client(client);
+    __atomic_sub_fetch(&reactor->active, 1, __ATOMIC_RELAXED);
+}
+
+static void epoll_accept_clients(Reactor *reactor) {
+    while (1) {
+        struct sockaddr_in address;
+        socklen_t addrlen = sizeof(address);
+        int new_socket = accept(reactor->listen_fd, (struct sockaddr *)&address, &addrlen);
+        if (new_socket < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept failed");
+            }
+            return;
+        }
         
-        // Save match history for both players
-        save_match_history(winner->username, loser->username, "WIN");
-        save_match_history(loser->username, winner->username, "LOSE");
+        printf("New connection from %s:%d (socket: %d, reactor %d)\n", 
+               inet_ntoa(address.sin_addr), 
+               ntohs(address.sin_port),
+               new_socket, reactor->id);
         
-        printf("[ELO] %s +10, %s -10\n", winner->username, loser->username);
-    }
-    
-    if (winner) {
-        int new_elo = get_player_elo(winner->username);
-        char message[BUFFER_SIZE];
-        sprintf(message, "{\"cmd\":\"GAME_END\",\"payload\":{\"result\":\"WIN\",\"reason\":\"%s\",\"log_id\":\"%s\",\"elo\":%d}}\n", 
-                reason, session->log_id, new_elo);
-        send_message(winner->sock, message);
+        Client *client = create_client(new_socket, &address);
+        if (!client) {
+            close(new_socket);
+            continue;
+        }
         
-        // Reset winner state completely
-        winner->status = PLAYER_ONLINE;
-        winner->in_game_with = 0;
-        winner->ready = 0;
-        winner->is_turn = 0;
-        winner->is_matching = 0;
-        winner->match_ready = 0;
-        init_board(&winner->board);
+        client->reactor = reactor;
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = client;
+        if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, new_socket, &ev) < 0) {
+            perror("epoll_ctl ADD failed");
+            release_client(client);
+            continue;
+        }
+        __atomic_add_fetch(&reactor->accepted, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&reactor->active, 1, __ATOMIC_RELAXED);
         
-        printf("[END_GAME] %s wins, status set to ONLINE, ELO: %d\n", winner->username, new_elo);
+        send_welcome(client);
+        flush_pending_output();
     }
-    
-    if (loser) {
-        int new_elo = get_player_elo(loser->username);
-        char message[BUFFER_SIZE];
-        sprintf(message, "{\"cmd\":\"GAME_END\",\"payload\":{\"result\":\"LOSE\",\"reason\":\"%s\",\"log_id\":\"%s\",\"elo\":%d}}\n", 
-                reason, session->log_id, new_elo);
-        send_message(loser->sock, message);
+}
+
+// Drain the socket; returns 0 when the connection is gone
+static int epoll_read_client(Client *client) {
+    while (1) {
+        int read_size = recv(client->sock, client->recv_buffer + client->recv_offset,
+                             BUFFER_SIZE - 1 - client->recv_offset, MSG_DONTWAIT);
+        if (read_size > 0) {
+            client_process_input(client, read_size);
+            continue;
+        }
         
-        // Reset loser state completely
-        loser->status = PLAYER_ONLINE;
-        loser->in_game_with = 0;
-        loser->ready = 0;
-        loser->is_turn = 0;
-        loser->is_matching = 0;
-        loser->match_ready = 0;
-        init_board(&loser->board);
+        if (read_size == 0) {
+            printf("Client disconnected: %s (sock %d)\n", client->username, client->sock);
+            return 0;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
         
-        printf("[END_GAME] %s loses, status set to ONLINE, ELO: %d\n", loser->username, new_elo);
+        printf("Recv error from client %s (sock %d): %s\n", client->username, client->sock, strerror(errno));
+        return 0;
     }
+}
+
+void *reactor_thread(void *arg) {
+    Reactor *reactor = (Reactor *)arg;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
     
-    // Remove game session
-    pthread_mutex_lock(&games_mutex);
-    for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-        if (game_sessions[i] == session) {
-            free(game_sessions[i]);
-            game_sessions[i] = NULL;
-            printf("[END_GAME] Game session removed\n");
+    while (1) {
+        int n = epoll_wait(reactor->epfd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
             break;
         }
+        
+        for (int i = 0; i < n; i++) {
+            Client *client = (Client *)events[i].data.ptr;
+            if (client == NULL) {
+                epoll_accept_clients(reactor);
+                continue;
+            }
+            
+            // Read first so data that arrived together with the FIN is still handled
+            int alive = 1;
+            if (events[i].events & EPOLLIN) {
+                alive = epoll_read_client(client);
+            }
+            if (alive && (events[i].events & EPOLLOUT)) {
+                flush_client_output(client);
+            }
+            if (alive && (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP))) {
+                printf("Client disconnected: %s (sock %d)\n", client->username, client->sock);
+                alive = 0;
+            }
+            if (!alive) {
+                epoll_close_client(reactor, client);
+            }
+        }
     }
-    pthread_mutex_unlock(&games_mutex);
     
-    printf("Game ended: %s\n", reason);
+    return NULL;
 }
 
-// Helper function to handle game cleanup (used by both disconnect and logout)
-void cleanup_game_on_exit(Client *client, int notify_opponent) {
-    if ((client->status == PLAYER_IN_GAME || client->status == PLAYER_IN_LOBBY) && client->in_game_with > 0) {
-        Client *opponent = get_client(client->in_game_with);
+int epoll_init(int port) {
+    reactors = (Reactor *)calloc(reactor_count, sizeof(Reactor));
+    if (!reactors) {
+        perror("calloc reactors failed");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (int i = 0; i < reactor_count; i++) {
+        Reactor *reactor = &reactors[i];
+        reactor->id = i;
+        reactor->listen_fd = create_listener(port, 1);
         
-        if (opponent && notify_opponent) {
-            // Determine phase for better messaging
-            const char *phase = (client->status == PLAYER_IN_LOBBY) ? "đặt thuyền" : "chơi game";
-            
-            printf("[GAME_CLEANUP] %s left during %s - %s wins\n", 
-                   client->username, phase, opponent->username);
-            
-            // Save match history
-            save_match_history(opponent->username, client->username, "WIN");
-            save_match_history(client->username, opponent->username, "LOSE");
-            
-            // Update ELO - opponent wins
-            update_player_stats(opponent->username, 10, 1);  // Winner +10
-            update_player_stats(client->username, -10, 0);   // Loser -10
-            
-            int new_elo = get_player_elo(opponent->username);
-            
-            // Send WIN notification to opponent
-            char message[BUFFER_SIZE];
-            sprintf(message, "{\"cmd\":\"GAME_END\",\"payload\":{\"result\":\"WIN\",\"reason\":\"OPPONENT_DISCONNECTED\",\"opponent\":\"%s\",\"message\":\"Đối thủ đã ngắt kết nối. Bạn thắng!\",\"elo\":%d}}\n", 
-                    client->username, new_elo);
-            send_message(opponent->sock, message);
-            
-            // Reset opponent state to online
-            opponent->status = PLAYER_ONLINE;
-            opponent->in_game_with = 0;
-            opponent->ready = 0;
-            opponent->is_turn = 0;
-            opponent->is_matching = 0;
-            opponent->match_ready = 0;
-            init_board(&opponent->board);
+        int flags = fcntl(reactor->listen_fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(reactor->listen_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            perror("fcntl O_NONBLOCK failed");
+            exit(EXIT_FAILURE);
         }
         
-        // Remove game session
-        pthread_mutex_lock(&games_mutex);
-        for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-            if (game_sessions[i] && 
-                (game_sessions[i]->player1_sock == client->sock || 
-                 game_sessions[i]->player2_sock == client->sock)) {
-                free(game_sessions[i]);
-                game_sessions[i] = NULL;
-                printf("[GAME_CLEANUP] Game session removed\n");
-                break;
-            }
+        reactor->epfd = epoll_create1(0);
+        if (reactor->epfd < 0) {
+            perror("epoll_create1 failed");
+            exit(EXIT_FAILURE);
+        }
+        
+        // Listening socket is tagged with a NULL pointer
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->listen_fd, &ev) < 0) {
+            perror("epoll_ctl ADD listener failed");
+            exit(EXIT_FAILURE);
         }
-        pthread_mutex_unlock(&games_mutex);
     }
+    return 0;
 }
 
-void handle_disconnect(Client *client) {
-    printf("[DISCONNECT] %s disconnected (sock %d, status %d)\n", 
-           client->username, client->sock, client->status);
-    
-    // Cleanup game with opponent notification
-    cleanup_game_on_exit(client, 1);
-    
-    // Mark client as offline (DON'T invalidate socket here - thread will close it)
-    client->status = PLAYER_OFFLINE;
+void epoll_run() {
+    run_io_threads(reactor_thread);
 }
 
-void handle_surrender(Client *client) {
-    printf("[SURRENDER] %s wants to surrender\n", client->username);
-    if (client->status != PLAYER_IN_GAME || client->in_game_with == 0) {
-        char message[BUFFER_SIZE];
-        sprintf(message, "{\"cmd\":\"ERROR\",\"payload\":{\"message\":\"Not in a game\"}}\n");
-        send_message(client->sock, message);
-        return;
-    }
-
-    Client *opponent = get_client(client->in_game_with);
-    if (!opponent) {
-        printf("[SURRENDER] No opponent found\n");
-        return;
-    }
-    printf("[SURRENDER] Ending game, opponent %s wins\n", opponent->username);
+// ==================== IO_URING BACKEND ====================
+// Talks to the kernel through the raw syscalls (no liburing dependency).
+// Each ring thread owns a SO_REUSEPORT listener with a multishot accept,
+// receives into a ring of provided buffers, and turns each connection's
+// outbound queue into one IORING_OP_SENDMSG SQE (an iovec per queued message)
+// that goes out with the next io_uring_enter(). Only the owning ring submits
+// sends; other threads hand the connection over through the ring's remote
+// list and wake it with an eventfd.
 
-    // Find game session
-    GameSession *session = NULL;
-    pthread_mutex_lock(&games_mutex);
-    for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-        if (game_sessions[i] && 
-            (game_sessions[i]->player1_sock == client->sock || game_sessions[i]->player2_sock == client->sock)) {
-            session = game_sessions[i];
-            break;
-        }
-    }
-    pthread_mutex_unlock(&games_mutex);
+#define URING_OP_ACCEPT 0
+#define URING_OP_RECV 1
+#define URING_OP_SEND 2
+#define URING_OP_WAKE 3
+#define URING_OP_MASK 3
 
-    if (session) {
-        end_game(session, opponent->sock, "SURRENDER");
-    }
-}
+typedef struct UringConn UringConn;
+struct UringConn {
+    Client *client;
+    Reactor *reactor;
+    struct msghdr msg;      // owned by the kernel while client->out_inflight
+    struct iovec iov[OUTQ_MAX_IOV];
+    int dirty;              // in ring->dirty_head list
+    int remote;             // in ring->remote_head list (guarded by remote_mutex)
+    int closing;            // recv finished, close once sends are done
+    int released;           // client released, no more flushes (guarded by remote_mutex)
+    UringConn *next_dirty;
+    UringConn *next_remote;
+    EpochNode retire;       // other threads may still reach it through client->io_ctx
+};
 
-void handle_draw_offer(Client *client) {
-    printf("[DRAW_OFFER] %s offers draw\n", client->username);
-    if (client->status != PLAYER_IN_GAME || client->in_game_with == 0) {
-        char message[BUFFER_SIZE];
-        sprintf(message, "{\"cmd\":\"ERROR\",\"payload\":{\"message\":\"Not in a game\"}}\n");
-        send_message(client->sock, message);
-        return;
-    }
+struct UringRing {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;      // local tail, published on submit
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buf_base;
+    UringConn *dirty_head;  // connections with output to submit (ring thread only)
+    int wake_fd;            // eventfd other threads poke after queueing output
+    unsigned long long wake_value;
+    pthread_mutex_t remote_mutex;
+    UringConn *remote_head; // connections flushed from other threads
+};
 
-    Client *opponent = get_client(client->in_game_with);
-    if (!opponent) {
-        printf("[DRAW_OFFER] No opponent found\n");
-        return;
-    }
+static __thread Reactor *current_reactor = NULL;
 
-    // Send draw offer to opponent
-    char message[BUFFER_SIZE];
-    sprintf(message, "{\"cmd\":\"DRAW_OFFER\",\"payload\":{\"from\":\"%s\"}}\n", client->username);
-    printf("[DRAW_OFFER] Sending to %s (sock %d): %s", opponent->username, opponent->sock, message);
-    send_message(opponent->sock, message);
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
 }
 
-void handle_draw_reply(Client *client, const char *status) {
-    printf("[DRAW_REPLY] %s replies: %s\n", client->username, status);
-    if (client->status != PLAYER_IN_GAME || client->in_game_with == 0) {
-        return;
-    }
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
 
-    Client *opponent = get_client(client->in_game_with);
-    if (!opponent) {
-        printf("[DRAW_REPLY] No opponent found\n");
-        return;
-    }
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
 
-    if (strcmp(status, "accept") == 0) {
-        printf("[DRAW_REPLY] Draw accepted, ending game\n");
-        // Find game session and end as draw
-        GameSession *session = NULL;
-        pthread_mutex_lock(&games_mutex);
-        for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-            if (game_sessions[i] && 
-                (game_sessions[i]->player1_sock == client->sock || game_sessions[i]->player2_sock == client->sock)) {
-                session = game_sessions[i];
-                break;
-            }
-        }
-        pthread_mutex_unlock(&games_mutex);
+static void uring_queue_exit(UringRing *ring) {
+    if (ring->buf_ring) munmap(ring->buf_ring, ring->buf_ring_size);
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr) munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->fd >= 0) close(ring->fd);
+    if (ring->wake_fd >= 0) close(ring->wake_fd);
+    free(ring->buf_base);
+    free(ring);
+}
 
-        if (session) {
-            // Save match history for both players as DRAW
-            save_match_history(client->username, opponent->username, "DRAW");
-            save_match_history(opponent->username, client->username, "DRAW");
-            
-            // No ELO change for draw
-            int client_elo = get_player_elo(client->username);
-            int opponent_elo = get_player_elo(opponent->username);
-            
-            // Send DRAW to both players with current ELO
-            char message[BUFFER_SIZE];
-            sprintf(message, "{\"cmd\":\"GAME_END\",\"payload\":{\"result\":\"DRAW\",\"reason\":\"DRAW_ACCEPTED\",\"log_id\":\"\",\"elo\":%d}}\n", client_elo);
-            send_message(client->sock, message);
-            sprintf(message, "{\"cmd\":\"GAME_END\",\"payload\":{\"result\":\"DRAW\",\"reason\":\"DRAW_ACCEPTED\",\"log_id\":\"\",\"elo\":%d}}\n", opponent_elo);
-            send_message(opponent->sock, message);
-
-            client->status = PLAYER_ONLINE;
-            client->in_game_with = 0;
-            opponent->status = PLAYER_ONLINE;
-            opponent->in_game_with = 0;
-
-            pthread_mutex_lock(&games_mutex);
-            for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-                if (game_sessions[i] == session) {
-                    free(game_sessions[i]);
-                    game_sessions[i] = NULL;
-                    break;
-                }
-            }
-            pthread_mutex_unlock(&games_mutex);
-        }
-    } else {
-        // Reject - notify opponent
-        char message[BUFFER_SIZE];
-        sprintf(message, "{\"cmd\":\"DRAW_REJECTED\",\"payload\":{}}\n");
-        send_message(opponent->sock, message);
-    }
+static void uring_recycle_buffer(UringRing *ring, unsigned short bid) {
+    // Index the entries by hand: in C++ the header's flex-array wrapper shifts bufs[] by 8 bytes
+    struct io_uring_buf *bufs = (struct io_uring_buf *)ring->buf_ring;
+    unsigned short tail = ring->buf_ring->tail;
+    struct io_uring_buf *buf = &bufs[tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (unsigned long)(ring->buf_base + (size_t)bid * BUFFER_SIZE);
+    buf->len = BUFFER_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
 }
 
-// Matching functions
-void handle_start_matching(Client *client) {
-    if (client->status != PLAYER_ONLINE) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Cannot start matching\"}}\n");
-        send_message(client->sock, response);
-        return;
+// Returns NULL with errno set when the kernel lacks what we need
+static UringRing *uring_queue_init(unsigned entries) {
+    UringRing *ring = (UringRing *)calloc(1, sizeof(UringRing));
+    if (!ring) return NULL;
+    ring->wake_fd = -1;
+    
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
     }
     
-    client->is_matching = 1;
-    client->status = PLAYER_IN_LOBBY;
+    // Multishot accept and provided buffer rings need the same kernel (5.19+)
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probe_size);
+    int supported = probe && sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    int needed_ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_READ };
+    for (int i = 0; supported && i < 4; i++) {
+        supported = needed_ops[i] < probe->ops_len &&
+                    (probe->ops[needed_ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (!supported) {
+        uring_queue_exit(ring);
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
     
-    char response[BUFFER_SIZE];
-    sprintf(response, "{\"cmd\":\"MATCHING_STARTED\",\"payload\":{\"message\":\"Đang tìm đối thủ...\"}}\n");
-    send_message(client->sock, response);
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
     
-    printf("[MATCHING] %s started matching (ELO: %d)\n", client->username, get_player_elo(client->username));
+    void *sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        uring_queue_exit(ring);
+        return NULL;
+    }
+    ring->sq_ptr = sq_ptr;
     
-    // Try to match immediately
-    try_match_players();
-}
-
-void handle_cancel_matching(Client *client) {
-    if (!client->is_matching) {
-        return;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = sq_ptr;
+    } else {
+        void *cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            uring_queue_exit(ring);
+            return NULL;
+        }
+        ring->cq_ptr = cq_ptr;
     }
     
-    client->is_matching = 0;
-    client->status = PLAYER_ONLINE;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        uring_queue_exit(ring);
+        return NULL;
+    }
+    ring->sqes = (struct io_uring_sqe *)sqes;
     
-    char response[BUFFER_SIZE];
-    sprintf(response, "{\"cmd\":\"MATCHING_CANCELLED\",\"payload\":{\"message\":\"Đã hủy tìm trận\"}}\n");
-    send_message(client->sock, response);
+    char *sq = (char *)ring->sq_ptr;
+    char *cq = (char *)ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    unsigned *sq_array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        sq_array[i] = i; // SQE index == SQ slot, set once
+    }
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
     
-    printf("[MATCHING] %s cancelled matching\n", client->username);
-}
-
-void try_match_players() {
-    pthread_mutex_lock(&clients_mutex);
+    // Provided buffer ring for recv
+    ring->buf_ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    void *buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) {
+        uring_queue_exit(ring);
+        return NULL;
+    }
+    ring->buf_ring = (struct io_uring_buf_ring *)buf_ring;
     
-    // Find all players in matching queue
-    Client *matching_players[MAX_CLIENTS];
-    int matching_count = 0;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uring_queue_exit(ring);
+        return NULL;
+    }
     
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] != NULL && clients[i]->is_matching) {
-            matching_players[matching_count++] = clients[i];
-        }
+    ring->buf_base = (char *)malloc((size_t)URING_BUF_COUNT * BUFFER_SIZE);
+    if (!ring->buf_base) {
+        uring_queue_exit(ring);
+        return NULL;
+    }
+    for (int i = 0; i < URING_BUF_COUNT; i++) {
+        uring_recycle_buffer(ring, (unsigned short)i);
     }
     
-    // Try to match players with similar ELO (±100)
-    for (int i = 0; i < matching_count - 1; i++) {
-        if (!matching_players[i]->is_matching) continue; // Already matched
-        
-        int player1_elo = get_player_elo(matching_players[i]->username);
-        
-        for (int j = i + 1; j < matching_count; j++) {
-            if (!matching_players[j]->is_matching) continue;
-            
-            int player2_elo = get_player_elo(matching_players[j]->username);
-            int elo_diff = abs(player1_elo - player2_elo);
-            
-            if (elo_diff <= 100) {
-                // Match found!
-                Client *p1 = matching_players[i];
-                Client *p2 = matching_players[j];
-                
-                p1->is_matching = 0;
-                p2->is_matching = 0;
-                p1->match_ready = 0;
-                p2->match_ready = 0;
-                p1->in_game_with = p2->sock;
-                p2->in_game_with = p1->sock;
-                p1->status = PLAYER_IN_LOBBY;
-                p2->status = PLAYER_IN_LOBBY;
-                
-                printf("[MATCHING] Matched %s (ELO: %d) with %s (ELO: %d)\n",
-                       p1->username, player1_elo, p2->username, player2_elo);
-                
-                // Send match found notification
-                char message[BUFFER_SIZE];
-                sprintf(message, "{\"cmd\":\"MATCH_FOUND\",\"payload\":{\"opponent\":\"%s\",\"elo\":%d}}\n", 
-                        p2->username, player2_elo);
-                send_message(p1->sock, message);
-                
-                sprintf(message, "{\"cmd\":\"MATCH_FOUND\",\"payload\":{\"opponent\":\"%s\",\"elo\":%d}}\n", 
-                        p1->username, player1_elo);
-                send_message(p2->sock, message);
-                
-                break;
-            }
-        }
+    ring->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (ring->wake_fd < 0) {
+        uring_queue_exit(ring);
+        return NULL;
     }
+    pthread_mutex_init(&ring->remote_mutex, NULL);
     
-    pthread_mutex_unlock(&clients_mutex);
+    return ring;
+}
+
+static int uring_submit(Reactor *reactor, unsigned wait_nr) {
+    UringRing *ring = reactor->uring;
+    // Count from the kernel's head so SQEs left over by an interrupted enter are resubmitted
+    unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    
+    int ret;
+    do {
+        ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR && wait_nr == 0);
+    
+    __atomic_add_fetch(&reactor->enters, 1, __ATOMIC_RELAXED);
+    if (ret > 0) __atomic_add_fetch(&reactor->sqes, ret, __ATOMIC_RELAXED);
+    return ret;
+}
+
+static struct io_uring_sqe *uring_get_sqe(Reactor *reactor) {
+    UringRing *ring = reactor->uring;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        // SQ full: push what we have to the kernel and retry
+        uring_submit(reactor, 0);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sqe_tail - head >= ring->sq_entries) return NULL;
+    }
+    
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void uring_arm_accept(Reactor *reactor) {
+    struct io_uring_sqe *sqe = uring_get_sqe(reactor);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = reactor->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_OP_ACCEPT;
+}
+
+// Returns 0 if the SQ stayed full even after a submit
+static int uring_arm_recv(UringConn *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(conn->reactor);
+    if (!sqe) return 0;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->client->sock;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->len = BUFFER_SIZE;
+    sqe->user_data = (unsigned long)conn | URING_OP_RECV;
+    return 1;
+}
+
+static void uring_arm_wake(Reactor *reactor) {
+    struct io_uring_sqe *sqe = uring_get_sqe(reactor);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = reactor->uring->wake_fd;
+    sqe->addr = (unsigned long)&reactor->uring->wake_value;
+    sqe->len = sizeof(reactor->uring->wake_value);
+    sqe->user_data = URING_OP_WAKE;
 }
 
-void handle_match_ready(Client *client) {
-    if (client->in_game_with == 0) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"No match found\"}}\n");
-        send_message(client->sock, response);
+// Hand the whole queue to the kernel if no SENDMSG is in flight for this connection
+static void uring_start_send(UringConn *conn) {
+    Client *client = conn->client;
+    if (client->out_inflight) return;
+    
+    pthread_mutex_lock(&client->out_mutex);
+    if (!client->out_head) {
+        pthread_mutex_unlock(&client->out_mutex);
         return;
     }
-    
-    client->match_ready = 1;
-    
-    Client *opponent = get_client(client->in_game_with);
-    if (!opponent) {
+    struct io_uring_sqe *sqe = uring_get_sqe(conn->reactor);
+    if (!sqe) {
+        pthread_mutex_unlock(&client->out_mutex);
         return;
     }
+    memset(&conn->msg, 0, sizeof(conn->msg));
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = out_fill_iovec(client, conn->iov, OUTQ_MAX_IOV);
+    client->out_inflight = 1;
+    pthread_mutex_unlock(&client->out_mutex);
     
-    // Notify opponent that this player is ready
-    char message[BUFFER_SIZE];
-    sprintf(message, "{\"cmd\":\"OPPONENT_READY\",\"payload\":{\"username\":\"%s\"}}\n", client->username);
-    send_message(opponent->sock, message);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = client->sock;
+    sqe->addr = (unsigned long)&conn->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long)conn | URING_OP_SEND;
+    __atomic_add_fetch(&out_writes, 1, __ATOMIC_RELAXED);
+}
+
+static void uring_conn_free(EpochNode *node) {
+    free(container_of(node, UringConn, retire));
+}
+
+static void uring_finish_close(UringConn *conn) {
+    if (!conn->closing || conn->client->out_inflight || conn->dirty) return;
     
-    // Check if both players are ready
-    if (opponent->match_ready) {
-        printf("[MATCH_READY] Both players ready, starting game: %s vs %s\n", 
-               client->username, opponent->username);
-        
-        // Reset match_ready flags
-        client->match_ready = 0;
-        opponent->match_ready = 0;
-        
-        // Start the game
-        start_game(client, opponent);
-    } else {
-        sprintf(message, "{\"cmd\":\"WAITING_OPPONENT\",\"payload\":{\"message\":\"Đang chờ đối thủ sẵn sàng...\"}}\n");
-        send_message(client->sock, message);
+    Reactor *reactor = conn->reactor;
+    UringRing *ring = reactor->uring;
+    pthread_mutex_lock(&ring->remote_mutex);
+    if (conn->remote) {
+        UringConn **link = &ring->remote_head;
+        while (*link != conn) link = &(*link)->next_remote;
+        *link = conn->next_remote;
+        conn->remote = 0;
     }
+    conn->released = 1;
+    pthread_mutex_unlock(&ring->remote_mutex);
+    
+    release_client(conn->client);
+    epoch_retire(&conn->retire, uring_conn_free);
+    __atomic_sub_fetch(&reactor->active, 1, __ATOMIC_RELAXED);
 }
 
-void handle_match_decline(Client *client) {
-    if (client->in_game_with == 0) {
-        return;
+static void uring_mark_dirty(UringConn *conn) {
+    if (conn->dirty) return;
+    UringRing *ring = conn->reactor->uring;
+    conn->dirty = 1;
+    conn->next_dirty = ring->dirty_head;
+    ring->dirty_head = conn;
+}
+
+static void uring_flush_dirty(UringRing *ring) {
+    while (ring->dirty_head) {
+        UringConn *conn = ring->dirty_head;
+        ring->dirty_head = conn->next_dirty;
+        conn->next_dirty = NULL;
+        conn->dirty = 0;
+        uring_start_send(conn);
+        uring_finish_close(conn);
     }
+}
+
+// IoBackend flush: defer to the owning ring's next submit
+void uring_flush(Client *client) {
+    UringConn *conn = (UringConn *)client->io_ctx;
+    if (!conn) return;
     
-    printf("[MATCH_DECLINE] %s declined match\n", client->username);
-    
-    Client *opponent = get_client(client->in_game_with);
-    if (opponent) {
-        // Notify opponent
-        char message[BUFFER_SIZE];
-        sprintf(message, "{\"cmd\":\"MATCH_DECLINED\",\"payload\":{\"message\":\"Đối thủ đã từ chối trận đấu\"}}\n");
-        send_message(opponent->sock, message);
-        
-        // Reset opponent state
-        opponent->in_game_with = 0;
-        opponent->match_ready = 0;
-        opponent->is_matching = 0;
-        opponent->status = PLAYER_ONLINE;
+    if (current_reactor == conn->reactor) {
+        if (!conn->released) uring_mark_dirty(conn);
+        return;
     }
     
-    // Send confirmation to the person who declined
-    char response[BUFFER_SIZE];
-    sprintf(response, "{\"cmd\":\"MATCH_DECLINED\",\"payload\":{\"message\":\"Bạn đã từ chối trận đấu\"}}\n");
-    send_message(client->sock, response);
+    UringRing *ring = conn->reactor->uring;
+    int wake = 0;
+    pthread_mutex_lock(&ring->remote_mutex);
+    if (!conn->remote && !conn->released) {
+        conn->remote = 1;
+        conn->next_remote = ring->remote_head;
+        wake = ring->remote_head == NULL;
+        ring->remote_head = conn;
+    }
+    pthread_mutex_unlock(&ring->remote_mutex);
     
-    // Reset this player's state
-    client->in_game_with = 0;
-    client->match_ready = 0;
-    client->is_matching = 0;
-    client->status = PLAYER_ONLINE;
+    if (wake) {
+        unsigned long long one = 1;
+        if (write(ring->wake_fd, &one, sizeof(one)) < 0) {
+            perror("eventfd write failed");
+        }
+    }
 }
 
-void handle_leaderboard(Client *client) {
-    FILE *fp = fopen("users.dat", "r");
-    if (!fp) {
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"LEADERBOARD\",\"payload\":{\"players\":[]}}\n");
-        send_message(client->sock, response);
+// Recv side is done: disconnect now, free once the last SENDMSG completes
+static void uring_close_conn(UringConn *conn) {
+    handle_disconnect(conn->client);
+    flush_pending_output();
+    conn->closing = 1;
+    uring_finish_close(conn);
+}
+
+static void uring_keep_reading(UringConn *conn) {
+    if (uring_arm_recv(conn)) return;
+    // Without a RECV in flight the connection would never be read again
+    printf("[IO_URING] Submission queue full, closing sock %d\n", conn->client->sock);
+    uring_close_conn(conn);
+}
+
+static void uring_handle_accept(Reactor *reactor, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept(reactor); // multishot terminated, re-arm
+    }
+    if (cqe->res < 0) {
+        printf("accept failed: %s\n", strerror(-cqe->res));
         return;
     }
     
-    // Read all players
-    PlayerAccount players[MAX_CLIENTS];
-    int player_count = 0;
+    int new_socket = cqe->res;
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    getpeername(new_socket, (struct sockaddr *)&address, &addrlen);
     
-    char line[256];
-    while (fgets(line, sizeof(line), fp) && player_count < MAX_CLIENTS) {
-        sscanf(line, "%[^:]:%[^:]:%d:%d:%d", 
-               players[player_count].username, 
-               players[player_count].password,
-               &players[player_count].elo,
-               &players[player_count].games_played,
-               &players[player_count].games_won);
-        player_count++;
-    }
-    fclose(fp);
+    printf("New connection from %s:%d (socket: %d, ring %d)\n", 
+           inet_ntoa(address.sin_addr), 
+           ntohs(address.sin_port),
+           new_socket, reactor->id);
     
-    // Sort by ELO (descending)
-    for (int i = 0; i < player_count - 1; i++) {
-        for (int j = i + 1; j < player_count; j++) {
-            if (players[j].elo > players[i].elo) {
-                PlayerAccount temp = players[i];
-                players[i] = players[j];
-                players[j] = temp;
-            }
-        }
+    UringConn *conn = (UringConn *)calloc(1, sizeof(UringConn));
+    Client *client = conn ? create_client(new_socket, &address) : NULL;
+    if (!client) {
+        free(conn);
+        close(new_socket);
+        return;
     }
+    conn->client = client;
+    conn->reactor = reactor;
+    client->reactor = reactor;
+    client->io_ctx = conn;
+    __atomic_add_fetch(&reactor->accepted, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&reactor->active, 1, __ATOMIC_RELAXED);
     
-    // Build JSON response
-    char response[BUFFER_SIZE * 2];
-    char players_json[BUFFER_SIZE * 2] = "[";
+    send_welcome(client);
+    flush_pending_output();
+    uring_keep_reading(conn);
+}
+
+static void uring_handle_recv(UringConn *conn, struct io_uring_cqe *cqe) {
+    UringRing *ring = conn->reactor->uring;
+    Client *client = conn->client;
     
-    for (int i = 0; i < player_count && i < 50; i++) { // Top 50
-        char player_entry[256];
-        double winrate = players[i].games_played > 0 
-            ? (players[i].games_won * 100.0 / players[i].games_played) 
-            : 0.0;
-        
-        sprintf(player_entry, "%s{\"rank\":%d,\"username\":\"%s\",\"elo\":%d,\"games\":%d,\"wins\":%d,\"winrate\":%.1f}",
-                i > 0 ? "," : "",
-                i + 1,
-                players[i].username,
-                players[i].elo,
-                players[i].games_played,
-                players[i].games_won,
-                winrate);
-        strcat(players_json, player_entry);
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        client_feed_input(client, ring->buf_base + (size_t)bid * BUFFER_SIZE, cqe->res);
+        uring_recycle_buffer(ring, bid);
+        uring_keep_reading(conn);
+        return;
     }
-    strcat(players_json, "]");
     
-    sprintf(response, "{\"cmd\":\"LEADERBOARD\",\"payload\":{\"players\":%s}}\n", players_json);
-    send_message(client->sock, response);
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        uring_recycle_buffer(ring, (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+    if (cqe->res == -ENOBUFS || cqe->res == -EINTR) {
+        uring_keep_reading(conn); // every provided buffer is busy, retry
+        return;
+    }
     
-    printf("[LEADERBOARD] Sent top %d players to %s\n", player_count < 50 ? player_count : 50, client->username);
+    if (cqe->res == 0) {
+        printf("Client disconnected: %s (sock %d)\n", client->username, client->sock);
+    } else {
+        printf("Recv error from client %s (sock %d): %s\n", client->username, client->sock, strerror(-cqe->res));
+    }
+    uring_close_conn(conn);
 }
 
-void handle_logout(Client *client) {
-    time_t now = time(NULL);
-    printf("[LOGOUT] User: %s\n", client->username);
-    printf("[LOGOUT] Socket: %d\n", client->sock);
-    printf("[LOGOUT] Status: %d\n", client->status);
-    printf("[LOGOUT] Time: %s", ctime(&now));
+static void uring_handle_send(UringConn *conn, struct io_uring_cqe *cqe) {
+    Client *client = conn->client;
     
-    // If in game or lobby, cleanup game (notify opponent)
-    if ((client->status == PLAYER_IN_GAME || client->status == PLAYER_IN_LOBBY) && client->in_game_with > 0) {
-        printf("[LOGOUT] %s is in game - cleaning up game\n", client->username);
-        cleanup_game_on_exit(client, 1);
+    pthread_mutex_lock(&client->out_mutex);
+    client->out_inflight = 0;
+    if (cqe->res < 0) {
+        printf("Send failed to socket %d: %s\n", client->sock, strerror(-cqe->res));
+        client->out_closed = 1;
+    } else {
+        out_consume(client, (size_t)cqe->res);
     }
+    if (client->out_closed) {
+        out_drop(client); // send error or backpressure hit while the SQE was in flight
+    }
+    pthread_mutex_unlock(&client->out_mutex);
     
-    // Clear session and reset state
-    memset(client->session_token, 0, sizeof(client->session_token));
-    client->status = PLAYER_OFFLINE;
-    client->in_game_with = 0;
-    client->ready = 0;
-    client->is_turn = 0;
-    client->is_matching = 0;
-    client->match_ready = 0;
-    init_board(&client->board);
-    
-    char response[BUFFER_SIZE];
-    sprintf(response, "{\"cmd\":\"LOGOUT_SUCCESS\",\"payload\":{\"message\":\"Logged out successfully\"}}\n");
-    send_message(client->sock, response);
-    
-    printf("[LOGOUT] %s logout completed\n", client->username);
+    // Short send or messages queued meanwhile: keep going
+    uring_start_send(conn);
+    uring_finish_close(conn);
 }
 
-void handle_command(Client *client, const char *cmd, const char *payload) {
-    if (strcmp(cmd, "REGISTER") == 0) {
-        char username[USERNAME_SIZE], password[PASSWORD_SIZE];
-        sscanf(payload, "{\"username\":\"%[^\"]\",\"password\":\"%[^\"]\"}", username, password);
-        
-        if (register_user(username, password)) {
-            char response[BUFFER_SIZE];
-            sprintf(response, "{\"cmd\":\"REGISTER_SUCCESS\",\"payload\":{\"message\":\"Registration successful\"}}\n");
-            send_message(client->sock, response);
-        } else {
-            char response[BUFFER_SIZE];
-            sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":400,\"message\":\"Username already exists\"}}\n");
-            send_message(client->sock, response);
-        }
+static void uring_handle_wake(Reactor *reactor) {
+    UringRing *ring = reactor->uring;
+    pthread_mutex_lock(&ring->remote_mutex);
+    UringConn *conn = ring->remote_head;
+    ring->remote_head = NULL;
+    while (conn) {
+        UringConn *next = conn->next_remote;
+        conn->remote = 0;
+        conn->next_remote = NULL;
+        uring_mark_dirty(conn);
+        conn = next;
     }
-    else if (strcmp(cmd, "LOGIN") == 0) {
-        char username[USERNAME_SIZE], password[PASSWORD_SIZE];
-        sscanf(payload, "{\"username\":\"%[^\"]\",\"password\":\"%[^\"]\"}", username, password);
+    pthread_mutex_unlock(&ring->remote_mutex);
+    uring_arm_wake(reactor);
+}
+
+void *uring_thread(void *arg) {
+    Reactor *reactor = (Reactor *)arg;
+    UringRing *ring = reactor->uring;
+    current_reactor = reactor;
+    
+    uring_arm_accept(reactor);
+    uring_arm_wake(reactor);
+    
+    while (1) {
+        // Everything queued during the last batch goes out with this one syscall
+        uring_flush_dirty(ring);
+        if (uring_submit(reactor, 1) < 0 && errno != EINTR) {
+            perror("io_uring_enter failed");
+            break;
+        }
         
-        if (authenticate_user(username, password)) {
-            strncpy(client->username, username, USERNAME_SIZE - 1);
-            client->status = PLAYER_ONLINE;
-            client->last_active = time(NULL);
-            generate_session_token(client->session_token);
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            unsigned long data = cqe->user_data;
+            UringConn *conn = (UringConn *)(data & ~(unsigned long)URING_OP_MASK);
             
-            int elo = get_player_elo(username);
-            char response[BUFFER_SIZE];
-            sprintf(response, "{\"cmd\":\"LOGIN_SUCCESS\",\"payload\":{\"username\":\"%s\",\"message\":\"Welcome!\",\"elo\":%d,\"sessionToken\":\"%s\"}}\n", 
-                    username, elo, client->session_token);
-            send_message(client->sock, response);
+            switch (data & URING_OP_MASK) {
+                case URING_OP_ACCEPT: uring_handle_accept(reactor, cqe); break;
+                case URING_OP_RECV: uring_handle_recv(conn, cqe); break;
+                case URING_OP_SEND: uring_handle_send(conn, cqe); break;
+                case URING_OP_WAKE: uring_handle_wake(reactor); break;
+            }
             
-            printf("User logged in: %s (socket %d, ELO: %d, token: %s)\n", username, client->sock, elo, client->session_token);
-        } else {
-            char response[BUFFER_SIZE];
-            sprintf(response, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"code\":401,\"message\":\"Invalid credentials\"}}\n");
-            send_message(client->sock, response);
-        }
-    }
-    else if (strcmp(cmd, "PLAYER_LIST") == 0) {
-        send_player_list(client->sock);
-    }
-    else if (strcmp(cmd, "MATCH_HISTORY") == 0) {
-        send_match_history(client->sock, client->username);
-    }
-    else if (strcmp(cmd, "CHALLENGE") == 0) {
-        char target[USERNAME_SIZE];
-        sscanf(payload, "{\"target_username\":\"%[^\"]\"}", target);
-        handle_challenge(client, target);
-    }
-    else if (strcmp(cmd, "CHALLENGE_REPLY") == 0) {
-        char challenger[USERNAME_SIZE], status[20];
-        sscanf(payload, "{\"challenger_username\":\"%[^\"]\",\"status\":\"%[^\"]\"}", challenger, status);
-        handle_challenge_reply(client, challenger, status);
-    }
-    else if (strcmp(cmd, "PLACE_SHIPS") == 0) {
-        // Extract ships array from payload: {"ships":[...]}
-        const char *ships_start = strstr(payload, "\"ships\":");
-        if (ships_start) {
-            ships_start += 8; // skip "ships":
-            while (*ships_start == ' ') ships_start++; // skip whitespace
-            handle_place_ships(client, ships_start);
+            head++;
+            if (head == tail) {
+                __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+                tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+            }
         }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
     }
-    else if (strcmp(cmd, "MOVE") == 0) {
-        char coord[10];
-        sscanf(payload, "{\"coord\":\"%[^\"]\"}", coord);
-        handle_move(client, coord);
+    
+    return NULL;
+}
+
+int uring_init(int port) {
+    reactors = (Reactor *)calloc(reactor_count, sizeof(Reactor));
+    if (!reactors) {
+        perror("calloc reactors failed");
+        exit(EXIT_FAILURE);
     }
-    else if (strcmp(cmd, "CHAT") == 0) {
-        char message[BUFFER_SIZE];
-        sscanf(payload, "{\"message\":\"%[^\"]\"}", message);
-        
-        printf("[CHAT] From: %s, Message: %s\n", client->username, message);
-        
-        Client *opponent = get_client(client->in_game_with);
-        if (opponent) {
-            printf("[CHAT] Sending to opponent: %s (sock %d)\n", opponent->username, opponent->sock);
-            char response[BUFFER_SIZE];
-            sprintf(response, "{\"cmd\":\"CHAT\",\"payload\":{\"from\":\"%s\",\"message\":\"%s\"}}\n", 
-                    client->username, message);
-            send_message(opponent->sock, response);
-        } else {
-            printf("[CHAT] No opponent found for %s\n", client->username);
+    
+    for (int i = 0; i < reactor_count; i++) {
+        reactors[i].id = i;
+        reactors[i].uring = uring_queue_init(URING_ENTRIES);
+        if (!reactors[i].uring) {
+            printf("[IO_URING] Not available: %s\n", strerror(errno));
+            for (int j = 0; j < i; j++) {
+                uring_queue_exit(reactors[j].uring);
+            }
+            free(reactors);
+            reactors = NULL;
+            return -1;
         }
     }
-    else if (strcmp(cmd, "SURRENDER") == 0) {
-        handle_surrender(client);
-    }
-    else if (strcmp(cmd, "DRAW_OFFER") == 0) {
-        handle_draw_offer(client);
-    }
-    else if (strcmp(cmd, "DRAW_REPLY") == 0) {
-        char status[20];
-        sscanf(payload, "{\"status\":\"%[^\"]\"}", status);
-        handle_draw_reply(client, status);
-    }
-    else if (strcmp(cmd, "START_MATCHING") == 0) {
-        handle_start_matching(client);
-    }
-    else if (strcmp(cmd, "CANCEL_MATCHING") == 0) {
-        handle_cancel_matching(client);
-    }
-    else if (strcmp(cmd, "MATCH_READY") == 0) {
-        handle_match_ready(client);
-    }
-    else if (strcmp(cmd, "MATCH_DECLINE") == 0) {
-        handle_match_decline(client);
-    }
-    else if (strcmp(cmd, "LEADERBOARD") == 0) {
-        handle_leaderboard(client);
+    
+    for (int i = 0; i < reactor_count; i++) {
+        reactors[i].listen_fd = create_listener(port, 1);
     }
-    else if (strcmp(cmd, "LOGOUT") == 0) {
-        handle_logout(client);
+    return 0;
+}
+
+void uring_run() {
+    run_io_threads(uring_thread);
+}
+
+// ==================== THREADED BACKEND ====================
+
+static int threaded_listen_fd = -1;
+
+int threaded_init(int port) {
+    threaded_listen_fd = create_listener(port, 0);
+    return 0;
+}
+
+// The accept loop owns the main thread, so the statistics get their own
+void *stats_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        sleep(STATS_INTERVAL);
+        print_server_stats();
     }
-    else if (strcmp(cmd, "PING") == 0) {
-        // Respond with PONG immediately
-        char response[BUFFER_SIZE];
-        sprintf(response, "{\"cmd\":\"PONG\",\"payload\":{\"timestamp\":%ld}}\n", time(NULL));
-        send_message(client->sock, response);
+    return NULL;
+}
+
+void threaded_run() {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, stats_thread, NULL) != 0) {
+        perror("pthread_create stats failed");
+        exit(EXIT_FAILURE);
     }
-    else if (strcmp(cmd, "UPDATE_PING") == 0) {
-        // Client sends its calculated ping
-        int ping_value = 0;
-        sscanf(payload, "{\"ping\":%d}", &ping_value);
-        client->ping = ping_value;
-        
-        printf("[UPDATE_PING] %s ping: %d ms, status: %d, in_game_with: %d\n", 
-               client->username, ping_value, client->status, client->in_game_with);
-        
-        // If in game, broadcast ping update to opponent
-        if (client->status == PLAYER_IN_GAME && client->in_game_with > 0) {
-            pthread_mutex_lock(&clients_mutex);
-            Client *opponent = NULL;
-            for (int i = 0; i < MAX_CLIENTS; i++) {
-                if (clients[i] != NULL && clients[i]->sock == client->in_game_with) {
-                    opponent = clients[i];
-                    break;
-                }
-            }
-            
-            if (opponent != NULL) {
-                char ping_update[BUFFER_SIZE];
-                sprintf(ping_update, "{\"cmd\":\"PING_UPDATE\",\"payload\":{\"opponent_ping\":%d}}\n", client->ping);
-                send_message(opponent->sock, ping_update);
-                printf("[UPDATE_PING] Sent to opponent %s: ping=%d\n", opponent->username, client->ping);
-            } else {
-                printf("[UPDATE_PING] Opponent not found for %s\n", client->username);
-            }
-            pthread_mutex_unlock(&clients_mutex);
-        } else {
-            printf("[UPDATE_PING] %s not in game, skipping broadcast\n", client->username);
+    pthread_detach(tid);
+    run_threaded_server(threaded_listen_fd);
+}
+
+// Threaded and epoll modes write straight from whichever thread queued the message
+void socket_flush(Client *client) {
+    flush_client_output(client);
+}
+
+// Threaded mode: the owning thread sleeps in poll() without a timeout, so
+// whatever the socket did not take is handed to it through wake_fd
+void threaded_flush(Client *client) {
+    if (!flush_client_output(client)) return;
+    pthread_mutex_lock(&client->out_mutex);
+    if (!client->out_closed && client->wake_fd >= 0) {
+        unsigned long long one = 1;
+        if (write(client->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("eventfd write failed");
         }
     }
+    pthread_mutex_unlock(&client->out_mutex);
 }
 
-void handle_client(Client *client) {
-    char buffer[BUFFER_SIZE];
-    int read_size;
-    
-    send_message(client->sock, "{\"cmd\":\"WELCOME\",\"payload\":{\"message\":\"Welcome to BattleShip Server\"}}\n");
-    
-    while ((read_size = recv(client->sock, buffer, BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[read_size] = '\0';
-        
-        // Remove newline
-        char *newline = strchr(buffer, '\n');
-        if (newline) *newline = '\0';
-        
-        printf("Received from %s (sock %d): %s\n", client->username[0] ? client->username : "unknown", client->sock, buffer);
-        
-        // Parse JSON command
-        char cmd[50] = "", payload[BUFFER_SIZE] = "";
-        char *cmd_start = strstr(buffer, "\"cmd\":\"");
-        char *payload_start = strstr(buffer, "\"payload\":");
-        
-        if (cmd_start) {
-            cmd_start += 7;
-            char *cmd_end = strchr(cmd_start, '"');
-            if (cmd_end) {
-                int len = cmd_end - cmd_start;
-                strncpy(cmd, cmd_start, len < 50 ? len : 49);
-                cmd[len < 50 ? len : 49] = '\0';
-            }
-        }
-        
-        if (payload_start) {
-            payload_start += 10;
-            char *payload_end = strrchr(payload_start, '}');
-            if (payload_end) {
-                payload_end++;
-                int len = payload_end - payload_start;
-                strncpy(payload, payload_start, len < BUFFER_SIZE ? len : BUFFER_SIZE - 1);
-                payload[len < BUFFER_SIZE ? len : BUFFER_SIZE - 1] = '\0';
-            }
-        }
-        
-        if (cmd[0]) {
-            handle_command(client, cmd, payload);
+IoBackend threaded_backend = { "threaded", threaded_init, threaded_run, threaded_flush };
+IoBackend epoll_backend = { "epoll", epoll_init, epoll_run, socket_flush };
+IoBackend uring_backend = { "io_uring", uring_init, uring_run, uring_flush };
+
+// Start one thread per reactor/ring, then report load balance from the main thread
+void run_io_threads(void *(*thread_fn)(void *)) {
+    // Threads start only after every listener is bound, so none misses the reuseport group
+    for (int i = 0; i < reactor_count; i++) {
+        if (pthread_create(&reactors[i].thread, NULL, thread_fn, &reactors[i]) != 0) {
+            perror("pthread_create reactor failed");
+            exit(EXIT_FAILURE);
         }
     }
-    
-    if (read_size == 0) {
-        printf("Client disconnected: %s (sock %d)\n", client->username, client->sock);
-    } else if (read_size == -1) {
-        printf("Recv error from client %s (sock %d): %s\n", client->username, client->sock, strerror(errno));
-    }
-    
-    handle_disconnect(client);
+    stats_thread(NULL);
 }
 
-void *client_thread(void *arg) {
-    Client *client = (Client *)arg;
-    handle_client(client);
-    close(client->sock);
-    remove_client(client->sock);
-    free(client);
-    pthread_exit(NULL);
+void print_server_stats() {
+    // Threaded mode has no reactors; everything below it applies to every mode
+    for (int i = 0; reactors && i < reactor_count; i++) {
+        if (server_mode == SERVER_MODE_URING) {
+            printf("[STATS] ring %d: accepted=%lu active=%d enters=%lu sqes=%lu\n", i,
+                   __atomic_load_n(&reactors[i].accepted, __ATOMIC_RELAXED),
+                   __atomic_load_n(&reactors[i].active, __ATOMIC_RELAXED),
+                   __atomic_load_n(&reactors[i].enters, __ATOMIC_RELAXED),
+                   __atomic_load_n(&reactors[i].sqes, __ATOMIC_RELAXED));
+        } else {
+            printf("[STATS] reactor %d: accepted=%lu active=%d\n", i,
+                   __atomic_load_n(&reactors[i].accepted, __ATOMIC_RELAXED),
+                   __atomic_load_n(&reactors[i].active, __ATOMIC_RELAXED));
+        }
+    }
+    printf("[STATS] output: messages=%lu writes=%lu\n",
+           __atomic_load_n(&out_messages, __ATOMIC_RELAXED),
+           __atomic_load_n(&out_writes, __ATOMIC_RELAXED));
+    printf("[STATS] admission: overloaded=%d queued=%lu handler_us=%lu rate_limited=%lu shed=%lu rejected=%lu\n",
+           server_overloaded(),
+           __atomic_load_n(&out_queued_bytes, __ATOMIC_RELAXED),
+           __atomic_load_n(&handler_latency_us, __ATOMIC_RELAXED),
+           __atomic_load_n(&rate_limited, __ATOMIC_RELAXED),
+           __atomic_load_n(&shed_queries, __ATOMIC_RELAXED),
+           __atomic_load_n(&rejected_connections, __ATOMIC_RELAXED));
+    unsigned long bytes_in = __atomic_load_n(&compress_bytes_in, __ATOMIC_RELAXED);
+    unsigned long bytes_out = __atomic_load_n(&compress_bytes_out, __ATOMIC_RELAXED);
+    printf("[STATS] compression: messages=%lu bytes=%lu->%lu ratio=%.2f cpu_us=%lu\n",
+           __atomic_load_n(&compress_messages, __ATOMIC_RELAXED), bytes_in, bytes_out,
+           bytes_out ? (double)bytes_in / bytes_out : 0.0,
+           __atomic_load_n(&compress_cpu_us, __ATOMIC_RELAXED));
+    pthread_mutex_lock(&query_mutex);
+    int pending = query_pending;
+    pthread_mutex_unlock(&query_mutex);
+    printf("[STATS] slow queries: answered=%lu pending=%d\n",
+           __atomic_load_n(&query_answered, __ATOMIC_RELAXED), pending);
+    LockStats stats;
+    pthread_mutex_lock(&clients_mutex);
+    stats = clients_lock_stats;
+    pthread_mutex_unlock(&clients_mutex);
+    print_lock_stats("clients", &stats);
+    pthread_mutex_lock(&games_mutex);
+    stats = games_lock_stats;
+    pthread_mutex_unlock(&games_mutex);
+    print_lock_stats("games", &stats);
+    for (int i = 0; i < game_worker_count; i++) {
+        printf("[STATS] game worker %d: sessions=%d tasks=%lu wakeups=%lu\n", i,
+               __atomic_load_n(&game_workers[i].sessions, __ATOMIC_RELAXED),
+               __atomic_load_n(&game_workers[i].tasks, __ATOMIC_RELAXED),
+               __atomic_load_n(&game_workers[i].wakeups, __ATOMIC_RELAXED));
+    }
+    unsigned long retired = __atomic_load_n(&retired_objects, __ATOMIC_RELAXED);
+    unsigned long freed = __atomic_load_n(&freed_objects, __ATOMIC_RELAXED);
+    printf("[STATS] reclaim: epoch=%lu retired=%lu freed=%lu pending=%lu\n",
+           __atomic_load_n(&global_epoch, __ATOMIC_RELAXED), retired, freed, retired - freed);
+    print_command_stats();
 }
 
-int main() {
-    int server_fd, new_socket;
+// Create a bound, listening TCP socket (SO_REUSEPORT lets several reactors share the port)
+int create_listener(int port, int reuseport) {
+    int server_fd;
     struct sockaddr_in address;
-    int addrlen = sizeof(address);
     
-    // Initialize arrays
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        clients[i] = NULL;
-    }
-    for (int i = 0; i < MAX_CLIENTS / 2; i++) {
-        game_sessions[i] = NULL;
-    }
-    
-    // Create socket
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("socket error");
         exit(EXIT_FAILURE);
     }
@@ -1507,68 +4981,150 @@ int main() {
         perror("setsockopt failed");
         exit(EXIT_FAILURE);
     }
+    if (reuseport && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT failed");
+        exit(EXIT_FAILURE);
+    }
     
+    memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(port);
     
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind error");
         exit(EXIT_FAILURE);
     }
     
-    if (listen(server_fd, MAX_CLIENTS) < 0) {
+    if (listen(server_fd, SOMAXCONN) < 0) {
         perror("listen error");
         exit(EXIT_FAILURE);
     }
     
+    return server_fd;
+}
+
+// Each client needs a descriptor (two in threaded mode, see wake_fd): lift
+// the soft RLIMIT_NOFILE towards the hard limit
+void raise_fd_limit(int clients) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) return;
+    
+    int per_client = server_mode == SERVER_MODE_THREADED ? 2 : 1;
+    rlim_t wanted = (rlim_t)clients * per_client + 64; // listeners, epoll/io_uring fds, users.dat...
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted) {
+        limit.rlim_cur = (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > wanted) ? wanted : limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted) {
+        printf("[WARN] RLIMIT_NOFILE is %lu, fewer than --max-clients %d connections will fit\n",
+               (unsigned long)limit.rlim_cur, clients);
+    }
+}
+
+void print_usage(const char *prog) {
+    printf("Usage: %s [--mode threaded|epoll|io_uring] [--reactors N] [--max-clients N]\n"
+           "          [--idle-timeout SEC] [--reconnect-grace SEC] [--game-workers N]\n", prog);
+    printf("  --mode threaded   one thread per client (default)\n");
+    printf("  --mode epoll      edge-triggered epoll reactors\n");
+    printf("  --mode io_uring   io_uring rings, falls back to epoll if unsupported\n");
+    printf("  --reactors N      number of epoll/io_uring threads (default 1, max %d)\n", MAX_REACTORS);
+    printf("  --max-clients N   connection capacity (default %d)\n", DEFAULT_MAX_CLIENTS);
+    printf("  --idle-timeout S  disconnect clients silent for S seconds (default %d, 0 = never)\n", IDLE_TIMEOUT);
+    printf("  --reconnect-grace S  keep a game S seconds for a dropped player to log back in\n"
+           "                    (default 0 = disconnect is an instant loss)\n");
+    printf("  --game-workers N  threads running game sessions (default one per core, max %d)\n", MAX_GAME_WORKERS);
+}
+
+// fuzz_commands.cpp includes this file with BATTLESHIP_NO_MAIN and drives the handlers itself
+#ifndef BATTLESHIP_NO_MAIN
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "threaded") == 0) {
+                server_mode = SERVER_MODE_THREADED;
+            } else if (strcmp(mode, "epoll") == 0) {
+                server_mode = SERVER_MODE_EPOLL;
+            } else if (strcmp(mode, "io_uring") == 0 || strcmp(mode, "uring") == 0) {
+                server_mode = SERVER_MODE_URING;
+            } else {
+                fprintf(stderr, "Unknown mode: %s\n", mode);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc) {
+            max_clients = atoi(argv[++i]);
+            if (max_clients < 1) {
+                fprintf(stderr, "--max-clients must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            idle_timeout = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reconnect-grace") == 0 && i + 1 < argc) {
+            reconnect_grace = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--game-workers") == 0 && i + 1 < argc) {
+            game_worker_count = atoi(argv[++i]);
+            if (game_worker_count < 1 || game_worker_count > MAX_GAME_WORKERS) {
+                fprintf(stderr, "--game-workers must be between 1 and %d\n", MAX_GAME_WORKERS);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--reactors") == 0 && i + 1 < argc) {
+            reactor_count = atoi(argv[++i]);
+            if (reactor_count < 1 || reactor_count > MAX_REACTORS) {
+                fprintf(stderr, "--reactors must be between 1 and %d\n", MAX_REACTORS);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            print_usage(argv[0]);
+            exit(strcmp(argv[i], "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    
+    view_versions_init();
+    
+    // Slots grow on demand up to the configured capacity
+    slot_table_init(&client_slots, max_clients);
+    slot_table_init(&game_slots, max_clients / 2 > 0 ? max_clients / 2 : 1);
+    client_index_init(&sock_index, max_clients);
+    client_index_init(&name_index, max_clients);
+    raise_fd_limit(max_clients);
+    timers_start();
+    queries_start();
+    game_workers_start();
+    
+    if (server_mode == SERVER_MODE_THREADED && reactor_count > 1) {
+        printf("[WARN] --reactors only applies to --mode epoll/io_uring, ignoring\n");
+    }
+    
+    IoBackend *backends[] = { &threaded_backend, &epoll_backend, &uring_backend };
+    io_backend = backends[server_mode];
+    if (io_backend->init(PORT) < 0) {
+        printf("[WARN] %s backend unavailable, falling back to epoll\n", io_backend->name);
+        server_mode = SERVER_MODE_EPOLL;
+        io_backend = &epoll_backend;
+        io_backend->init(PORT);
+    }
+    
     printf("╔═══════════════════════════════════════╗\n");
     printf("║   BattleShip TCP Server Started!     ║\n");
     printf("║   Port: %d                         ║\n", PORT);
-    printf("║   Max Clients: %d                   ║\n", MAX_CLIENTS);
-    printf("║   Disconnect = Instant Loss          ║\n");
+    printf("║   Max Clients: %-6d                ║\n", max_clients);
+    if (server_mode == SERVER_MODE_THREADED) {
+        printf("║   Mode: threaded                     ║\n");
+    } else {
+        printf("║   Mode: %s (%d threads)          ║\n", io_backend->name, reactor_count);
+    }
+    if (reconnect_grace > 0) {
+        printf("║   Reconnect grace: %-4ds             ║\n", reconnect_grace);
+    } else {
+        printf("║   Disconnect = Instant Loss          ║\n");
+    }
     printf("╚═══════════════════════════════════════╝\n");
     
-    while (1) {
-        new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen);
-        if (new_socket < 0) {
-            perror("accept failed");
-            continue;
-        }
-        
-        printf("New connection from %s:%d (socket: %d)\n", 
-               inet_ntoa(address.sin_addr), 
-               ntohs(address.sin_port),
-               new_socket);
-        
-        Client *client = (Client *)malloc(sizeof(Client));
-        client->sock = new_socket;
-        client->status = PLAYER_OFFLINE;
-        strcpy(client->username, "");
-        memset(client->session_token, 0, sizeof(client->session_token));
-        client->last_active = time(NULL);
-        client->address = address;
-        client->in_game_with = 0;
-        client->ready = 0;
-        client->is_turn = 0;
-        client->is_matching = 0;
-        client->match_ready = 0;
-        init_board(&client->board);
-        
-        add_client(client);
-        
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, client_thread, (void *)client) != 0) {
-            perror("pthread_create failed");
-            close(new_socket);
-            remove_client(new_socket);
-            free(client);
-            continue;
-        }
-        
-        pthread_detach(tid);
-    }
+    io_backend->run();
     
-    close(server_fd);
     return 0;
-}
\ No newline at end of file
+}
+#endif
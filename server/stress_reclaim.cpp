@@ -0,0 +1,201 @@
+// stress_reclaim.cpp - client and game churn against lock-free lookups, for ThreadSanitizer
+//
+// Build & run: make stress-tsan [ARGS=SECONDS]
+// Churn threads play the I/O threads: they connect pairs of fake clients (no
+// sockets), start a game, and disconnect them either mid-game or right after
+// the last move, while MOVEs they posted are still queued on the game
+// workers. Socket numbers and usernames are reused the way fds and logins
+// are. Meanwhile lookup threads keep finding those clients through
+// get_client(), get_client_by_username() and session_get(), and queue
+// messages to them. Any read of a freed Client or GameSession is a
+// heap-use-after-free report; at the end every retired object must be freed.
+
+#include <sys/stat.h>
+
+#define BATTLESHIP_NO_MAIN
+#include "server_full.cpp"
+
+#define CHURN_THREADS 2
+#define LOOKUP_THREADS 4
+#define STRESS_SECONDS 3
+#define STRESS_SOCK_BASE 1000000  // never a real fd
+#define STRESS_SOCKS 8            // sock numbers per churn thread, reused
+#define STRESS_MISSES 8           // MOVEs left queued when a game is dropped
+
+static const char *stress_ships =
+    "{\"ships\":[{\"name\":\"Destroyer\",\"size\":1,\"row\":0,\"col\":0,\"horizontal\":true}]}";
+
+static int stress_init(int port) { (void)port; return 0; }
+static void stress_run() {}
+
+static void stress_flush(Client *client) {
+    pthread_mutex_lock(&client->out_mutex);
+    out_drop(client);
+    pthread_mutex_unlock(&client->out_mutex);
+}
+
+static IoBackend stress_backend = { "stress", stress_init, stress_run, stress_flush };
+
+static volatile int stress_stop = 0;
+static unsigned long games_played = 0;
+static unsigned long lookups = 0;
+static unsigned long lookup_hits = 0;
+static unsigned long session_hits = 0;
+
+static void stress_name(char *name, int thread, int index) {
+    snprintf(name, USERNAME_SIZE, "stress_%d_%d", thread, index % STRESS_SOCKS);
+}
+
+static Client *stress_connect(int thread, int index) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    Client *client = create_client(STRESS_SOCK_BASE + thread * STRESS_SOCKS + index % STRESS_SOCKS, &address);
+    if (!client) {
+        fprintf(stderr, "create_client failed\n");
+        exit(EXIT_FAILURE);
+    }
+    char name[USERNAME_SIZE];
+    stress_name(name, thread, index);
+    set_username(client, name);
+    store_status(client, PLAYER_ONLINE);
+    return client;
+}
+
+static void stress_place_ships(Client *client) {
+    char buffer[256];
+    JsonDoc doc;
+    strcpy(buffer, stress_ships);
+    if (json_tokenize(&doc, buffer, strlen(buffer)) != 0) {
+        fprintf(stderr, "bad ship layout\n");
+        exit(EXIT_FAILURE);
+    }
+    handle_place_ships(client, &doc, json_find(&doc, 0, "ships"));
+}
+
+static void post_misses(Client *players[2]) {
+    char coord[4];
+    for (int i = 0; i < STRESS_MISSES; i++) {
+        snprintf(coord, sizeof(coord), "B%d", i);
+        handle_move(players[0], coord);
+        handle_move(players[1], coord);
+    }
+}
+
+static void *churn_thread(void *arg) {
+    int thread = (int)(long)arg;
+    for (int round = 0; !__atomic_load_n(&stress_stop, __ATOMIC_RELAXED); round++) {
+        Client *players[2];
+        players[0] = stress_connect(thread, 2 * round);
+        players[1] = stress_connect(thread, 2 * round + 1);
+        start_game(players[0], players[1]);
+        stress_place_ships(players[0]);
+        stress_place_ships(players[1]);
+
+        if (round % 2) {
+            // Whoever has the turn sinks the only ship; the misses queued behind
+            // it still hold both clients when they are released below
+            handle_move(players[0], "A0");
+            handle_move(players[1], "A0");
+            post_misses(players);
+            while (__atomic_load_n(&players[0]->session, __ATOMIC_ACQUIRE)) sched_yield();
+        } else {
+            post_misses(players); // dropped mid-game: the opponent wins on disconnect
+        }
+
+        for (int i = 0; i < 2; i++) {
+            handle_disconnect(players[i]);
+            release_client(players[i]);
+        }
+        __atomic_add_fetch(&games_played, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void *lookup_thread(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg;
+    char name[USERNAME_SIZE];
+    unsigned long count = 0, hits = 0, sessions = 0;
+    while (!__atomic_load_n(&stress_stop, __ATOMIC_RELAXED)) {
+        int thread = rand_r(&seed) % CHURN_THREADS;
+        int index = rand_r(&seed) % STRESS_SOCKS;
+
+        epoch_enter();
+        Client *client = get_client(STRESS_SOCK_BASE + thread * STRESS_SOCKS + index);
+        if (client) {
+            hits++;
+            send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"message\":\"stress\"}}\n");
+            GameSession *session = session_get(client);
+            if (session) {
+                sessions += session->id != 0;
+                session_put(session);
+            }
+        }
+        stress_name(name, thread, index);
+        client = get_client_by_username(name);
+        if (client) {
+            hits++;
+            send_to_client(client, "{\"cmd\":\"SYSTEM_MSG\",\"payload\":{\"message\":\"stress\"}}\n");
+        }
+        epoch_exit();
+        flush_pending_output();
+        count += 2;
+    }
+    __atomic_add_fetch(&lookups, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lookup_hits, hits, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&session_hits, sessions, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : STRESS_SECONDS;
+
+    char dir[] = "/tmp/battleship-stress-XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0 || mkdir("history", 0755) != 0) {
+        perror("stress workspace");
+        return EXIT_FAILURE;
+    }
+    // Keep the per-game logging out of the way; results go to stderr
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+        return EXIT_FAILURE;
+    }
+
+    slot_table_init(&client_slots, DEFAULT_MAX_CLIENTS);
+    slot_table_init(&game_slots, DEFAULT_MAX_CLIENTS / 2);
+    client_index_init(&sock_index, DEFAULT_MAX_CLIENTS);
+    client_index_init(&name_index, DEFAULT_MAX_CLIENTS);
+    io_backend = &stress_backend;
+    timers_init();
+    game_workers_start();
+    idle_timeout = 0;
+
+    pthread_t churn[CHURN_THREADS], lookup[LOOKUP_THREADS];
+    for (int i = 0; i < CHURN_THREADS; i++) {
+        pthread_create(&churn[i], NULL, churn_thread, (void *)(long)i);
+    }
+    for (int i = 0; i < LOOKUP_THREADS; i++) {
+        pthread_create(&lookup[i], NULL, lookup_thread, (void *)(long)(i + 1));
+    }
+    sleep(seconds);
+    __atomic_store_n(&stress_stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < CHURN_THREADS; i++) pthread_join(churn[i], NULL);
+    for (int i = 0; i < LOOKUP_THREADS; i++) pthread_join(lookup[i], NULL);
+
+    // Let the workers finish what is queued, then reclaim everything retired
+    for (int i = 0; i < 100 && __atomic_load_n(&freed_objects, __ATOMIC_RELAXED) <
+                               __atomic_load_n(&retired_objects, __ATOMIC_RELAXED); i++) {
+        usleep(10000);
+        epoch_reclaim();
+    }
+
+    unsigned long retired = __atomic_load_n(&retired_objects, __ATOMIC_RELAXED);
+    unsigned long freed = __atomic_load_n(&freed_objects, __ATOMIC_RELAXED);
+    fprintf(stderr, "%lu games, %lu lookups (%lu hits, %lu in a game), epoch %lu\n",
+            games_played, lookups, lookup_hits, session_hits, global_epoch);
+    fprintf(stderr, "retired %lu clients and sessions, freed %lu\n", retired, freed);
+    if (freed != retired || games_played == 0) {
+        fprintf(stderr, "FAIL: %s\n", games_played ? "retired objects never freed" : "no game completed");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}